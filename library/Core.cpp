@@ -38,6 +38,7 @@ distribution.
 #include "ModuleFactory.h"
 #include "RemoteServer.h"
 #include "RemoteTools.h"
+#include "Trace.h"
 #include "LuaTools.h"
 #include "DFHackVersion.h"
 #include "md5wrapper.h"
@@ -67,6 +68,7 @@ distribution.
 
 #include <stdio.h>
 #include <iomanip>
+#include <algorithm>
 #include <stdlib.h>
 #include <fstream>
 #include <thread>
@@ -142,9 +144,53 @@ struct Core::Private
     bool was_load_save{false};
 };
 
+size_t PerfHistogram::getBucket(uint64_t us) {
+    if (us < LINEAR_BUCKETS)
+        return us;
+    size_t msb = 63;
+    while (!(us & (uint64_t(1) << msb)))
+        --msb;
+    size_t sub = (us >> (msb - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1);
+    return LINEAR_BUCKETS + ((msb - 4) << SUB_BUCKET_BITS) + sub;
+}
+
+uint64_t PerfHistogram::getBucketUpperBound(size_t bucket) {
+    if (bucket < LINEAR_BUCKETS)
+        return bucket;
+    size_t msb = ((bucket - LINEAR_BUCKETS) >> SUB_BUCKET_BITS) + 4;
+    uint64_t sub = (bucket - LINEAR_BUCKETS) & ((1 << SUB_BUCKET_BITS) - 1);
+    uint64_t lower = (uint64_t(1) << msb) | (sub << (msb - SUB_BUCKET_BITS));
+    return lower + (uint64_t(1) << (msb - SUB_BUCKET_BITS)) - 1;
+}
+
+void PerfHistogram::record(uint64_t us) {
+    ++buckets[getBucket(us)];
+    ++count;
+    total_us += us;
+    if (us > max_us)
+        max_us = us;
+}
+
+uint64_t PerfHistogram::getPercentile(double pct) const {
+    if (!count)
+        return 0;
+    uint64_t target = uint64_t(count * std::clamp(pct, 0.0, 100.0) / 100.0 + 0.5);
+    if (target < 1)
+        target = 1;
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= target)
+            return std::min(getBucketUpperBound(bucket), max_us);
+    }
+    return max_us;
+}
+
 void PerfCounters::reset(bool ignorePauseState) {
+    bool histogramsEnabled = histograms_enabled;
     *this = {};
     ignore_pause_state = ignorePauseState;
+    histograms_enabled = histogramsEnabled;
     baseline_elapsed_ms = Core::getInstance().p->getTickCount();
 }
 
@@ -154,6 +200,18 @@ void PerfCounters::incCounter(uint32_t &counter, uint32_t baseline_ms) {
     counter += Core::getInstance().p->getTickCount() - baseline_ms;
 }
 
+void PerfCounters::incCount(uint32_t &counter, uint32_t amount) {
+    if (!ignore_pause_state && (!World::isFortressMode() || World::ReadPauseState()))
+        return;
+    counter += amount;
+}
+
+void PerfCounters::recordLatency(PerfHistogram &histogram, uint64_t baseline_us) {
+    if (!ignore_pause_state && (!World::isFortressMode() || World::ReadPauseState()))
+        return;
+    histogram.record(getTimestampUs() - baseline_us);
+}
+
 bool PerfCounters::getIgnorePauseState() {
     return ignore_pause_state;
 }
@@ -1256,6 +1314,42 @@ command_result Core::runCommand(color_ostream &con, const std::string &first_, s
             return CR_WRONG_USAGE;
         }
     }
+    else if (first == "devel/trace")
+    {
+        if (parts.size() == 1 && (parts[0] == "enable" || parts[0] == "disable"))
+        {
+            Trace::setEnabled(parts[0] == "enable");
+            con.print("Tracing %s.\n", Trace::isEnabled() ? "enabled" : "disabled");
+        }
+        else if (parts.size() == 1 && parts[0] == "status")
+        {
+            con.print("Tracing is %s.\n", Trace::isEnabled() ? "enabled" : "disabled");
+        }
+        else if ((parts.size() == 2 || parts.size() == 3) && parts[0] == "dump")
+        {
+            int seconds = 10;
+            if (parts.size() == 3 && (seconds = string_to_int(parts[2], -1)) <= 0)
+            {
+                con.printerr("Invalid number of seconds: %s\n", parts[2].c_str());
+                return CR_WRONG_USAGE;
+            }
+            std::ofstream file(parts[1]);
+            if (!file)
+            {
+                con.printerr("Could not open %s for writing\n", parts[1].c_str());
+                return CR_FAILURE;
+            }
+            size_t count = Trace::dumpChromeTrace(file, seconds);
+            con.print("Wrote %zu spans from the last %d seconds to %s\n", count, seconds, parts[1].c_str());
+        }
+        else
+        {
+            con << "Usage:" << std::endl
+                << "  devel/trace enable|disable|status" << std::endl
+                << "  devel/trace dump <filename> [<seconds>]" << std::endl;
+            return CR_WRONG_USAGE;
+        }
+    }
     else if (first == "devel/dump-rpc")
     {
         if (parts.size() == 1)
@@ -2123,21 +2217,36 @@ int Core::Update()
                 return -1;
         }
 
+        frame_count++;
         uint32_t start_ms = p->getTickCount();
         unpaused_ms += perf_counters.registerTick(start_ms);
-        doUpdate(out);
+        {
+            DFHACK_TRACE_SPAN("Core::doUpdate");
+            doUpdate(out);
+        }
         perf_counters.incCounter(perf_counters.total_update_ms, start_ms);
     }
 
+    // Run the remote calls that were queued for this frame while we still
+    // hold the suspend lock
+    ServerMain::runBatchedCalls();
+
     // Let all commands run that require CoreSuspender
     CoreWakeup.wait(MainThread::suspend(),
             [this]() -> bool {return this->toolCount.load() == 0;});
 
+    // DF may copy the save folder as soon as it runs again, so the files of
+    // a save started this frame must be complete before we return. Writing
+    // them still overlaps with the rest of the frame's work above.
+    Persistence::Internal::finishSave(out);
+
     return 0;
 };
 
 extern bool buildings_do_onupdate;
 void buildings_onStateChange(color_ostream &out, state_change_event event);
+void materials_onStateChange(color_ostream &out, state_change_event event);
+void items_onStateChange(color_ostream &out, state_change_event event);
 void buildings_onUpdate(color_ostream &out);
 
 static int buildings_timer = 0;
@@ -2147,7 +2256,10 @@ void Core::onUpdate(color_ostream &out)
     Gui::clearFocusStringCache();
 
     uint32_t step_start_ms = p->getTickCount();
-    EventManager::manageEvents(out);
+    {
+        DFHACK_TRACE_SPAN("EventManager::manageEvents");
+        EventManager::manageEvents(out);
+    }
     perf_counters.incCounter(perf_counters.update_event_manager_ms, step_start_ms);
 
     // convert building reagents
@@ -2156,12 +2268,18 @@ void Core::onUpdate(color_ostream &out)
 
     // notify all the plugins that a game tick is finished
     step_start_ms = p->getTickCount();
-    plug_mgr->OnUpdate(out);
+    {
+        DFHACK_TRACE_SPAN("PluginManager::OnUpdate");
+        plug_mgr->OnUpdate(out);
+    }
     perf_counters.incCounter(perf_counters.update_plugin_ms, step_start_ms);
 
     // process timers in lua
     step_start_ms = p->getTickCount();
-    Lua::Core::onUpdate(out);
+    {
+        DFHACK_TRACE_SPAN("Lua::Core::onUpdate");
+        Lua::Core::onUpdate(out);
+    }
     perf_counters.incCounter(perf_counters.update_lua_ms, step_start_ms);
 }
 
@@ -2372,6 +2490,8 @@ void Core::onStateChange(color_ostream &out, state_change_event event)
     EventManager::onStateChange(out, event);
 
     buildings_onStateChange(out, event);
+    materials_onStateChange(out, event);
+    items_onStateChange(out, event);
 
     plug_mgr->OnStateChange(out, event);
 
@@ -2412,6 +2532,8 @@ int Core::Shutdown ( void )
     d->hotkeythread.join();
     d->iothread.join();
 
+    Persistence::Internal::finishSave(con);
+
     if(plug_mgr)
     {
         delete plug_mgr;
@@ -2498,6 +2620,7 @@ void Core::setArmokTools(const std::vector<std::string> &tool_names) {
 
 // returns true if the event is handled
 bool Core::DFH_SDL_Event(SDL_Event* ev) {
+    DFHACK_TRACE_SPAN("Core::doSdlInputEvent");
     uint32_t start_ms = p->getTickCount();
     bool ret = doSdlInputEvent(ev);
     perf_counters.incCounter(perf_counters.total_keybinding_ms, start_ms);
@@ -0,0 +1,142 @@
+#include "modules/EventManager.h"
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <vector>
+
+using namespace DFHack;
+using EventManager::EventHandler;
+using EventManager::HandlerList;
+
+// counts the allocations made by this thread while counting is on
+static thread_local bool counting = false;
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+    if (counting)
+        ++allocations;
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// The handlers are never called through these, so any distinct addresses will do.
+static std::vector<Plugin *> fakePlugins(size_t count) {
+    static char storage[64];
+    std::vector<Plugin *> plugins;
+    for (size_t idx = 0; idx < count; ++idx)
+        plugins.push_back(reinterpret_cast<Plugin *>(&storage[(idx * 37) % count]));
+    return plugins;
+}
+
+static void noop(color_ostream &, void *) {}
+
+TEST(EventManagerHandlers, empty) {
+    HandlerList list;
+    EXPECT_TRUE(list.empty());
+    ASSERT_TRUE(list.snapshot());
+    EXPECT_TRUE(list.snapshot()->empty());
+    EXPECT_FALSE(list.removeIf([](const EventHandler &) { return true; }));
+}
+
+// the order handlers are called in is the one the multimap they used to be
+// stored in gave: grouped by plugin, then in registration order
+TEST(EventManagerHandlers, order) {
+    auto plugins = fakePlugins(20);
+    HandlerList list;
+    std::multimap<Plugin *, EventHandler> reference;
+    for (int idx = 0; idx < 60; ++idx) {
+        EventHandler handler(plugins[(idx * 7) % plugins.size()], noop, idx);
+        list.add(handler);
+        reference.emplace(handler.plugin, handler);
+    }
+
+    auto check = [&]() {
+        auto snapshot = list.snapshot();
+        ASSERT_EQ(snapshot->size(), reference.size());
+        size_t idx = 0;
+        for (auto &entry : reference) {
+            EXPECT_EQ((*snapshot)[idx], entry.second) << "handler " << idx;
+            ++idx;
+        }
+    };
+    check();
+
+    list.removeIf([&](const EventHandler &h) { return h.plugin == plugins[3]; });
+    reference.erase(plugins[3]);
+    check();
+}
+
+TEST(EventManagerHandlers, snapshot_outlives_removal) {
+    auto plugins = fakePlugins(2);
+    HandlerList list;
+    list.add(EventHandler(plugins[0], noop, 1));
+    list.add(EventHandler(plugins[1], noop, 2));
+    uint32_t epoch = list.epoch();
+
+    auto snapshot = list.snapshot();
+    EXPECT_TRUE(list.removeIf([](const EventHandler &h) { return h.freq == 1; }));
+    EXPECT_NE(list.epoch(), epoch);
+    EXPECT_EQ(snapshot->size(), 2u);
+    EXPECT_EQ(list.snapshot()->size(), 1u);
+
+    EXPECT_FALSE(list.removeIf([](const EventHandler &h) { return h.freq == 1; }));
+    EXPECT_TRUE(list.removeIf([](const EventHandler &h) { return h.freq == 2; }));
+    EXPECT_TRUE(list.empty());
+}
+
+// Dispatch with 20 plugins registered, against the per-dispatch multimap copy
+// it replaced. The allocation counts are checked; the timings are recorded as
+// test properties.
+TEST(EventManagerHandlers, dispatch_allocations) {
+    const int dispatches = 100000;
+    auto plugins = fakePlugins(20);
+    HandlerList list;
+    std::multimap<Plugin *, EventHandler> old_handlers;
+    for (auto plugin : plugins) {
+        list.add(EventHandler(plugin, noop, 0));
+        old_handlers.emplace(plugin, EventHandler(plugin, noop, 0));
+    }
+
+    int32_t calls = 0;
+    auto measure = [&](const char *name, auto dispatch) {
+        allocations = 0;
+        counting = true;
+        auto start = std::chrono::steady_clock::now();
+        for (int idx = 0; idx < dispatches; ++idx)
+            dispatch();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        counting = false;
+        RecordProperty(std::string(name) + "_allocations_per_dispatch", std::to_string(allocations / dispatches));
+        RecordProperty(std::string(name) + "_ns_per_dispatch", std::to_string(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / dispatches));
+        return size_t(allocations);
+    };
+
+    size_t old_allocations = measure("multimap_copy", [&]() {
+        std::multimap<Plugin *, EventHandler> copy(old_handlers.begin(), old_handlers.end());
+        for (auto &entry : copy)
+            calls += entry.second.freq + 1;
+    });
+    size_t new_allocations = measure("snapshot", [&]() {
+        auto handles = list.snapshot();
+        for (auto &handle : *handles)
+            calls += handle.freq + 1;
+    });
+
+    EXPECT_EQ(calls, 2 * dispatches * 20);
+    EXPECT_GE(old_allocations, size_t(dispatches) * 20);
+    EXPECT_EQ(new_allocations, 0u);
+}
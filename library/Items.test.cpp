@@ -0,0 +1,114 @@
+#include "modules/Items.h"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace DFHack;
+using Items::NearestItemIndex;
+
+// The index never looks inside the items, so any distinct addresses will do.
+static std::vector<df::item *> fakeItems(size_t count) {
+    static std::vector<char> storage;
+    storage.resize(std::max(storage.size(), count));
+    std::vector<df::item *> items;
+    for (size_t idx = 0; idx < count; ++idx)
+        items.push_back(reinterpret_cast<df::item *>(&storage[idx]));
+    return items;
+}
+
+// the first remaining item at the smallest distance, in order of addition
+static df::item *bruteForceNearest(const std::vector<df::item *> &items, const std::vector<df::coord> &positions,
+        const std::vector<bool> &removed, df::coord pos, int *distance) {
+    df::item *best = NULL;
+    int best_dist = 0;
+    for (size_t idx = 0; idx < items.size(); ++idx) {
+        if (removed[idx] || !positions[idx].isValid())
+            continue;
+        int dist = NearestItemIndex::distance(pos, positions[idx]);
+        if (!best || dist < best_dist)
+            best = items[idx], best_dist = dist;
+    }
+    *distance = best_dist;
+    return best;
+}
+
+TEST(NearestItemIndex, empty) {
+    NearestItemIndex index;
+    EXPECT_TRUE(index.empty());
+    EXPECT_EQ(index.findNearest(df::coord(10, 10, 10)), nullptr);
+    EXPECT_FALSE(index.remove(fakeItems(1)[0]));
+}
+
+TEST(NearestItemIndex, invalid_position) {
+    auto items = fakeItems(2);
+    df::coord nowhere;
+    nowhere.clear();
+
+    NearestItemIndex index;
+    index.add(items[0], nowhere);
+    EXPECT_TRUE(index.empty());
+    index.add(items[1], df::coord(5, 5, 5));
+    EXPECT_EQ(index.size(), 1u);
+    EXPECT_EQ(index.findNearest(df::coord(0, 0, 0)), items[1]);
+    EXPECT_FALSE(index.remove(items[0]));
+}
+
+TEST(NearestItemIndex, ties) {
+    auto items = fakeItems(4);
+    NearestItemIndex index;
+    // all at distance 3 from (20, 20, 5), on both sides of a block edge
+    index.add(items[0], df::coord(23, 17, 5));
+    index.add(items[1], df::coord(17, 20, 5));
+    index.add(items[2], df::coord(20, 20, 8));
+    index.add(items[3], df::coord(14, 20, 5));
+
+    int dist = -1;
+    EXPECT_EQ(index.findNearest(df::coord(20, 20, 5), &dist), items[0]);
+    EXPECT_EQ(dist, 3);
+    index.remove(items[0]);
+    EXPECT_EQ(index.findNearest(df::coord(20, 20, 5)), items[1]);
+    index.remove(items[1]);
+    EXPECT_EQ(index.findNearest(df::coord(20, 20, 5)), items[2]);
+    index.remove(items[2]);
+    EXPECT_EQ(index.findNearest(df::coord(20, 20, 5), &dist), items[3]);
+    EXPECT_EQ(dist, 6);
+}
+
+// random items and queries, with removals in between, against a linear scan.
+// Positions are drawn from a small area so that ties are common.
+TEST(NearestItemIndex, matches_brute_force) {
+    std::mt19937 rng(1234);
+    for (int span : {8, 40, 300}) {
+        auto coord_in = [&](int lo, int hi) { return int16_t(std::uniform_int_distribution<int>(lo, hi)(rng)); };
+        auto items = fakeItems(500);
+        std::vector<df::coord> positions;
+        std::vector<bool> removed(items.size());
+
+        NearestItemIndex index;
+        for (auto item : items) {
+            df::coord pos(coord_in(0, span), coord_in(0, span), coord_in(0, span / 8));
+            if (coord_in(0, 49) == 0)
+                pos.clear();
+            positions.push_back(pos);
+            index.add(item, pos);
+        }
+
+        for (int query = 0; query < 2000; ++query) {
+            df::coord pos(coord_in(0, span + 20), coord_in(0, span + 20), coord_in(0, span / 8 + 2));
+            int expected_dist = -1, dist = -1;
+            auto expected = bruteForceNearest(items, positions, removed, pos, &expected_dist);
+            auto found = index.findNearest(pos, &dist);
+            ASSERT_EQ(found, expected) << "span " << span << " query " << query;
+            if (!found)
+                break;
+            ASSERT_EQ(dist, expected_dist);
+            if (query % 3 == 0) {
+                size_t idx = std::find(items.begin(), items.end(), found) - items.begin();
+                EXPECT_TRUE(index.remove(found));
+                removed[idx] = true;
+            }
+        }
+    }
+}
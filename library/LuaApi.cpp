@@ -37,6 +37,7 @@ distribution.
 #include "LuaWrapper.h"
 #include "md5wrapper.h"
 #include "MiscUtils.h"
+#include "Trace.h"
 #include "PluginManager.h"
 
 #include "modules/Buildings.h"
@@ -291,7 +292,7 @@ static PersistentDataItem get_world_data(lua_State *L) {
 static int dfhack_persistent_get_data_string(lua_State *L, get_data_fn get_data) {
     CoreSuspender suspend;
 
-    PersistentDataItem data = get_data(L);
+    const PersistentDataItem data = get_data(L);
 
     if (!data.isValid())
         lua_pushnil(L);
@@ -357,6 +358,34 @@ static int dfhack_persistent_delete_world_data(lua_State *L) {
     return delete_site_data(L, get_world_data);
 }
 
+static int dfhack_persistent_for_each_data(lua_State *L, int entity_id) {
+    const char *prefix = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    bool ok = Persistence::forEachByPrefix(entity_id, prefix, [&](const PersistentDataItem &data) {
+        lua_pushvalue(L, 2);
+        Lua::Push(L, data.key());
+        Lua::Push(L, data.val());
+        lua_call(L, 2, 1);
+        bool more = lua_isnil(L, -1) || lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        return more;
+    });
+    if (!ok)
+        luaL_error(L, "persistent data modified during iteration");
+
+    return 0;
+}
+
+static int dfhack_persistent_for_each_site_data(lua_State *L) {
+    CoreSuspender suspend;
+    return dfhack_persistent_for_each_data(L, World::GetCurrentSiteId());
+}
+
+static int dfhack_persistent_for_each_world_data(lua_State *L) {
+    return dfhack_persistent_for_each_data(L, Persistence::WORLD_ENTITY_ID);
+}
+
 static int dfhack_persistent_get_unsaved_seconds(lua_State *L) {
     lua_pushinteger(L, Persistence::getUnsavedSeconds());
     return 1;
@@ -369,6 +398,8 @@ static const luaL_Reg dfhack_persistent_funcs[] = {
     { "getWorldDataString", dfhack_persistent_get_world_data_string },
     { "saveWorldDataString", dfhack_persistent_save_world_data_string },
     { "deleteWorldData", dfhack_persistent_delete_world_data },
+    { "forEachSiteData", dfhack_persistent_for_each_site_data },
+    { "forEachWorldData", dfhack_persistent_for_each_world_data },
     { "getUnsavedSeconds", dfhack_persistent_get_unsaved_seconds },
     { NULL, NULL }
 };
@@ -1411,6 +1442,7 @@ static const LuaWrapper::FunctionReg dfhack_module[] = {
 
 static const luaL_Reg dfhack_funcs[] = {
     { "getCommandHistory", getCommandHistory },
+    { "columns", LuaWrapper::read_columns },
     { NULL, NULL }
 };
 
@@ -2204,6 +2236,47 @@ static int units_isUnitInBox(lua_State *state) {
     return 1;
 }
 
+// returns a filter that calls the lua function at fn_arg, or accepts
+// everything if that argument is absent or nil
+static std::function<bool(df::unit *)> units_lua_filter(lua_State *state, int fn_arg) {
+    if (lua_isnoneornil(state, fn_arg))
+        return [](df::unit *) { return true; };
+    luaL_checktype(state, fn_arg, LUA_TFUNCTION);
+    return [state, fn_arg](df::unit *unit) {
+        lua_pushvalue(state, fn_arg);
+        Lua::PushDFObject(state, unit);
+        lua_call(state, 1, 1);
+        bool ret = lua_toboolean(state, -1);
+        lua_pop(state, 1);
+        return ret;
+    };
+}
+
+static int units_getUnitsInRadius(lua_State *state) {
+    df::coord center;
+    Lua::CheckDFAssign(state, &center, 1);
+    int radius = luaL_checkint(state, 2);
+    auto filter = units_lua_filter(state, 3);
+
+    vector<df::unit *> units;
+    Units::getUnitsInRadius(units, center, radius, filter);
+    Lua::PushVector(state, units);
+    return 1;
+}
+
+static int units_getNearestUnits(lua_State *state) {
+    df::coord pos;
+    Lua::CheckDFAssign(state, &pos, 1);
+    int count = luaL_checkint(state, 2);
+    auto filter = units_lua_filter(state, 3);
+
+    vector<df::unit *> units;
+    if (count > 0)
+        Units::getNearestUnits(units, pos, count, filter);
+    Lua::PushVector(state, units);
+    return 1;
+}
+
 static int units_getUnitsInBox(lua_State *state) {
     vector<df::unit *> units;
     cuboid box;
@@ -2352,6 +2425,8 @@ static const luaL_Reg dfhack_units_funcs[] = {
     { "getNoblePositions", units_getNoblePositions },
     { "isUnitInBox", units_isUnitInBox },
     { "getUnitsInBox", units_getUnitsInBox },
+    { "getUnitsInRadius", units_getUnitsInRadius },
+    { "getNearestUnits", units_getNearestUnits },
     { "getCitizens", units_getCitizens },
     { "getUnitsByNobleRole", units_getUnitsByNobleRole},
     { "getCasteRaw", units_getCasteRaw},
@@ -2395,6 +2470,7 @@ static const LuaWrapper::FunctionReg dfhack_items_module[] = {
     WRAPM(Items, isCasteMaterial),
     WRAPM(Items, getSubtypeCount),
     WRAPM(Items, getSubtypeDef),
+    WRAPM(Items, getCensusFlags),
     WRAPM(Items, getGeneralRef),
     WRAPM(Items, getSpecificRef),
     WRAPM(Items, getOwner),
@@ -2479,6 +2555,21 @@ static int items_moveToInventory(lua_State *state) {
     return 1;
 }
 
+static int items_getCensusCount(lua_State *state)
+{
+    auto itype = (df::item_type)luaL_checkint(state, 1);
+    int subtype = luaL_optint(state, 2, -1);
+    int mat_type = luaL_optint(state, 3, -1);
+    int mat_index = luaL_optint(state, 4, -1);
+    uint32_t exclude_flags = (uint32_t)luaL_optnumber(state, 5, 0);
+    int max_wear = luaL_optint(state, 6, 3);
+
+    auto count = Items::getCensusCount(itype, subtype, mat_type, mat_index, exclude_flags, max_wear);
+    lua_pushinteger(state, count.items);
+    lua_pushinteger(state, count.stack);
+    return 2;
+}
+
 static int items_createItem(lua_State *state)
 {
     auto unit = Lua::CheckDFObject<df::unit>(state, 1);
@@ -2503,6 +2594,7 @@ static const luaL_Reg dfhack_items_funcs[] = {
     { "moveToBuilding", items_moveToBuilding },
     { "moveToInventory", items_moveToInventory },
     { "createItem", items_createItem },
+    { "getCensusCount", items_getCensusCount },
     { NULL, NULL }
 };
 
@@ -2804,6 +2896,30 @@ static int buildings_findCivzonesAt(lua_State *L)
     return 1;
 }
 
+static int buildings_getBuildingsInBox(lua_State *L)
+{
+    cuboid box;
+    int flag_arg;
+    if (lua_gettop(L) > 3) {
+        box = cuboid(luaL_checkint(L, 1), luaL_checkint(L, 2), luaL_checkint(L, 3),
+                     luaL_checkint(L, 4), luaL_checkint(L, 5), luaL_checkint(L, 6));
+        flag_arg = 7;
+    }
+    else {
+        df::coord pos1, pos2;
+        Lua::CheckDFAssign(L, &pos1, 1);
+        Lua::CheckDFAssign(L, &pos2, 2);
+        box = cuboid(pos1, pos2);
+        flag_arg = 3;
+    }
+    bool include_civzones = lua_isnoneornil(L, flag_arg) || lua_toboolean(L, flag_arg);
+
+    vector<df::building *> buildings;
+    Buildings::getBuildingsInBox(buildings, box, include_civzones);
+    Lua::PushVector(L, buildings);
+    return 1;
+}
+
 static int buildings_findPenPitAt(lua_State *L)
 {
     auto pos = CheckCoordXYZ(L, 1, true);
@@ -2875,6 +2991,7 @@ static int buildings_getCageOccupants(lua_State *state)
 static const luaL_Reg dfhack_buildings_funcs[] = {
     { "findAtTile", buildings_findAtTile },
     { "findCivzonesAt", buildings_findCivzonesAt },
+    { "getBuildingsInBox", buildings_getBuildingsInBox },
     { "getCorrectSize", buildings_getCorrectSize },
     CWRAP(setSize, buildings_setSize),
     CWRAP(getStockpileContents, buildings_getStockpileContents),
@@ -3502,6 +3619,42 @@ static void recordRepeatRuntime(string name, uint32_t start_ms) {
     counters.incCounter(counters.update_lua_per_repeat[name.c_str()], start_ms);
 }
 
+static void recordRepeatLatency(string name, uint64_t start_us) {
+    auto & counters = Core::getInstance().perf_counters;
+    if (counters.getHistogramsEnabled())
+        counters.recordLatency(counters.update_lua_per_repeat_us[name], start_us);
+}
+
+static uint64_t getPerfTimestampUs() {
+    return PerfCounters::getTimestampUs();
+}
+
+static bool getPerfHistogramsEnabled() {
+    return Core::getInstance().perf_counters.getHistogramsEnabled();
+}
+
+static void setPerfHistogramsEnabled(bool enabled) {
+    Core::getInstance().perf_counters.setHistogramsEnabled(enabled);
+}
+
+static string getPersistenceSaveFormat() {
+    return Persistence::getSaveFormat() == Persistence::SaveFormat::JSON ? "json" : "binary";
+}
+
+static void setPersistenceSaveFormat(string format) {
+    CHECK_INVALID_ARGUMENT(format == "json" || format == "binary");
+    Persistence::setSaveFormat(format == "json" ? Persistence::SaveFormat::JSON : Persistence::SaveFormat::BINARY);
+}
+
+static bool isTraceEnabled() {
+    return Trace::isEnabled();
+}
+
+static void recordTraceSpan(string name, uint64_t start_us) {
+    if (Trace::isEnabled())
+        Trace::record(Trace::internName(name), start_us, PerfCounters::getTimestampUs());
+}
+
 static void recordZScreenRuntime(string name, uint32_t start_ms) {
     auto & counters = Core::getInstance().perf_counters;
     counters.incCounter(counters.zscreen_per_focus[name.c_str()], start_ms);
@@ -3551,7 +3704,15 @@ static const LuaWrapper::FunctionReg dfhack_internal_module[] = {
     WRAP(setClipboardTextCp437Multiline),
     WRAP(resetPerfCounters),
     WRAP(recordRepeatRuntime),
+    WRAP(recordRepeatLatency),
+    WRAP(getPerfTimestampUs),
+    WRAP(getPerfHistogramsEnabled),
+    WRAP(setPerfHistogramsEnabled),
+    WRAP(getPersistenceSaveFormat),
+    WRAP(setPersistenceSaveFormat),
     WRAP(recordZScreenRuntime),
+    WRAP(isTraceEnabled),
+    WRAP(recordTraceSpan),
     WRAP(getUnpausedFps),
     WRAP(setPreferredNumberFormat),
     { NULL, NULL }
@@ -4228,6 +4389,9 @@ static int internal_getPerfCounters(lua_State *L) {
     summary["update_lua_ms"] = counters.update_lua_ms;
     summary["total_keybinding_ms"] = counters.total_keybinding_ms;
     summary["total_overlay_ms"] = counters.total_overlay_ms;
+    summary["rpc_batched_calls"] = counters.rpc_batched_calls;
+    summary["rpc_deferred_calls"] = counters.rpc_deferred_calls;
+    summary["rpc_max_queue_depth"] = counters.rpc_max_queue_depth;
     summary["total_zscreen_ms"] = std::accumulate(
         std::begin(counters.zscreen_per_focus), std::end(counters.zscreen_per_focus), 0,
         [](const uint32_t prev, const std::pair<const string, uint32_t>& p){ return prev + p.second; });
@@ -4239,7 +4403,49 @@ static int internal_getPerfCounters(lua_State *L) {
     Lua::Push(L, counters.update_lua_per_repeat);
     Lua::Push(L, counters.overlay_per_widget);
     Lua::Push(L, counters.zscreen_per_focus);
-    return 8;
+    Lua::Push(L, translate_event_types(counters.event_manager_event_scanned));
+    return 9;
+}
+
+static void push_histogram(lua_State *L, const PerfHistogram &histogram) {
+    lua_createtable(L, 0, 6);
+    Lua::SetField(L, histogram.count, -1, "count");
+    Lua::SetField(L, histogram.total_us, -1, "total_us");
+    Lua::SetField(L, histogram.max_us, -1, "max_us");
+    Lua::SetField(L, histogram.getPercentile(50), -1, "p50_us");
+    Lua::SetField(L, histogram.getPercentile(90), -1, "p90_us");
+    Lua::SetField(L, histogram.getPercentile(99), -1, "p99_us");
+}
+
+static void push_histograms(lua_State *L, const std::unordered_map<string, PerfHistogram> &histograms) {
+    lua_createtable(L, 0, histograms.size());
+    for (auto & [name, histogram] : histograms) {
+        push_histogram(L, histogram);
+        lua_setfield(L, -2, name.c_str());
+    }
+}
+
+static int internal_getPerfHistograms(lua_State *L) {
+    auto & counters = Core::getInstance().perf_counters;
+
+    std::unordered_map<int32_t, int32_t> event_types;
+    for (auto & [event_type, _] : counters.event_manager_event_per_plugin_us)
+        event_types[event_type] = event_type;
+
+    lua_createtable(L, 0, 4);
+    lua_newtable(L);
+    for (auto & [name, event_type] : translate_event_types(event_types)) {
+        push_histograms(L, counters.event_manager_event_per_plugin_us[event_type]);
+        lua_setfield(L, -2, name);
+    }
+    lua_setfield(L, -2, "event_manager");
+    push_histograms(L, counters.update_per_plugin_us);
+    lua_setfield(L, -2, "update_per_plugin");
+    push_histograms(L, counters.update_lua_per_repeat_us);
+    lua_setfield(L, -2, "update_lua_per_repeat");
+    push_histogram(L, counters.rpc_queue_wait_us);
+    lua_setfield(L, -2, "rpc_queue_wait");
+    return 1;
 }
 
 static int internal_getClipboardTextCp437Multiline(lua_State *L) {
@@ -4282,6 +4488,7 @@ static const luaL_Reg dfhack_internal_funcs[] = {
     { "setMortalMode", internal_setMortalMode },
     { "setArmokTools", internal_setArmokTools },
     { "getPerfCounters", internal_getPerfCounters },
+    { "getPerfHistograms", internal_getPerfHistograms },
     { "getPreferredNumberFormat", internal_getPreferredNumberFormat },
     { "getClipboardTextCp437Multiline", internal_getClipboardTextCp437Multiline },
     { NULL, NULL }
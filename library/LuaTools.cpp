@@ -36,6 +36,7 @@ distribution.
 #include "MiscUtils.h"
 #include "DFHackVersion.h"
 #include "PluginManager.h"
+#include "TimerWheel.h"
 
 #include "modules/World.h"
 #include "modules/Gui.h"
@@ -62,6 +63,7 @@ distribution.
 #include <lualib.h>
 #include <lstate.h>
 
+#include <algorithm>
 #include <csignal>
 #include <string>
 #include <vector>
@@ -1928,10 +1930,12 @@ lua_State *DFHack::Lua::Open(color_ostream &out, lua_State *state)
 
 static int next_timeout_id = 0;
 static int frame_idx = 0;
-static std::multimap<int,int> frame_timers;
-static std::multimap<int,int> tick_timers;
+static TimerWheel frame_timers;
+static TimerWheel tick_timers;
+static std::vector<int> due_timers;
 
 int DFHACK_TIMEOUTS_TOKEN = 0;
+int DFHACK_TIMEOUT_NAMES_TOKEN = 0;
 
 static const char *const timeout_modes[] = {
     "frames", "ticks", "days", "months", "years", NULL
@@ -1946,7 +1950,9 @@ int dfhack_timeout(lua_State *L)
     lua_Number time = luaL_checknumber(L, 1);
     int mode = luaL_checkoption(L, 2, NULL, timeout_modes);
     luaL_checktype(L, 3, LUA_TFUNCTION);
-    lua_settop(L, 3);
+    if (!lua_isnoneornil(L, 4))
+        luaL_checktype(L, 4, LUA_TSTRING);
+    lua_settop(L, 4);
 
     if (mode > 0 && !Core::getInstance().isWorldLoaded())
     {
@@ -1977,14 +1983,21 @@ int dfhack_timeout(lua_State *L)
     // Queue the timeout
     int id = next_timeout_id++;
     if (mode)
-        tick_timers.insert(std::pair<int,int>(world->frame_counter+delta, id));
+        tick_timers.add(world->frame_counter, int64_t(world->frame_counter)+delta, id);
     else
-        frame_timers.insert(std::pair<int,int>(frame_idx+delta, id));
+        frame_timers.add(frame_idx, int64_t(frame_idx)+delta, id);
 
     lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TIMEOUTS_TOKEN);
-    lua_swap(L);
+    lua_pushvalue(L, 3);
     lua_rawseti(L, -2, id);
 
+    if (!lua_isnil(L, 4))
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &DFHACK_TIMEOUT_NAMES_TOKEN);
+        lua_pushvalue(L, 4);
+        lua_rawseti(L, -2, id);
+    }
+
     lua_pushinteger(L, id);
     return 1;
 }
@@ -2013,20 +2026,20 @@ int dfhack_timeout_active(lua_State *L)
     return 1;
 }
 
-static void cancel_timers(std::multimap<int,int> &timers)
+static void cancel_timers(TimerWheel &timers)
 {
     auto State = DFHack::Core::getInstance().getLuaState();
 
     Lua::StackUnwinder frame(State);
     lua_rawgetp(State, LUA_REGISTRYINDEX, &DFHACK_TIMEOUTS_TOKEN);
+    lua_rawgetp(State, LUA_REGISTRYINDEX, &DFHACK_TIMEOUT_NAMES_TOKEN);
 
-    for (auto it = timers.begin(); it != timers.end(); ++it)
-    {
+    timers.clear([&](int id) {
         lua_pushnil(State);
-        lua_rawseti(State, frame[1], it->second);
-    }
-
-    timers.clear();
+        lua_rawseti(State, frame[1], id);
+        lua_pushnil(State);
+        lua_rawseti(State, frame[2], id);
+    });
 }
 
 void DFHack::Lua::Core::onStateChange(color_ostream &out, int code) {
@@ -2047,28 +2060,6 @@ void DFHack::Lua::Core::onStateChange(color_ostream &out, int code) {
     Lua::Event::Invoke(out, State, (void*)onStateChange, 1);
 }
 
-static void run_timers(color_ostream &out, lua_State *L,
-                       std::multimap<int,int> &timers, int table, int bound)
-{
-    while (!timers.empty() && timers.begin()->first <= bound)
-    {
-        int id = timers.begin()->second;
-        timers.erase(timers.begin());
-
-        lua_rawgeti(L, table, id);
-
-        if (lua_isnil(L, -1))
-            lua_pop(L, 1);
-        else
-        {
-            lua_pushnil(L);
-            lua_rawseti(L, table, id);
-
-            Lua::SafeCall(out, L, 0, 0);
-        }
-    }
-}
-
 void DFHack::Lua::Core::onUpdate(color_ostream &out)
 {
     auto State = DFHack::Core::getInstance().getLuaState();
@@ -2077,13 +2068,36 @@ void DFHack::Lua::Core::onUpdate(color_ostream &out)
     if (frame_timers.empty() && tick_timers.empty())
         return;
 
+    due_timers.clear();
+    frame_timers.advance(++frame_idx, due_timers);
+    if (world)
+        tick_timers.advance(world->frame_counter, due_timers);
+
+    if (due_timers.empty())
+        return;
+
+    // Everything that came due this frame is run by one call into lua,
+    // which looks each callback up just before calling it so that a timer
+    // cancelled by an earlier callback in the batch stays cancelled.
     Lua::StackUnwinder frame(State);
+    lua_rawgetp(State, LUA_REGISTRYINDEX, &DFHACK_DFHACK_TOKEN);
+    lua_getfield(State, -1, "internal");
+    lua_getfield(State, -1, "runTimers");
+    if (!lua_isfunction(State, -1))
+    {
+        out.printerr("dfhack.internal.runTimers is missing; timers not run\n");
+        return;
+    }
     lua_rawgetp(State, LUA_REGISTRYINDEX, &DFHACK_TIMEOUTS_TOKEN);
+    lua_rawgetp(State, LUA_REGISTRYINDEX, &DFHACK_TIMEOUT_NAMES_TOKEN);
+    lua_createtable(State, due_timers.size(), 0);
+    for (size_t i = 0; i < due_timers.size(); i++)
+    {
+        lua_pushinteger(State, due_timers[i]);
+        lua_rawseti(State, -2, i+1);
+    }
 
-    run_timers(out, State, frame_timers, frame[1], ++frame_idx);
-
-    if (world)
-        run_timers(out, State, tick_timers, frame[1], world->frame_counter);
+    Lua::SafeCall(out, State, 3, 0);
 }
 
 static void Lua::Core::InitCoreContext(color_ostream &out)
@@ -2091,6 +2105,8 @@ static void Lua::Core::InitCoreContext(color_ostream &out)
     auto State = DFHack::Core::getInstance().getLuaState();
     lua_newtable(State);
     lua_rawsetp(State, LUA_REGISTRYINDEX, &DFHACK_TIMEOUTS_TOKEN);
+    lua_newtable(State);
+    lua_rawsetp(State, LUA_REGISTRYINDEX, &DFHACK_TIMEOUT_NAMES_TOKEN);
 
     // Register events
     lua_rawgetp(State, LUA_REGISTRYINDEX, &DFHACK_DFHACK_TOKEN);
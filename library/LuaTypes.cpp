@@ -45,6 +45,7 @@ distribution.
 
 #include <lua.h>
 #include <lauxlib.h>
+#include <llimits.h>
 
 using namespace DFHack;
 using namespace DFHack::LuaWrapper;
@@ -453,6 +454,51 @@ static void *find_field(lua_State *state, int index, const char *mode)
     return p;
 }
 
+/**
+ * Direct-mapped cache of field lookups for one struct metatable, keyed by the
+ * address of the field name string. Only names short enough to be interned
+ * by Lua are cached: such a name is the very string object used as the key in
+ * UPVAL_FIELDTABLE, which lives as long as the cache, so the address can't be
+ * reused for a different name.
+ */
+struct FieldCache
+{
+    static const size_t SIZE = 64;
+    // longer strings aren't interned, so their address isn't unique
+    static const size_t MAX_NAME_LEN = LUAI_MAXSHORTLEN;
+
+    struct Entry {
+        const char *name;
+        struct_field_info *field;
+    } entries[SIZE];
+};
+
+/**
+ * Like find_field, but consults UPVAL_FIELD_CACHE first. Only fields are
+ * cached; methods and metafields always take the slow path.
+ */
+static struct_field_info *find_struct_field(lua_State *state, int index, const char *mode)
+{
+    size_t len;
+    const char *name = (lua_type(state, index) == LUA_TSTRING) ? lua_tolstring(state, index, &len) : NULL;
+    if (!name || len > FieldCache::MAX_NAME_LEN)
+        return (struct_field_info*)find_field(state, index, mode);
+
+    auto cache = (FieldCache*)lua_touserdata(state, UPVAL_FIELD_CACHE);
+    uintptr_t hash = uintptr_t(name);
+    auto &entry = cache->entries[((hash >> 4) ^ (hash >> 10)) % FieldCache::SIZE];
+    if (entry.name == name)
+        return entry.field;
+
+    auto field = (struct_field_info*)find_field(state, index, mode);
+    if (field)
+    {
+        entry.name = name;
+        entry.field = field;
+    }
+    return field;
+}
+
 static int cur_iter_index(lua_State *state, int len, int fidx, int first_idx = -1)
 {
     int rv;
@@ -630,7 +676,7 @@ static void write_field(lua_State *state, const struct_field_info *field, void *
 static int meta_struct_index(lua_State *state)
 {
     uint8_t *ptr = get_object_addr(state, 1, 2, "read");
-    auto field = (struct_field_info*)find_field(state, 2, "read");
+    auto field = find_struct_field(state, 2, "read");
     if (!field)
         return 1;
     read_field(state, field, ptr + field->offset);
@@ -695,7 +741,7 @@ static int meta_global_field_reference(lua_State *state)
 static int meta_struct_newindex(lua_State *state)
 {
     uint8_t *ptr = get_object_addr(state, 1, 2, "write");
-    auto field = (struct_field_info*)find_field(state, 2, "write");
+    auto field = find_struct_field(state, 2, "write");
     if (!field)
         field_error(state, 2, "builtin property or method", "write");
     write_field(state, field, ptr + field->offset, 3);
@@ -1198,7 +1244,7 @@ static int meta_bitfield_next(lua_State *state)
  */
 static int meta_global_index(lua_State *state)
 {
-    auto field = (struct_field_info*)find_field(state, 2, "read");
+    auto field = find_struct_field(state, 2, "read");
     if (!field)
         return 1;
     void *ptr = *(void**)field->offset;
@@ -1213,7 +1259,7 @@ static int meta_global_index(lua_State *state)
  */
 static int meta_global_newindex(lua_State *state)
 {
-    auto field = (struct_field_info*)find_field(state, 2, "write");
+    auto field = find_struct_field(state, 2, "write");
     if (!field)
         field_error(state, 2, "builtin property or method", "write");
     void *ptr = *(void**)field->offset;
@@ -1223,6 +1269,228 @@ static int meta_global_newindex(lua_State *state)
     return 0;
 }
 
+/*
+ * Bulk column reads
+ */
+
+namespace {
+    struct Column {
+        size_t offset;
+        const struct_field_info *field;
+        // for bitfield members
+        int bit_shift = -1;
+        int bit_size = 0;
+    };
+}
+
+// Like indexing, a name declared by both a parent and a subclass refers to
+// the parent's field (see IndexFields), so look from the root class down.
+static const struct_field_info *find_column_field(const struct_identity *pstruct, const char *name, size_t len)
+{
+    std::vector<const struct_identity*> chain;
+    for (const struct_identity *p = pstruct; p; p = p->getParent())
+        chain.push_back(p);
+
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    {
+        auto fields = (*it)->getFields();
+        if (!fields)
+            continue;
+
+        for (int i = 0; fields[i].mode != struct_field_info::END; ++i)
+        {
+            if (fields[i].name && strlen(fields[i].name) == len && !memcmp(fields[i].name, name, len))
+                return &fields[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_struct_type(const type_identity *type)
+{
+    switch (type->type())
+    {
+    case IDTYPE_STRUCT:
+    case IDTYPE_CLASS:
+    case IDTYPE_UNION:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Resolve a dotted field path, e.g. "pos.x" or "flags1.inactive", through
+ * embedded substructures and bitfields down to a primitive value.
+ */
+static Column resolve_column(lua_State *state, int path_idx, const struct_identity *pstruct)
+{
+    const char *path = lua_tostring(state, path_idx);
+    if (!path)
+        luaL_error(state, "column names must be strings");
+
+    Column col;
+    col.offset = 0;
+    col.field = NULL;
+
+    const char *seg = path;
+    for (;;)
+    {
+        const char *dot = strchr(seg, '.');
+        size_t len = dot ? size_t(dot - seg) : strlen(seg);
+
+        if (col.field && col.field->type->type() == IDTYPE_BITFIELD)
+        {
+            // the rest of the path names a bit
+            auto btype = (bitfield_identity*)col.field->type;
+            auto bits = btype->getBits();
+            for (int i = 0; i < btype->getNumBits(); i++)
+            {
+                if (bits[i].size > 0 && bits[i].name && strlen(bits[i].name) == len && !memcmp(bits[i].name, seg, len))
+                {
+                    col.bit_shift = i;
+                    col.bit_size = bits[i].size;
+                    break;
+                }
+            }
+            if (col.bit_shift < 0 || dot)
+                luaL_error(state, "invalid column '%s': unknown bit", path);
+            return col;
+        }
+
+        auto field = find_column_field(pstruct, seg, len);
+        if (!field)
+            luaL_error(state, "invalid column '%s': field not found", path);
+
+        col.offset += field->offset;
+        col.field = field;
+
+        if (!dot)
+            break;
+
+        if (field->mode != struct_field_info::SUBSTRUCT)
+            luaL_error(state, "invalid column '%s': only embedded structures can be traversed", path);
+        if (field->type->type() != IDTYPE_BITFIELD)
+        {
+            if (!is_struct_type(field->type))
+                luaL_error(state, "invalid column '%s': only embedded structures can be traversed", path);
+            pstruct = (const struct_identity*)field->type;
+        }
+
+        seg = dot + 1;
+    }
+
+    switch (col.field->mode)
+    {
+    case struct_field_info::PRIMITIVE:
+    case struct_field_info::STATIC_STRING:
+        break;
+    default:
+        luaL_error(state, "invalid column '%s': not a primitive field", path);
+    }
+
+    return col;
+}
+
+static void read_column(lua_State *state, int path_idx, const Column &col, uint8_t *item)
+{
+    uint8_t *ptr = item + col.offset;
+
+    if (col.bit_shift >= 0)
+    {
+        uint64_t value = 0;
+        memcpy(&value, ptr, std::min(col.field->type->byte_size(), sizeof(value)));
+        value >>= col.bit_shift;
+        if (col.bit_size == 1)
+            lua_pushboolean(state, value & 1);
+        else
+            lua_pushinteger(state, lua_Integer(value & ((uint64_t(1) << col.bit_size) - 1)));
+        return;
+    }
+
+    if (col.field->mode == struct_field_info::STATIC_STRING)
+    {
+        int len = strnlen((char*)ptr, col.field->count);
+        lua_pushlstring(state, (char*)ptr, len);
+        return;
+    }
+
+    col.field->type->lua_read(state, path_idx, ptr);
+}
+
+int LuaWrapper::read_columns(lua_State *state)
+{
+    luaL_checktype(state, 2, LUA_TTABLE);
+    lua_settop(state, 2);
+
+    auto id = get_object_identity(state, 1, "dfhack.columns()", false, true);
+    if (!id->isContainer() || id->type() == IDTYPE_BIT_CONTAINER)
+        luaL_error(state, "dfhack.columns() needs a container of structures");
+    auto container = (const container_identity*)id;
+
+    // the metatable knows the real item type and fixed count
+    lua_getfield(state, -1, "_field_identity");
+    auto item = (const type_identity*)lua_touserdata(state, -1);
+    lua_getfield(state, -2, "_count");
+    int count = lua_isnumber(state, -1) ? lua_tointeger(state, -1) : -1;
+    lua_settop(state, 2);
+
+    void *ptr = get_object_ref(state, 1);
+
+    // items are either the structures themselves or pointers to them
+    auto slot_type = item;
+    bool indirect = false;
+    if (id->type() == IDTYPE_PTR_CONTAINER || id->type() == IDTYPE_STL_PTR_VECTOR)
+    {
+        slot_type = &df::identity_traits<void*>::identity;
+        indirect = true;
+    }
+    else if (item && item->type() == IDTYPE_POINTER)
+    {
+        item = ((const pointer_identity*)item)->getTarget();
+        indirect = true;
+    }
+    if (!item || !is_struct_type(item))
+        luaL_error(state, "dfhack.columns() needs a container of structures");
+
+    int ncols = lua_rawlen(state, 2);
+    luaL_checkstack(state, 2*ncols + LUA_MINSTACK, "too many columns");
+
+    // stack: container paths [path...] [column...]
+    std::vector<Column> cols;
+    cols.reserve(ncols);
+    for (int c = 1; c <= ncols; c++)
+    {
+        lua_rawgeti(state, 2, c);
+        cols.push_back(resolve_column(state, lua_gettop(state), (const struct_identity*)item));
+    }
+
+    if (count < 0)
+        count = container->getItemCount(ptr);
+
+    int path_base = 2;
+    int col_base = path_base + ncols;
+    for (int c = 0; c < ncols; c++)
+        lua_createtable(state, count, 0);
+
+    for (int i = 0; i < count; i++)
+    {
+        auto pitem = (uint8_t*)container->getItemPointer(slot_type, ptr, i);
+        if (indirect)
+            pitem = *(uint8_t**)pitem;
+        if (!pitem)
+            continue;
+
+        for (int c = 0; c < ncols; c++)
+        {
+            read_column(state, path_base + 1 + c, cols[c], pitem);
+            lua_rawseti(state, col_base + 1 + c, i + 1);
+        }
+    }
+
+    return ncols;
+}
+
 /**
  * Wrapper for c++ methods and functions.
  */
@@ -1573,6 +1841,20 @@ void LuaWrapper::IndexStatics(lua_State *state, int meta_idx, int ftable_idx, st
     }
 }
 
+/**
+ * Add a struct-style metamethod with UPVAL_FIELD_CACHE to the metatable.
+ */
+static void SetFieldAccessor(lua_State *state, int meta_idx, int ftable_idx, int cache_idx,
+                             lua_CFunction function, const char *name)
+{
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &DFHACK_TYPETABLE_TOKEN);
+    lua_pushvalue(state, meta_idx);
+    lua_pushvalue(state, ftable_idx);
+    lua_pushvalue(state, cache_idx);
+    lua_pushcclosure(state, function, 4);
+    lua_setfield(state, meta_idx, name);
+}
+
 /**
  * Make a struct-style object metatable.
  */
@@ -1596,9 +1878,14 @@ static void MakeFieldMetatable(lua_State *state, const struct_identity *pstruct,
 
     lua_setfield(state, base+1, "_index_table");
 
-    // Add the indexing metamethods
-    SetStructMethod(state, base+1, base+2, reader, "__index");
-    SetStructMethod(state, base+1, base+2, writer, "__newindex");
+    // Add the indexing metamethods, with a field cache shared between them
+    auto cache = (FieldCache*)lua_newuserdata(state, sizeof(FieldCache));
+    memset(cache, 0, sizeof(FieldCache));
+    int ix_cache = lua_gettop(state);
+
+    SetFieldAccessor(state, base+1, base+2, ix_cache, reader, "__index");
+    SetFieldAccessor(state, base+1, base+2, ix_cache, writer, "__newindex");
+    lua_pop(state, 1);
 
     // returns: [metatable readfields writefields];
 }
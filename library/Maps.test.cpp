@@ -0,0 +1,115 @@
+#include "modules/Maps.h"
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace DFHack;
+
+static block_span makeSpan(df::map_block *block, int x_min, int y_min, int x_max, int y_max) {
+    block_span span;
+    span.block = block;
+    span.base_x = 32;
+    span.base_y = 48;
+    span.z = 7;
+    span.x_min = x_min;
+    span.y_min = y_min;
+    span.x_max = x_max;
+    span.y_max = y_max;
+    return span;
+}
+
+static std::unique_ptr<df::map_block> makeBlock() {
+    std::unique_ptr<df::map_block> block(new df::map_block());
+    block->flags.whole = 0;
+    for (int x = 0; x < 16; x++) {
+        for (int y = 0; y < 16; y++) {
+            block->designation[x][y].whole = 0;
+            block->occupancy[x][y].whole = 0;
+        }
+    }
+    return block;
+}
+
+static int countAquifer(df::map_block *block) {
+    int count = 0;
+    for (auto &row : block->designation)
+        for (auto &des : row)
+            count += des.bits.water_table;
+    return count;
+}
+
+TEST(Maps, block_span_forTile) {
+    block_span span = makeSpan(NULL, 2, 3, 4, 5);
+    EXPECT_FALSE(span.isFullBlock());
+    EXPECT_EQ(span.getPos(2, 3), df::coord(34, 51, 7));
+
+    // x outer, y inner: the order the [x][y] block arrays are laid out in
+    std::vector<std::pair<int, int>> tiles;
+    EXPECT_TRUE(span.forTile([&](int x, int y) { tiles.emplace_back(x, y); return true; }));
+    ASSERT_EQ(tiles.size(), 9u);
+    EXPECT_EQ(tiles.front(), std::make_pair(2, 3));
+    EXPECT_EQ(tiles[1], std::make_pair(2, 4));
+    EXPECT_EQ(tiles.back(), std::make_pair(4, 5));
+
+    int visited = 0;
+    EXPECT_FALSE(span.forTile([&](int, int) { return ++visited < 4; }));
+    EXPECT_EQ(visited, 4);
+}
+
+TEST(Maps, block_aquifer) {
+    auto block = makeBlock();
+    auto span = makeSpan(block.get(), 1, 1, 10, 12);
+
+    // every other column of the span
+    auto odd_x = [](df::coord pos, df::map_block *) { return pos.x % 2 == 1; };
+    EXPECT_EQ(Maps::setBlockAquifer(span, true, odd_x), 60);
+    EXPECT_EQ(countAquifer(block.get()), 60);
+    EXPECT_TRUE(block->flags.bits.has_aquifer);
+    EXPECT_TRUE(block->occupancy[1][1].bits.heavy_aquifer);
+    EXPECT_FALSE(block->designation[2][1].bits.water_table);
+    EXPECT_FALSE(block->designation[1][0].bits.water_table);
+
+    // an aquifer tile outside the span keeps the block flagged
+    block->designation[15][15].bits.water_table = true;
+    auto all = [](df::coord, df::map_block *) { return true; };
+    EXPECT_EQ(Maps::removeBlockAquifer(span, all), 60);
+    EXPECT_EQ(countAquifer(block.get()), 1);
+    EXPECT_TRUE(block->flags.bits.has_aquifer);
+    EXPECT_FALSE(block->occupancy[1][1].bits.heavy_aquifer);
+
+    EXPECT_EQ(Maps::removeBlockAquifer(makeSpan(block.get(), 0, 0, 15, 15), all), 1);
+    EXPECT_FALSE(block->flags.bits.has_aquifer);
+}
+
+// Setting and clearing the aquifer on whole blocks with the filter inlined,
+// against the per-tile std::function call it replaced. The timings are
+// recorded as test properties; only the results are checked.
+TEST(Maps, block_aquifer_timing) {
+    const int passes = 20000;
+    auto block = makeBlock();
+    auto span = makeSpan(block.get(), 0, 0, 15, 15);
+
+    auto measure = [&](const std::string &name, auto filter) {
+        int changed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int idx = 0; idx < passes; ++idx) {
+            changed += Maps::setBlockAquifer(span, idx % 2, filter);
+            changed += Maps::removeBlockAquifer(span, filter);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        RecordProperty(name + "_ns_per_block", std::to_string(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (2 * passes)));
+        return changed;
+    };
+
+    auto inlined = [](df::coord pos, df::map_block *) { return pos.y != 50; };
+    std::function<bool(df::coord, df::map_block *)> wrapped = inlined;
+    int expected = 2 * passes * 240;
+    EXPECT_EQ(measure("inlined_filter", inlined), expected);
+    EXPECT_EQ(measure("std_function_filter", wrapped), expected);
+}
@@ -17,3 +17,50 @@ TEST(MiscUtils, wordwrap) {
     word_wrap(&result, "1234567", 3);
     ASSERT_EQ(result.size(), 3);
 }
+
+namespace {
+    // shaped like df::caste_raw, which findCasteIndex looks up by caste_id
+    struct caste_like {
+        std::string caste_id;
+    };
+}
+
+TEST(MiscUtils, token_index_lookup) {
+    caste_like female{"FEMALE"}, male{"MALE"}, dup{"FEMALE"};
+    std::vector<caste_like *> castes{&female, nullptr, &male, &dup};
+    token_index index;
+
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "MALE"), 2);
+    // like linear_index, the first object with the id wins
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "FEMALE"), 0);
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, ""), -1);
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "NEUTER"), -1);
+}
+
+TEST(MiscUtils, token_index_stale) {
+    caste_like female{"FEMALE"}, male{"MALE"}, neuter{"NEUTER"};
+    std::vector<caste_like *> castes{&female, &male};
+    castes.reserve(4);
+    token_index index;
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "MALE"), 1);
+
+    // an object replaced in place: the miss in the old table must not be
+    // reported as not found
+    castes[1] = &neuter;
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "NEUTER"), 1);
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "MALE"), -1);
+
+    // a hit that no longer has its id
+    castes[1] = &male;
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "NEUTER"), -1);
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "MALE"), 1);
+
+    // the vector growing
+    castes.push_back(&neuter);
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "NEUTER"), 2);
+
+    // ids changed in place need a clear()
+    neuter.caste_id = "OTHER";
+    index.clear();
+    EXPECT_EQ(index.find(castes, &caste_like::caste_id, "OTHER"), 2);
+}
@@ -0,0 +1,44 @@
+#include "Core.h"
+#include <gtest/gtest.h>
+
+using namespace DFHack;
+
+TEST(PerfHistogram, empty) {
+    PerfHistogram h;
+    EXPECT_EQ(h.count, 0u);
+    EXPECT_EQ(h.getPercentile(50), 0u);
+    EXPECT_EQ(h.getPercentile(99), 0u);
+}
+
+TEST(PerfHistogram, small_values_are_exact) {
+    PerfHistogram h;
+    for (uint64_t us = 0; us < 10; ++us)
+        h.record(us);
+    EXPECT_EQ(h.count, 10u);
+    EXPECT_EQ(h.total_us, 45u);
+    EXPECT_EQ(h.max_us, 9u);
+    EXPECT_EQ(h.getPercentile(50), 4u);
+    EXPECT_EQ(h.getPercentile(100), 9u);
+}
+
+TEST(PerfHistogram, percentiles_within_error) {
+    PerfHistogram h;
+    for (uint64_t us = 1; us <= 10000; ++us)
+        h.record(us);
+    EXPECT_EQ(h.max_us, 10000u);
+    uint64_t p50 = h.getPercentile(50);
+    EXPECT_GE(p50, 5000u);
+    EXPECT_LE(p50, 5000 * 1.125);
+    uint64_t p99 = h.getPercentile(99);
+    EXPECT_GE(p99, 9900u);
+    EXPECT_LE(p99, 10000u);
+}
+
+TEST(PerfHistogram, outlier_sets_max) {
+    PerfHistogram h;
+    for (int i = 0; i < 1000; ++i)
+        h.record(100);
+    h.record(300000);
+    EXPECT_LE(h.getPercentile(99), 100 * 1.125);
+    EXPECT_EQ(h.getPercentile(100), 300000u);
+}
@@ -0,0 +1,100 @@
+#include "modules/Persistence.h"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+using namespace DFHack;
+using Persistence::SavedEntry;
+using Persistence::SaveFormat;
+
+static SavedEntry makeEntry(const std::string &key, int fake_df_id, const std::string &str_value,
+        std::initializer_list<int> ints = {}) {
+    SavedEntry entry{key, fake_df_id, str_value, {}};
+    entry.int_values.fill(-1);
+    std::copy(ints.begin(), ints.end(), entry.int_values.begin());
+    return entry;
+}
+
+// the entries come back in key order, and in their original order within a key
+static std::vector<SavedEntry> inKeyOrder(std::vector<SavedEntry> entries) {
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const SavedEntry &a, const SavedEntry &b) { return a.key < b.key; });
+    return entries;
+}
+
+static void expectRoundTrip(SaveFormat format, const std::vector<SavedEntry> &entries) {
+    std::vector<SavedEntry> decoded;
+    ASSERT_TRUE(Persistence::roundTripSaveFormat(format, entries, decoded));
+    auto expected = inKeyOrder(entries);
+    ASSERT_EQ(decoded.size(), expected.size());
+    for (size_t idx = 0; idx < expected.size(); ++idx) {
+        EXPECT_EQ(decoded[idx].key, expected[idx].key) << "entry " << idx;
+        EXPECT_EQ(decoded[idx].fake_df_id, expected[idx].fake_df_id) << "entry " << idx;
+        EXPECT_EQ(decoded[idx].str_value, expected[idx].str_value) << "entry " << idx;
+        EXPECT_EQ(decoded[idx].int_values, expected[idx].int_values) << "entry " << idx;
+    }
+}
+
+static std::vector<SavedEntry> edgeCaseEntries() {
+    std::vector<SavedEntry> entries;
+    entries.push_back(makeEntry("empty", 0, ""));
+    entries.push_back(makeEntry("negative", -101, "x", {-2, -100, -1000000}));
+    // values around the zigzag and varint byte boundaries
+    entries.push_back(makeEntry("zigzag", 0, "", {0, 1, 63, -64, 64, -65, 8191}));
+    entries.push_back(makeEntry("zigzag2", 0, "", {-8192, 8192, INT_MAX, INT_MIN, INT_MAX - 1, INT_MIN + 1}));
+    entries.push_back(makeEntry("fake-id", INT_MIN, "", {}));
+    // set ints after unset (-1) ones must keep their position
+    entries.push_back(makeEntry("gap", 0, "", {-1, -1, 5}));
+    entries.push_back(makeEntry("long", 0, std::string(100000, 'a') + "\n\t\"\\", {1}));
+    // keys shared by many entries are only written once in the binary format
+    for (int idx = 0; idx < 50; ++idx)
+        entries.push_back(makeEntry(idx % 2 ? "shared/odd" : "shared/even", -idx, std::to_string(idx), {idx, -idx}));
+    return entries;
+}
+
+TEST(PersistenceFormat, binary_round_trip) {
+    expectRoundTrip(SaveFormat::BINARY, edgeCaseEntries());
+}
+
+TEST(PersistenceFormat, json_round_trip) {
+    expectRoundTrip(SaveFormat::JSON, edgeCaseEntries());
+}
+
+// the binary format stores strings as raw bytes
+TEST(PersistenceFormat, binary_raw_bytes) {
+    expectRoundTrip(SaveFormat::BINARY, {
+        makeEntry(std::string("k\0ey", 4), 0, std::string("\0\0s", 3)),
+        makeEntry("cp437", 0, "\x80\xff\xfe")});
+}
+
+TEST(PersistenceFormat, empty_store) {
+    expectRoundTrip(SaveFormat::BINARY, {});
+    expectRoundTrip(SaveFormat::JSON, {});
+}
+
+// a store the size of a large fortress. The timings are recorded as test
+// properties for comparing the formats; only the sizes are checked.
+TEST(PersistenceFormat, large_store) {
+    std::vector<SavedEntry> entries;
+    for (int idx = 0; idx < 100000; ++idx)
+        entries.push_back(makeEntry("key-" + std::to_string(idx % 100), 0, "value " + std::to_string(idx),
+            {idx, -idx, idx * 7}));
+
+    size_t sizes[2];
+    int idx = 0;
+    for (SaveFormat format : {SaveFormat::BINARY, SaveFormat::JSON}) {
+        std::string name = format == SaveFormat::BINARY ? "binary" : "json";
+        std::vector<SavedEntry> decoded;
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_TRUE(Persistence::roundTripSaveFormat(format, entries, decoded, &sizes[idx]));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        EXPECT_EQ(decoded.size(), entries.size());
+        RecordProperty(name + "_bytes", std::to_string(sizes[idx]));
+        RecordProperty(name + "_round_trip_ms",
+            std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()));
+        ++idx;
+    }
+    EXPECT_LT(sizes[0], sizes[1]);
+}
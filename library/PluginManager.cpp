@@ -37,6 +37,7 @@ distribution.
 
 #include "DataDefs.h"
 #include "MiscUtils.h"
+#include "Trace.h"
 #include "DFHackVersion.h"
 
 #include "LuaWrapper.h"
@@ -180,6 +181,7 @@ Plugin::Plugin(Core * core, const std::filesystem::path& path,
     const std::string &name, PluginManager * pm)
     :path(path),
      name(name),
+     trace_name(Trace::internName(name)),
      parent(pm)
 {
     plugin_lib = 0;
@@ -1041,9 +1043,14 @@ void PluginManager::OnUpdate(color_ostream &out)
     for (auto it = begin(); it != end(); ++it) {
         auto & plugin_name = it->first;
         auto & plugin = it->second;
+        bool histograms = counters.getHistogramsEnabled();
+        uint64_t start_us = histograms ? PerfCounters::getTimestampUs() : 0;
         uint32_t start_ms = core.p->getTickCount();
+        Trace::Span span(plugin->getTraceName());
         plugin->on_update(out);
         counters.incCounter(counters.update_per_plugin[plugin_name], start_ms);
+        if (histograms)
+            counters.recordLatency(counters.update_per_plugin_us[plugin_name], start_us);
     }
 }
 
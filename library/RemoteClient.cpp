@@ -53,10 +53,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <cstdlib>
 #include <sstream>
 
+#include <functional>
 #include <memory>
 
 #include "json/json.h"
 
+#include <google/protobuf/io/coded_stream.h>
+
+#include <zlib.h>
+
 using namespace DFHack;
 
 using dfproto::CoreTextNotification;
@@ -91,6 +96,8 @@ RemoteClient::RemoteClient(color_ostream *default_output)
 {
     active = false;
     socket = new CActiveSocket();
+    protocol_version = 1;
+    compress_min_size = RPCMessageHeader::DEFAULT_COMPRESS_MIN_SIZE;
     suspend_ready = false;
 
     if (!p_default_output)
@@ -188,7 +195,7 @@ bool RemoteClient::connect(int port)
 
     RPCHandshakeHeader header;
     memcpy(header.magic, RPCHandshakeHeader::REQUEST_MAGIC, sizeof(header.magic));
-    header.version = 1;
+    header.version = RPCHandshakeHeader::CURRENT_VERSION;
 
     if (socket->Send((uint8*)&header, sizeof(header)) != sizeof(header))
     {
@@ -205,13 +212,15 @@ bool RemoteClient::connect(int port)
     }
 
     if (memcmp(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic)) ||
-        header.version != 1)
+        header.version < 1 || header.version > RPCHandshakeHeader::CURRENT_VERSION)
     {
         default_output().printerr("Invalid handshake response.\n");
         socket->Close();
         return active = false;
     }
 
+    protocol_version = header.version;
+
     bind_call.name = "BindMethod";
     bind_call.p_client = this;
     bind_call.id = 0;
@@ -347,9 +356,56 @@ bool RemoteFunctionBase::bind(color_ostream &out, RemoteClient *client,
     return client->bind(out, this, name, plugin);
 }
 
-bool sendRemoteMessage(CSimpleSocket *socket, int16_t id, const MessageLite *msg, bool size_ready)
+/*
+ * Sends a message with the given payload. If compress_min_size is positive
+ * and the payload is at least that long, it is sent compressed instead, as
+ * long as that actually saves space.
+ */
+bool sendRemoteData(CSimpleSocket *socket, int16_t id, const uint8_t *data, int size, int compress_min_size)
+{
+    if (compress_min_size > 0 && size >= compress_min_size)
+    {
+        uLongf packed_size = compressBound(size);
+        int prefix = sizeof(RPCMessageHeader) + sizeof(int32_t);
+        std::unique_ptr<uint8_t[]> packed(new uint8_t[prefix + packed_size]);
+
+        if (compress2(packed.get() + prefix, &packed_size, data, size, Z_BEST_SPEED) == Z_OK &&
+            packed_size + sizeof(int32_t) < size_t(size))
+        {
+            RPCMessageHeader *hdr = (RPCMessageHeader*)packed.get();
+            hdr->id = id;
+            hdr->size = int32_t(packed_size + sizeof(int32_t)) | RPCMessageHeader::COMPRESSED_FLAG;
+
+            int32_t raw_size = size;
+            memcpy(packed.get() + sizeof(RPCMessageHeader), &raw_size, sizeof(raw_size));
+
+            int fullsz = prefix + int(packed_size);
+            return socket->Send(packed.get(), fullsz) == fullsz;
+        }
+    }
+
+    RPCMessageHeader header;
+    header.id = id;
+    header.size = size;
+
+    if (socket->Send((uint8_t*)&header, sizeof(header)) != sizeof(header))
+        return false;
+    return size == 0 || socket->Send(data, size) == size;
+}
+
+bool sendRemoteMessage(CSimpleSocket *socket, int16_t id, const MessageLite *msg, bool size_ready,
+                       int compress_min_size)
 {
     int size = size_ready ? msg->GetCachedSize() : msg->ByteSize();
+
+    if (compress_min_size > 0 && size >= compress_min_size)
+    {
+        std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+        uint8_t *pend = msg->SerializeWithCachedSizesToArray(data.get());
+        assert((pend - data.get()) == size); (void)pend;
+        return sendRemoteData(socket, id, data.get(), size, compress_min_size);
+    }
+
     int fullsz = size + sizeof(RPCMessageHeader);
 
     uint8_t *data = new uint8_t[fullsz];
@@ -367,6 +423,84 @@ bool sendRemoteMessage(CSimpleSocket *socket, int16_t id, const MessageLite *msg
     return (got == fullsz);
 }
 
+/*
+ * Reads the payload of a message whose header was just received, inflating
+ * it if it was compressed. On success the first size bytes of buf hold the
+ * payload; packed is scratch space for compressed data. Both keep their
+ * capacity, so callers can reuse them across messages. On failure error
+ * describes what went wrong. read must fill its buffer completely or fail;
+ * the socket overload reads from the socket.
+ */
+bool readRemoteData(const std::function<bool(void *buf, int size)> &read,
+                    const RPCMessageHeader &header, bool allow_compressed,
+                    std::vector<uint8_t> &buf, std::vector<uint8_t> &packed,
+                    int &size, std::string &error)
+{
+    bool compressed = allow_compressed && header.size >= 0 &&
+                      (header.size & RPCMessageHeader::COMPRESSED_FLAG);
+    int wire_size = compressed ? header.size & ~RPCMessageHeader::COMPRESSED_FLAG : header.size;
+
+    if (wire_size < (compressed ? int(sizeof(int32_t)) : 0) ||
+        wire_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        error = stl_sprintf("invalid received size %d", header.size);
+        return false;
+    }
+
+    std::vector<uint8_t> &wire = compressed ? packed : buf;
+    if (wire.size() < size_t(wire_size))
+        wire.resize(wire_size);
+
+    if (!read(wire.data(), wire_size))
+    {
+        error = stl_sprintf("I/O error in receive %d bytes of data", wire_size);
+        return false;
+    }
+
+    if (!compressed)
+    {
+        size = wire_size;
+        return true;
+    }
+
+    int32_t raw_size;
+    memcpy(&raw_size, packed.data(), sizeof(raw_size));
+
+    if (raw_size < 0 || raw_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        error = stl_sprintf("invalid uncompressed size %d", raw_size);
+        return false;
+    }
+
+    if (buf.size() < size_t(raw_size))
+        buf.resize(raw_size);
+    uLongf got = raw_size;
+
+    if (uncompress(buf.data(), &got, packed.data() + sizeof(int32_t), wire_size - sizeof(int32_t)) != Z_OK ||
+        got != uLongf(raw_size))
+    {
+        error = "invalid compressed data";
+        return false;
+    }
+
+    size = raw_size;
+    return true;
+}
+
+bool readRemoteData(CSimpleSocket *socket, const RPCMessageHeader &header, bool allow_compressed,
+                    std::vector<uint8_t> &buf, std::vector<uint8_t> &packed,
+                    int &size, std::string &error)
+{
+    return readRemoteData([socket](void *buf, int size) { return readFullBuffer(socket, buf, size); },
+                          header, allow_compressed, buf, packed, size, error);
+}
+
+static bool mergeFromArray(MessageLite *msg, const uint8_t *data, int size)
+{
+    google::protobuf::io::CodedInputStream input(data, size);
+    return msg->MergeFromCodedStream(&input) && input.ConsumedEntireMessage();
+}
+
 command_result RemoteFunctionBase::execute(color_ostream &out,
                                            const message_type *input, message_type *output)
 {
@@ -393,7 +527,10 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
         return CR_LINK_FAILURE;
     }
 
-    if (!sendRemoteMessage(p_client->socket, id, input, true))
+    bool compress = p_client->protocol_version >= RPCHandshakeHeader::COMPRESSION_VERSION;
+
+    if (!sendRemoteMessage(p_client->socket, id, input, true,
+                           compress ? p_client->compress_min_size : 0))
     {
         out.printerr("In call to %s::%s: I/O error in send.\n",
                      this->plugin.c_str(), this->name.c_str());
@@ -404,6 +541,9 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
     CoreTextNotification text_data;
 
     output->Clear();
+    bool got_parts = false;
+
+    std::vector<uint8_t> buf, packed;
 
     for (;;) {
         RPCMessageHeader header;
@@ -420,38 +560,41 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
         if ((DFHack::DFHackReplyCode)header.id == RPC_REPLY_FAIL)
             return header.size == CR_OK ? CR_FAILURE : command_result(header.size);
 
-        if (header.size < 0 || header.size > RPCMessageHeader::MAX_MESSAGE_SIZE)
-        {
-            out.printerr("In call to %s::%s: invalid received size %d.\n",
-                         this->plugin.c_str(), this->name.c_str(), header.size);
-            return CR_LINK_FAILURE;
-        }
-
-        uint8_t *buf = new uint8_t[header.size];
+        int size;
+        std::string error;
 
-        if (!readFullBuffer(p_client->socket, buf, header.size))
+        if (!readRemoteData(p_client->socket, header, compress, buf, packed, size, error))
         {
-            out.printerr("In call to %s::%s: I/O error in receive %d bytes of data.\n",
-                         this->plugin.c_str(), this->name.c_str(), header.size);
+            out.printerr("In call to %s::%s: %s.\n",
+                         this->plugin.c_str(), this->name.c_str(), error.c_str());
             return CR_LINK_FAILURE;
         }
 
         switch (header.id) {
+        case RPC_REPLY_PART:
+            if (!mergeFromArray(output, buf.data(), size))
+            {
+                out.printerr("In call to %s::%s: error parsing received result part.\n",
+                             this->plugin.c_str(), this->name.c_str());
+                return CR_LINK_FAILURE;
+            }
+            got_parts = true;
+            break;
+
         case RPC_REPLY_RESULT:
-            if (!output->ParseFromArray(buf, header.size))
+            if (!(got_parts ? mergeFromArray(output, buf.data(), size)
+                            : output->ParseFromArray(buf.data(), size)))
             {
                 out.printerr("In call to %s::%s: error parsing received result.\n",
                              this->plugin.c_str(), this->name.c_str());
-                delete[] buf;
                 return CR_LINK_FAILURE;
             }
 
-            delete[] buf;
             return CR_OK;
 
         case RPC_REPLY_TEXT:
             text_data.Clear();
-            if (text_data.ParseFromArray(buf, header.size))
+            if (text_data.ParseFromArray(buf.data(), size))
                 text_decoder.decode(&text_data);
             else
                 out.printerr("In call to %s::%s: received invalid text data.\n",
@@ -461,6 +604,5 @@ command_result RemoteFunctionBase::execute(color_ostream &out,
         default:
             break;
         }
-        delete[] buf;
     }
 }
@@ -52,16 +52,30 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "PluginManager.h"
 #include "MiscUtils.h"
 #include "Debug.h"
+#include "Trace.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 #include "json/json.h"
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 using namespace DFHack;
 
@@ -71,7 +85,14 @@ using google::protobuf::MessageLite;
 
 bool readFullBuffer(CSimpleSocket *socket, void *buf, int size);
 bool sendRemoteMessage(CSimpleSocket *socket, int16_t id,
-                        const ::google::protobuf::MessageLite *msg, bool size_ready);
+                        const ::google::protobuf::MessageLite *msg, bool size_ready,
+                        int compress_min_size);
+bool sendRemoteData(CSimpleSocket *socket, int16_t id,
+                    const uint8_t *data, int size, int compress_min_size);
+bool readRemoteData(const std::function<bool(void *buf, int size)> &read,
+                    const RPCMessageHeader &header, bool allow_compressed,
+                    std::vector<uint8_t> &buf, std::vector<uint8_t> &packed,
+                    int &size, std::string &error);
 
 std::mutex ServerMain::access_{};
 bool ServerMain::blocked_{};
@@ -89,16 +110,157 @@ namespace DFHack {
     DBG_DECLARE(core, socket, DebugCategory::LINFO);
 
     struct BlockGuard {
-        std::lock_guard<std::mutex> lock;
+        std::unique_lock<std::mutex> lock;
         BlockGuard() :
             lock{ServerMain::access_}
         {
             if (ServerMain::blocked_)
                 throw BlockedException{};
         }
+
+        // lets other connections start calls while this one waits
+        void unlock() { lock.unlock(); }
+        void relock()
+        {
+            lock.lock();
+            if (ServerMain::blocked_)
+                throw BlockedException{};
+        }
     };
 }
 
+namespace {
+    struct BatchedCall {
+        std::function<command_result()> run;
+        uint64_t queued_us;
+        command_result result = CR_FAILURE;
+        bool done = false;
+    };
+
+    std::mutex batch_mutex;
+    std::condition_variable batch_done;
+    std::deque<BatchedCall*> batch_queue;
+    std::atomic<uint32_t> batch_budget_us{0};
+
+    std::atomic<int> compress_min_size{RPCMessageHeader::DEFAULT_COMPRESS_MIN_SIZE};
+
+    // receive buffers larger than this are freed after the call
+    const size_t MAX_KEPT_BUFFER = 1048576;
+
+    std::atomic<int> worker_threads{0};
+
+    std::mutex connections_mutex;
+    std::condition_variable connection_closed;
+    int connection_count = 0;
+    int max_connections = 0;
+
+    // backpressure: stop accepting while at the connection limit, leaving
+    // new clients waiting in the listen backlog
+    void waitForConnectionSlot()
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex);
+        connection_closed.wait(lock, [] {
+            return max_connections <= 0 || connection_count < max_connections;
+        });
+    }
+
+    // Queues the call for the main thread and waits for it to finish.
+    command_result runBatched(BlockGuard &lock, std::function<command_result()> run)
+    {
+        BatchedCall call;
+        call.run = std::move(run);
+        call.queued_us = PerfCounters::getTimestampUs();
+
+        lock.unlock();
+        {
+            std::unique_lock<std::mutex> guard(batch_mutex);
+            batch_queue.push_back(&call);
+            batch_done.wait(guard, [&call] { return call.done; });
+        }
+        lock.relock();
+
+        return call.result;
+    }
+}
+
+void ServerMain::setBatchBudgetUs(uint32_t budget_us)
+{
+    batch_budget_us = budget_us;
+}
+
+uint32_t ServerMain::getBatchBudgetUs()
+{
+    return batch_budget_us;
+}
+
+void ServerMain::setCompressMinSize(int size)
+{
+    compress_min_size = std::max(size, 0);
+}
+
+int ServerMain::getCompressMinSize()
+{
+    return compress_min_size;
+}
+
+void ServerMain::setWorkerThreads(int count)
+{
+    worker_threads = std::max(count, 0);
+}
+
+void ServerMain::setMaxConnections(int count)
+{
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    max_connections = std::max(count, 0);
+    connection_closed.notify_all();
+}
+
+void ServerMain::runBatchedCalls()
+{
+    auto &counters = Core::getInstance().perf_counters;
+    uint64_t start_us = PerfCounters::getTimestampUs();
+
+    std::unique_lock<std::mutex> guard(batch_mutex);
+    if (batch_queue.empty())
+        return;
+
+    DFHACK_TRACE_SPAN("RemoteServer::runBatchedCalls");
+
+    counters.rpc_max_queue_depth = std::max<uint32_t>(counters.rpc_max_queue_depth, batch_queue.size());
+
+    // always run at least one call, so a budget smaller than any call
+    // still makes progress
+    do
+    {
+        BatchedCall *call = batch_queue.front();
+        batch_queue.pop_front();
+        guard.unlock();
+
+        uint64_t now_us = PerfCounters::getTimestampUs();
+        counters.rpc_queue_wait_us.record(now_us - call->queued_us);
+        counters.rpc_batched_calls++;
+
+        command_result res;
+        try
+        {
+            res = call->run();
+        }
+        catch (std::exception &e)
+        {
+            Core::printerr("Exception in batched RPC call: %s\n", e.what());
+            res = CR_FAILURE;
+        }
+
+        guard.lock();
+        call->result = res;
+        call->done = true;
+        batch_done.notify_all();
+    } while (!batch_queue.empty() &&
+             PerfCounters::getTimestampUs() - start_us < batch_budget_us);
+
+    counters.rpc_deferred_calls += batch_queue.size();
+}
+
 RPCService::RPCService()
 {
     owner = NULL;
@@ -153,25 +315,231 @@ void RPCService::dumpMethods(std::ostream & out) const
     }
 }
 
+/*
+ * Sends the parts of a streamed reply from a separate thread, so that the
+ * function can gather and serialize the next part while the previous one is
+ * being written to the socket. Version 1 clients can't receive parts, so for
+ * them the parts are merged into the normal reply message instead.
+ *
+ * There is one per connection. Its thread is started by the first part ever
+ * streamed and then kept until the connection closes; calls that only print
+ * text never start it.
+ */
+class ServerConnection::reply_stream : public RPCReplyStreamBase {
+    ServerConnection *owner;
+    // the output of the call in progress
+    MessageLite *reply;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<int16_t, std::string>> queue;
+    size_t queued_bytes;
+    // messages queued or being sent
+    size_t pending;
+    bool closing;
+    bool failed;
+    std::thread thread;
+
+    void threadFn();
+
+public:
+    // writers block while this much serialized data is waiting
+    static const size_t MAX_QUEUED_BYTES = 4*1048576;
+
+    reply_stream(ServerConnection *owner)
+        : owner(owner), reply(NULL), queued_bytes(0), pending(0), closing(false), failed(false)
+    {}
+    ~reply_stream();
+
+    // starts and ends streaming the output of a call
+    void begin(MessageLite *reply) { this->reply = reply; }
+    void end() { reply = NULL; }
+
+    virtual bool write(const MessageLite &part);
+
+    // queues an already serialized message
+    bool push(int16_t id, std::string &&data);
+
+    // true if nothing is queued or being sent, so the socket may be
+    // written to directly
+    bool idle();
+
+    // waits until everything queued was sent; returns false on I/O errors
+    bool finish();
+};
+
+bool ServerConnection::reply_stream::write(const MessageLite &part)
+{
+    if (owner->protocol_version < 2)
+    {
+        reply->CheckTypeAndMergeFrom(part);
+        return true;
+    }
+
+    std::string data;
+    if (!part.SerializeToString(&data))
+        return false;
+    if (data.size() > size_t(RPCMessageHeader::MAX_MESSAGE_SIZE))
+    {
+        owner->stream.printerr("Reply part too large: %d.\n", int(data.size()));
+        return false;
+    }
+    return push(RPC_REPLY_PART, std::move(data));
+}
+
+bool ServerConnection::reply_stream::push(int16_t id, std::string &&data)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return failed || queued_bytes < MAX_QUEUED_BYTES; });
+    if (failed)
+        return false;
+
+    if (!thread.joinable())
+        thread = std::thread(&reply_stream::threadFn, this);
+
+    queued_bytes += data.size();
+    pending++;
+    queue.emplace_back(id, std::move(data));
+    cv.notify_all();
+    return true;
+}
+
+void ServerConnection::reply_stream::threadFn()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        cv.wait(lock, [this] { return closing || !queue.empty(); });
+        if (queue.empty())
+            break;
+
+        auto msg = std::move(queue.front());
+        queue.pop_front();
+
+        lock.unlock();
+        bool ok = sendRemoteData(owner->socket, msg.first, (const uint8_t*)msg.second.data(),
+                                 int(msg.second.size()), owner->compressMinSize());
+        lock.lock();
+
+        queued_bytes -= msg.second.size();
+        pending--;
+        if (!ok)
+        {
+            failed = true;
+            queue.clear();
+            queued_bytes = 0;
+            pending = 0;
+        }
+        cv.notify_all();
+    }
+}
+
+bool ServerConnection::reply_stream::idle()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending == 0;
+}
+
+bool ServerConnection::reply_stream::finish()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return failed || pending == 0; });
+    return !failed;
+}
+
+ServerConnection::reply_stream::~reply_stream()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+        cv.notify_all();
+    }
+    if (thread.joinable())
+        thread.join();
+}
+
+int ServerConnection::compressMinSize() const
+{
+    if (protocol_version < RPCHandshakeHeader::COMPRESSION_VERSION)
+        return 0;
+    return ServerMain::getCompressMinSize();
+}
+
 ServerConnection::ServerConnection(CActiveSocket *socket)
     : socket(socket), stream(this)
 {
     in_error = false;
+    connected = false;
+    protocol_version = 1;
+    replies = new reply_stream(this);
+    hold_output = false;
+    recv_pos = 0;
 
     core_service = new CoreService();
     core_service->finalize(this, &functions);
+
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connection_count++;
 }
 
 ServerConnection::~ServerConnection()
 {
     in_error = true;
     socket->Close();
+    // the writer can't block on the closed socket
+    delete replies;
     delete socket;
 
     for (auto it = plugin_services.begin(); it != plugin_services.end(); ++it)
         delete it->second;
 
     delete core_service;
+
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connection_count--;
+    connection_closed.notify_all();
+}
+
+bool ServerConnection::readFull(void *buf, int size)
+{
+    size_t buffered = std::min(recv_buffer.size() - recv_pos, size_t(size));
+    if (buffered)
+    {
+        memcpy(buf, recv_buffer.data() + recv_pos, buffered);
+        recv_pos += buffered;
+        if (recv_pos == recv_buffer.size())
+        {
+            recv_buffer.clear();
+            recv_pos = 0;
+        }
+    }
+
+    return buffered == size_t(size) ||
+        readFullBuffer(socket, (char*)buf + buffered, size - int(buffered));
+}
+
+bool ServerConnection::hasFullMessage() const
+{
+    size_t avail = recv_buffer.size() - recv_pos;
+    if (!connected)
+        return avail >= sizeof(RPCHandshakeHeader);
+
+    RPCMessageHeader header;
+    if (avail < sizeof(header))
+        return false;
+    memcpy(&header, recv_buffer.data() + recv_pos, sizeof(header));
+
+    if ((DFHack::DFHackReplyCode)header.id == RPC_REQUEST_QUIT)
+        return true;
+
+    int wire_size = header.size;
+    if (protocol_version >= RPCHandshakeHeader::COMPRESSION_VERSION && header.size >= 0)
+        wire_size &= ~RPCMessageHeader::COMPRESSED_FLAG;
+    // let handleRequest report an invalid size
+    if (wire_size < 0 || wire_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+        return true;
+
+    return avail - sizeof(header) >= size_t(wire_size);
 }
 
 ServerFunctionBase *ServerConnection::findFunction(color_ostream &out, const std::string &plugin, const std::string &name)
@@ -216,6 +584,9 @@ void ServerConnection::connection_ostream::flush_proxy()
         return;
     }
 
+    if (owner->hold_output)
+        return;
+
     if (buffer.empty())
         return;
 
@@ -231,174 +602,380 @@ void ServerConnection::connection_ostream::flush_proxy()
 
     buffer.clear();
 
-    if (!sendRemoteMessage(owner->socket, RPC_REPLY_TEXT, &msg, false))
+    // while streamed parts are being written, the socket belongs to the
+    // writer, and the text has to wait its turn behind them
+    if (!owner->replies->idle())
+    {
+        std::string data;
+        msg.SerializeToString(&data);
+        if (!owner->replies->push(RPC_REPLY_TEXT, std::move(data)))
+            owner->in_error = true;
+        return;
+    }
+
+    if (!sendRemoteMessage(owner->socket, RPC_REPLY_TEXT, &msg, false, owner->compressMinSize()))
     {
         owner->in_error = true;
         Core::printerr("Error writing text into client socket.\n");
     }
 }
 
-void ServerConnection::Accepted(CActiveSocket* socket)
+#ifdef __linux__
+/*
+ * Serves every connection from a fixed set of threads. Idle connections sit
+ * in an epoll set armed for one event at a time, so each connection is
+ * picked up by exactly one worker. The worker reads what has arrived without
+ * blocking, and only once a whole request is buffered does it handle it,
+ * with the usual blocking writes, before rearming the connection. A slow
+ * client can't hold a worker while it trickles in a request.
+ *
+ * CoreSuspend leaves the core locked by the thread that ran it, so while a
+ * client holds the core that way its worker keeps serving it, with blocking
+ * reads, until the matching CoreResume. Its calls then take the lock on the
+ * thread that owns it, and no other client's call runs on that thread.
+ */
+class DFHack::ConnectionPool {
+    int epoll_fd;
+
+    explicit ConnectionPool(int threads);
+    void workerFn();
+    bool arm(ServerConnection *conn, int op);
+    static void close(ServerConnection *conn);
+
+public:
+    // the pool is created on first use; NULL if epoll is unavailable
+    static ConnectionPool *get(int threads);
+
+    bool add(ServerConnection *conn) { return arm(conn, EPOLL_CTL_ADD); }
+};
+
+ConnectionPool::ConnectionPool(int threads)
 {
-    std::thread{[](CActiveSocket* socket) {
-            try {
-                ServerConnection(socket).threadFn();
-            } catch (BlockedException &) {
-            }
-        },  socket}.detach();
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        WARN(socket).print("epoll_create1 failed: %s\n", strerror(errno));
+        return;
+    }
+
+    for (int i = 0; i < threads; i++)
+        std::thread(&ConnectionPool::workerFn, this).detach();
 }
 
-void ServerConnection::threadFn()
+ConnectionPool *ConnectionPool::get(int threads)
 {
-    color_ostream_proxy out(Core::getInstance().getConsole());
+    // never destroyed, since the workers are detached
+    static ConnectionPool *pool = new ConnectionPool(threads);
+    return pool->epoll_fd >= 0 ? pool : NULL;
+}
+
+bool ConnectionPool::arm(ServerConnection *conn, int op)
+{
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = conn;
+    return epoll_ctl(epoll_fd, op, conn->socket->GetSocketDescriptor(), &event) == 0;
+}
+
+void ConnectionPool::close(ServerConnection *conn)
+{
+    if (conn->connected)
+        std::cerr << "Shutting down client connection." << endl;
+    // closing the socket also removes it from the epoll set
+    delete conn;
+}
 
-    /* Handshake */
+bool ServerConnection::receiveAvailable()
+{
+    int fd = socket->GetSocketDescriptor();
+    uint8_t chunk[16384];
 
+    while (!hasFullMessage())
     {
-        RPCHandshakeHeader header;
+        ssize_t cnt = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (cnt > 0)
+            recv_buffer.insert(recv_buffer.end(), chunk, chunk + cnt);
+        else if (cnt == 0)
+            return false;
+        else if (errno != EINTR)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
 
-        if (!readFullBuffer(socket, &header, sizeof(header)))
+void ConnectionPool::workerFn()
+{
+    color_ostream_proxy out(Core::getInstance().getConsole());
+
+    for (;;)
+    {
+        epoll_event event;
+        int cnt = epoll_wait(epoll_fd, &event, 1, -1);
+        if (cnt < 0 && errno != EINTR)
         {
-            out << "In RPC server: could not read handshake header." << endl;
+            WARN(socket).print("epoll_wait failed: %s\n", strerror(errno));
             return;
         }
+        if (cnt <= 0)
+            continue;
 
-        if (memcmp(header.magic, RPCHandshakeHeader::REQUEST_MAGIC, sizeof(header.magic)) ||
-            header.version < 1 || header.version > 255)
+        auto conn = (ServerConnection*)event.data.ptr;
+        bool keep = false;
+
+        // a hangup may still come with a last message to read
+        if (event.events & EPOLLIN)
         {
-            out << "In RPC server: invalid handshake header." << endl;
-            return;
+            bool open = conn->receiveAvailable();
+            keep = true;
+            try {
+                while (keep && conn->hasFullMessage())
+                {
+                    if (!conn->connected)
+                        keep = conn->connected = conn->handshake(out);
+                    else
+                        keep = conn->handleRequest(out);
+
+                    // stay on the thread that holds the client's suspend
+                    while (keep && conn->core_service->isSuspending())
+                        keep = conn->handleRequest(out);
+                }
+            } catch (BlockedException &) {
+                keep = false;
+            }
+            keep = keep && open;
         }
 
-        memcpy(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic));
-        header.version = 1;
+        if (!keep || !arm(conn, EPOLL_CTL_MOD))
+            close(conn);
+    }
+}
+#endif
 
-        if (socket->Send((uint8*)&header, sizeof(header)) != sizeof(header))
-        {
-            out << "In RPC server: could not send handshake response." << endl;
+void ServerConnection::Accepted(CActiveSocket* socket)
+{
+    ServerConnection *conn = new ServerConnection(socket);
+
+#ifdef __linux__
+    if (int threads = worker_threads)
+    {
+        ConnectionPool *pool = ConnectionPool::get(threads);
+        if (pool && pool->add(conn))
             return;
-        }
     }
+#endif
 
-    /* Processing */
+    std::thread{[](ServerConnection *conn) {
+            try {
+                conn->threadFn();
+            } catch (BlockedException &) {
+            }
+            delete conn;
+        }, conn}.detach();
+}
 
-    std::cerr << "Client connection established." << endl;
+bool ServerConnection::handshake(color_ostream &out)
+{
+    RPCHandshakeHeader header;
 
-    while (!in_error) {
-        // Read the message
-        RPCMessageHeader header;
+    if (!readFull(&header, sizeof(header)))
+    {
+        out << "In RPC server: could not read handshake header." << endl;
+        return false;
+    }
 
-        if (!readFullBuffer(socket, &header, sizeof(header)))
-        {
-            out.printerr("In RPC server: I/O error in receive header.\n");
-            break;
-        }
+    if (memcmp(header.magic, RPCHandshakeHeader::REQUEST_MAGIC, sizeof(header.magic)) ||
+        header.version < 1 || header.version > 255)
+    {
+        out << "In RPC server: invalid handshake header." << endl;
+        return false;
+    }
 
-        if ((DFHack::DFHackReplyCode)header.id == RPC_REQUEST_QUIT)
-            break;
+    protocol_version = header.version;
+    if (protocol_version > RPCHandshakeHeader::CURRENT_VERSION)
+        protocol_version = RPCHandshakeHeader::CURRENT_VERSION;
 
-        if (header.size < 0 || header.size > RPCMessageHeader::MAX_MESSAGE_SIZE)
-        {
-            out.printerr("In RPC server: invalid received size %d.\n", header.size);
-            break;
-        }
+    memcpy(header.magic, RPCHandshakeHeader::RESPONSE_MAGIC, sizeof(header.magic));
+    header.version = protocol_version;
 
-        std::unique_ptr<uint8_t[]> buf(new uint8_t[header.size]);
+    if (socket->Send((uint8*)&header, sizeof(header)) != sizeof(header))
+    {
+        out << "In RPC server: could not send handshake response." << endl;
+        return false;
+    }
 
-        if (!readFullBuffer(socket, buf.get(), header.size))
-        {
-            out.printerr("In RPC server: I/O error in receive %d bytes of data.\n", header.size);
-            break;
-        }
+    std::cerr << "Client connection established." << endl;
+    return true;
+}
 
-        //out.print("Handling %d:%d\n", header.id, header.size);
+bool ServerConnection::handleRequest(color_ostream &out)
+{
+    // Read the message
+    RPCMessageHeader header;
 
-        // Find and call the function
-        int in_size = header.size;
-        BlockGuard lock;
+    if (!readFull(&header, sizeof(header)))
+    {
+        out.printerr("In RPC server: I/O error in receive header.\n");
+        return false;
+    }
+
+    if ((DFHack::DFHackReplyCode)header.id == RPC_REQUEST_QUIT)
+        return false;
+
+    int in_size;
+    std::string error;
+
+    if (!readRemoteData([this](void *buf, int size) { return readFull(buf, size); },
+                        header, protocol_version >= RPCHandshakeHeader::COMPRESSION_VERSION,
+                        in_buffer, packed_buffer, in_size, error))
+    {
+        out.printerr("In RPC server: %s.\n", error.c_str());
+        return false;
+    }
+
+    //out.print("Handling %d:%d\n", header.id, header.size);
+
+    // Find and call the function
+    BlockGuard lock;
 
-        ServerFunctionBase *fn = vector_get(functions, header.id);
-        MessageLite *reply = NULL;
-        command_result res = CR_FAILURE;
+    ServerFunctionBase *fn = vector_get(functions, header.id);
+    MessageLite *reply = NULL;
+    command_result res = CR_FAILURE;
 
-        if (!fn)
+    if (!fn)
+    {
+        stream.printerr("RPC call of invalid id %d\n", header.id);
+    }
+    else
+    {
+        if (((fn->flags & SF_ALLOW_REMOTE) != SF_ALLOW_REMOTE) && strcmp(socket->GetClientAddr(), "127.0.0.1") != 0)
         {
-            stream.printerr("RPC call of invalid id %d\n", header.id);
+            stream.printerr("In call to %s: forbidden host: %s\n", fn->name, socket->GetClientAddr());
+        }
+        else if (!fn->in()->ParseFromArray(in_buffer.data(), in_size))
+        {
+            stream.printerr("In call to %s: could not decode input args.\n", fn->name);
         }
         else
         {
-            if (((fn->flags & SF_ALLOW_REMOTE) != SF_ALLOW_REMOTE) && strcmp(socket->GetClientAddr(), "127.0.0.1") != 0)
-            {
-                stream.printerr("In call to %s: forbidden host: %s\n", fn->name, socket->GetClientAddr());
-            }
-            else if (!fn->in()->ParseFromArray(buf.get(), header.size))
-            {
-                stream.printerr("In call to %s: could not decode input args.\n", fn->name);
-            }
-            else
-            {
-                buf.reset();
+            reply = fn->out();
 
-                reply = fn->out();
+            // undoes the per-call state even if the call, or taking the
+            // server lock back after a batched call, throws
+            struct call_scope {
+                ServerConnection *conn;
+                ServerFunctionBase *fn;
+
+                call_scope(ServerConnection *conn, ServerFunctionBase *fn, MessageLite *reply)
+                    : conn(conn), fn(fn)
+                {
+                    conn->replies->begin(reply);
+                    fn->reply_stream = conn->replies;
+                }
+                ~call_scope()
+                {
+                    conn->hold_output = false;
+                    fn->reply_stream = NULL;
+                    conn->replies->end();
+                }
+            };
+
+            {
+                call_scope scope(this, fn, reply);
 
                 if (fn->flags & SF_DONT_SUSPEND)
                 {
                     res = fn->execute(stream);
                 }
+                else if (ServerMain::getBatchBudgetUs() && !fn->isStreaming() &&
+                         !(fn->flags & SF_DONT_BATCH) && !core_service->isSuspending())
+                {
+                    // the main thread must not block on the socket, and must not
+                    // wait for a client that already holds the core
+                    hold_output = true;
+                    res = runBatched(lock, [this, fn] { return fn->execute(stream); });
+                }
                 else
                 {
                     CoreSuspender suspend;
                     res = fn->execute(stream);
                 }
             }
+
+            // Flush text output through the stream so it stays in order
+            stream.flush();
+
+            if (!replies->finish())
+            {
+                out.printerr("In RPC server: I/O error in send result part.\n");
+                in_error = true;
+            }
         }
+    }
 
-        // Flush all text output
-        if (in_error)
-            break;
+    if (in_error)
+        return false;
 
-        //out.print("Answer %d:%d\n", res, reply);
+    //out.print("Answer %d:%d\n", res, reply);
 
-        // Send reply
-        int out_size = (reply ? reply->ByteSize() : 0);
+    // Send reply
+    int out_size = (reply ? reply->ByteSize() : 0);
 
-        if (out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
-        {
-            stream.printerr("In call to %s: reply too large: %d.\n",
-                                (fn ? fn->name : "UNKNOWN"), out_size);
-            res = CR_LINK_FAILURE;
-        }
+    if (out_size > RPCMessageHeader::MAX_MESSAGE_SIZE)
+    {
+        stream.printerr("In call to %s: reply too large: %d.\n",
+                            (fn ? fn->name : "UNKNOWN"), out_size);
+        res = CR_LINK_FAILURE;
+    }
 
-        stream.flush();
+    stream.flush();
 
-        if (res == CR_OK && reply)
-        {
-            if (!sendRemoteMessage(socket, RPC_REPLY_RESULT, reply, true))
-            {
-                out.printerr("In RPC server: I/O error in send result.\n");
-                break;
-            }
-        }
-        else
+    if (res == CR_OK && reply)
+    {
+        if (!sendRemoteMessage(socket, RPC_REPLY_RESULT, reply, true, compressMinSize()))
         {
-            header.id = RPC_REPLY_FAIL;
-            header.size = res;
-
-            if (socket->Send((uint8_t*)&header, sizeof(header)) != sizeof(header))
-            {
-                out.printerr("In RPC server: I/O error in send failure code.\n");
-                break;
-            }
+            out.printerr("In RPC server: I/O error in send result.\n");
+            return false;
         }
+    }
+    else
+    {
+        header.id = RPC_REPLY_FAIL;
+        header.size = res;
 
-        // Cleanup
-        if (fn)
+        if (socket->Send((uint8_t*)&header, sizeof(header)) != sizeof(header))
         {
-            fn->reset((fn->flags & SF_CALLED_ONCE) ||
-                      (out_size > 128*1024 || in_size > 32*1024));
+            out.printerr("In RPC server: I/O error in send failure code.\n");
+            return false;
         }
     }
 
+    // Cleanup
+    if (fn)
+    {
+        fn->reset((fn->flags & SF_CALLED_ONCE) ||
+                  (out_size > 128*1024 || in_size > 32*1024));
+    }
+
+    // don't hold on to the memory of an occasional huge request
+    if (in_buffer.size() > MAX_KEPT_BUFFER)
+        std::vector<uint8_t>().swap(in_buffer);
+    if (packed_buffer.size() > MAX_KEPT_BUFFER)
+        std::vector<uint8_t>().swap(packed_buffer);
+    if (recv_buffer.empty() && recv_buffer.capacity() > MAX_KEPT_BUFFER)
+        std::vector<uint8_t>().swap(recv_buffer);
+
+    return !in_error;
+}
+
+void ServerConnection::threadFn()
+{
+    color_ostream_proxy out(Core::getInstance().getConsole());
+
+    if (!(connected = handshake(out)))
+        return;
+
+    while (handleRequest(out)) {}
+
     std::cerr << "Shutting down client connection." << endl;
 }
 
@@ -440,6 +1017,39 @@ ServerMainImpl::ServerMainImpl(std::promise<bool> promise, int port) :
     // rewrite/normalize config file
     configJson["allow_remote"] = allow_remote;
     configJson["port"] = configJson.get("port", RemoteClient::DEFAULT_PORT);
+    configJson["batch_budget_us"] = configJson.get("batch_budget_us", 0);
+    configJson["compress_min_size"] = configJson.get("compress_min_size",
+                                                     RPCMessageHeader::DEFAULT_COMPRESS_MIN_SIZE);
+    configJson["worker_threads"] = configJson.get("worker_threads", 0);
+    configJson["max_connections"] = configJson.get("max_connections", 0);
+
+    try {
+        ServerMain::setBatchBudgetUs(configJson["batch_budget_us"].asUInt());
+    } catch (const std::exception & e) {
+        std::cerr << "Invalid batch_budget_us in " << filename << ": " << e.what() << std::endl;
+        configJson["batch_budget_us"] = 0;
+    }
+
+    try {
+        ServerMain::setCompressMinSize(configJson["compress_min_size"].asInt());
+    } catch (const std::exception & e) {
+        std::cerr << "Invalid compress_min_size in " << filename << ": " << e.what() << std::endl;
+        configJson["compress_min_size"] = RPCMessageHeader::DEFAULT_COMPRESS_MIN_SIZE;
+    }
+
+    try {
+        ServerMain::setWorkerThreads(configJson["worker_threads"].asInt());
+    } catch (const std::exception & e) {
+        std::cerr << "Invalid worker_threads in " << filename << ": " << e.what() << std::endl;
+        configJson["worker_threads"] = 0;
+    }
+
+    try {
+        ServerMain::setMaxConnections(configJson["max_connections"].asInt());
+    } catch (const std::exception & e) {
+        std::cerr << "Invalid max_connections in " << filename << ": " << e.what() << std::endl;
+        configJson["max_connections"] = 0;
+    }
 
     std::ofstream outFile(filename, std::ios_base::trunc);
 
@@ -478,6 +1088,7 @@ void ServerMainImpl::threadFn(std::promise<bool> promise, int port)
     server.socket.SetBlocking();
     try {
         while (server.socket.IsSocketValid()) {
+            waitForConnectionSlot();
             if (std::unique_ptr<CActiveSocket> client{server.socket.Accept()}) {
                 BlockGuard lock;
                 ServerConnection::Accepted(client.release());
@@ -504,4 +1115,11 @@ void ServerMain::block()
 {
     std::lock_guard<std::mutex> lock{access_};
     blocked_ = true;
+
+    // Update won't run queued calls anymore; release their connections
+    std::lock_guard<std::mutex> guard{batch_mutex};
+    for (BatchedCall *call : batch_queue)
+        call->done = true;
+    batch_queue.clear();
+    batch_done.notify_all();
 }
@@ -665,7 +665,8 @@ CoreService::CoreService() :
     addMethod("CoreSuspend", &CoreService::CoreSuspend, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
     addMethod("CoreResume", &CoreService::CoreResume, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
 
-    addMethod("RunLua", &CoreService::RunLua);
+    // arbitrary scripts would stall every other batched call in the frame
+    addMethod("RunLua", &CoreService::RunLua, SF_DONT_BATCH);
 
     // Functions:
     addFunction("GetVersion", GetVersion, SF_DONT_SUSPEND | SF_ALLOW_REMOTE);
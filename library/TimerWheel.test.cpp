@@ -0,0 +1,132 @@
+#include "TimerWheel.h"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace DFHack;
+
+// advances one unit at a time and returns the ids due at each time
+static std::map<int64_t, std::vector<int>> runUntil(TimerWheel &wheel, int64_t from, int64_t to) {
+    std::map<int64_t, std::vector<int>> fired;
+    for (int64_t now = from + 1; now <= to; ++now) {
+        std::vector<int> due;
+        wheel.advance(now, due);
+        if (!due.empty())
+            fired[now] = due;
+    }
+    return fired;
+}
+
+TEST(TimerWheel, empty) {
+    TimerWheel wheel;
+    EXPECT_TRUE(wheel.empty());
+    std::vector<int> due;
+    wheel.advance(1000, due);
+    EXPECT_TRUE(due.empty());
+}
+
+TEST(TimerWheel, same_tick_order) {
+    TimerWheel wheel;
+    // added out of time order, and across levels, but due together
+    wheel.add(0, 300, 0);
+    wheel.add(0, 5, 1);
+    wheel.add(0, 300, 2);
+    std::vector<int> due;
+    wheel.advance(200, due);
+    wheel.add(200, 300, 3);
+    wheel.add(200, 300, 4);
+    EXPECT_EQ(due, std::vector<int>({1}));
+
+    due.clear();
+    wheel.advance(299, due);
+    EXPECT_TRUE(due.empty());
+    wheel.advance(300, due);
+    EXPECT_EQ(due, std::vector<int>({0, 2, 3, 4}));
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, past_due) {
+    TimerWheel wheel;
+    wheel.add(50, 10, 0);
+    wheel.add(50, 50, 1);
+    std::vector<int> due;
+    wheel.advance(51, due);
+    EXPECT_EQ(due, std::vector<int>({0, 1}));
+}
+
+// timers far enough out to start on every level, firing after cascading down
+TEST(TimerWheel, cascade_levels) {
+    TimerWheel wheel;
+    std::vector<int64_t> delays = {1, 255, 256, 257, 65535, 65536, 65537, 70000,
+        (int64_t(1) << 24) - 1, int64_t(1) << 24, (int64_t(1) << 24) + 300};
+    const int64_t start = 100;
+    for (size_t idx = 0; idx < delays.size(); ++idx)
+        wheel.add(start, start + delays[idx], idx);
+
+    // jump straight to each expiry rather than stepping through 16M units
+    for (size_t idx = 0; idx < delays.size(); ++idx) {
+        std::vector<int> due;
+        wheel.advance(start + delays[idx] - 1, due);
+        EXPECT_TRUE(due.empty()) << "delay " << delays[idx];
+        wheel.advance(start + delays[idx], due);
+        EXPECT_EQ(due, std::vector<int>({int(idx)})) << "delay " << delays[idx];
+    }
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, clear) {
+    TimerWheel wheel;
+    wheel.add(0, 3, 7);
+    wheel.add(0, 100000, 8);
+    std::vector<int> cleared;
+    wheel.clear([&](int id) { cleared.push_back(id); });
+    std::sort(cleared.begin(), cleared.end());
+    EXPECT_EQ(cleared, std::vector<int>({7, 8}));
+    EXPECT_TRUE(wheel.empty());
+
+    // an emptied wheel resyncs to the time given with the next timer
+    wheel.add(500000, 500002, 9);
+    std::vector<int> due;
+    wheel.advance(500001, due);
+    EXPECT_TRUE(due.empty());
+    wheel.advance(500002, due);
+    EXPECT_EQ(due, std::vector<int>({9}));
+}
+
+// random timers, some cancelled the way dfhack.timeout does it (by the caller
+// ignoring them when they come due), against a sorted reference
+TEST(TimerWheel, matches_reference) {
+    std::mt19937 rng(42);
+    TimerWheel wheel;
+    std::map<int64_t, std::vector<int>> expected;
+    std::vector<bool> cancelled;
+    int64_t now = 0;
+    int next_id = 0;
+    for (int round = 0; round < 50; ++round) {
+        for (int idx = 0; idx < 40; ++idx) {
+            int64_t delay = std::uniform_int_distribution<int64_t>(1, round % 5 ? 600 : 200000)(rng);
+            wheel.add(now, now + delay, next_id);
+            cancelled.push_back(std::uniform_int_distribution<int>(0, 3)(rng) == 0);
+            if (!cancelled.back())
+                expected[now + delay].push_back(next_id);
+            ++next_id;
+        }
+        int64_t until = now + std::uniform_int_distribution<int64_t>(1, 2000)(rng);
+        auto fired = runUntil(wheel, now, until);
+        for (auto &entry : fired) {
+            std::vector<int> live;
+            for (int id : entry.second)
+                if (!cancelled[id])
+                    live.push_back(id);
+            if (live.empty())
+                continue;
+            ASSERT_EQ(live, expected[entry.first]) << "time " << entry.first;
+            expected.erase(entry.first);
+        }
+        ASSERT_TRUE(expected.empty() || expected.begin()->first > until) << "time " << expected.begin()->first;
+        now = until;
+    }
+}
@@ -0,0 +1,206 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2012 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+using namespace DFHack;
+
+namespace {
+    struct TraceEvent {
+        const char *name;
+        uint64_t start_us;
+        uint64_t dur_us;
+    };
+
+    // the slot fields are atomic since a reader may copy a slot while the
+    // owning thread overwrites it; relaxed accesses compile to plain moves
+    struct TraceSlot {
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> start_us{0};
+        std::atomic<uint64_t> dur_us{0};
+    };
+
+    // Single-producer ring buffer, read like a seqlock. The owning thread
+    // issues a release fence (ordering it after the store that published the
+    // previous slot), writes the slot and then publishes it by bumping head
+    // with release semantics. Readers copy the window behind head, issue an
+    // acquire fence and re-read head: any slot they saw partly overwritten is
+    // then behind the new head and discarded.
+    struct ThreadBuffer {
+        static const size_t CAPACITY = 1 << 14;
+
+        uint32_t tid = 0;
+        // index of the first slot written by the current owner; slots before
+        // it belong to a thread that has exited. guarded by registry_mutex.
+        uint64_t start = 0;
+        std::atomic<uint64_t> head{0};
+        TraceSlot events[CAPACITY];
+    };
+
+    std::atomic<bool> enabled{false};
+
+    std::mutex registry_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<ThreadBuffer *> free_buffers;
+    uint32_t next_tid = 1;
+
+    std::mutex names_mutex;
+    std::unordered_set<std::string> names;
+
+    // returns the buffer to the pool when the owning thread exits, so
+    // short-lived threads don't each leak a buffer
+    struct BufferHolder {
+        ThreadBuffer *buffer = nullptr;
+        ~BufferHolder() {
+            if (!buffer)
+                return;
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            free_buffers.push_back(buffer);
+        }
+    };
+
+    thread_local BufferHolder holder;
+
+    ThreadBuffer *getThreadBuffer() {
+        if (holder.buffer)
+            return holder.buffer;
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        ThreadBuffer *buffer;
+        if (!free_buffers.empty()) {
+            buffer = free_buffers.back();
+            free_buffers.pop_back();
+        } else {
+            buffers.emplace_back(std::make_unique<ThreadBuffer>());
+            buffer = buffers.back().get();
+        }
+        buffer->tid = next_tid++;
+        buffer->start = buffer->head.load(std::memory_order_relaxed);
+        holder.buffer = buffer;
+        return buffer;
+    }
+
+    void writeJsonString(std::ostream &out, const char *str) {
+        out << '"';
+        for (const char *c = str; *c; ++c) {
+            switch (*c) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if ((unsigned char)*c < 0x20)
+                    out << ' ';
+                else
+                    out << *c;
+            }
+        }
+        out << '"';
+    }
+}
+
+bool Trace::isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void Trace::setEnabled(bool state) {
+    enabled.store(state, std::memory_order_relaxed);
+}
+
+void Trace::record(const char *name, uint64_t start_us, uint64_t end_us) {
+    ThreadBuffer *buffer = getThreadBuffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    TraceSlot &slot = buffer->events[head % ThreadBuffer::CAPACITY];
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start_us.store(start_us, std::memory_order_relaxed);
+    slot.dur_us.store(end_us > start_us ? end_us - start_us : 0, std::memory_order_relaxed);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+const char *Trace::internName(const std::string &name) {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    return names.insert(name).first->c_str();
+}
+
+size_t Trace::dumpChromeTrace(std::ostream &out, uint32_t seconds) {
+    uint64_t now_us = PerfCounters::getTimestampUs();
+    uint64_t cutoff_us = now_us > uint64_t(seconds) * 1000000 ? now_us - uint64_t(seconds) * 1000000 : 0;
+
+    struct Snapshot {
+        uint32_t tid;
+        std::vector<TraceEvent> events;
+    };
+    std::vector<Snapshot> snapshots;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (auto &buffer : buffers) {
+            Snapshot snapshot;
+            snapshot.tid = buffer->tid;
+            uint64_t head = buffer->head.load(std::memory_order_acquire);
+            uint64_t tail = head > ThreadBuffer::CAPACITY ? head - ThreadBuffer::CAPACITY : 0;
+            tail = std::max(tail, buffer->start);
+            snapshot.events.reserve(head - tail);
+            for (uint64_t idx = tail; idx < head; ++idx) {
+                const TraceSlot &slot = buffer->events[idx % ThreadBuffer::CAPACITY];
+                snapshot.events.push_back({
+                    slot.name.load(std::memory_order_relaxed),
+                    slot.start_us.load(std::memory_order_relaxed),
+                    slot.dur_us.load(std::memory_order_relaxed)});
+            }
+            // the writer may also be in the middle of filling the slot at
+            // new_head, which is the same slot as new_head - CAPACITY
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t new_head = buffer->head.load(std::memory_order_relaxed);
+            if (new_head + 1 - tail > ThreadBuffer::CAPACITY) {
+                size_t overwritten = std::min<uint64_t>(new_head + 1 - tail - ThreadBuffer::CAPACITY, snapshot.events.size());
+                snapshot.events.erase(snapshot.events.begin(), snapshot.events.begin() + overwritten);
+            }
+            snapshots.emplace_back(std::move(snapshot));
+        }
+    }
+
+    size_t count = 0;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (auto &snapshot : snapshots) {
+        for (auto &event : snapshot.events) {
+            if (!event.name || event.start_us + event.dur_us < cutoff_us)
+                continue;
+            if (count++)
+                out << ',';
+            out << "\n{\"name\":";
+            writeJsonString(out, event.name);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << snapshot.tid
+                << ",\"ts\":" << event.start_us << ",\"dur\":" << event.dur_us << '}';
+        }
+    }
+    out << "\n]}\n";
+    return count;
+}
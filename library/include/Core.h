@@ -79,6 +79,32 @@ namespace DFHack
         struct Hide;
     }
 
+    // Log-linear latency histogram with microsecond resolution. Values are
+    // bucketed by power of two with 8 linear sub-buckets each, so reported
+    // percentiles are within 12.5% of the true value.
+    class DFHACK_EXPORT PerfHistogram
+    {
+    public:
+        uint64_t count = 0;
+        uint64_t total_us = 0;
+        uint64_t max_us = 0;
+
+        void record(uint64_t us);
+
+        // returns the upper bound of the bucket containing the given
+        // percentile (0-100), clamped to max_us
+        uint64_t getPercentile(double pct) const;
+
+    private:
+        static const size_t LINEAR_BUCKETS = 16;
+        static const size_t SUB_BUCKET_BITS = 3;
+        static const size_t NUM_BUCKETS = LINEAR_BUCKETS + (64 - 4) * (1 << SUB_BUCKET_BITS);
+        uint32_t buckets[NUM_BUCKETS] = {};
+
+        static size_t getBucket(uint64_t us);
+        static uint64_t getBucketUpperBound(size_t bucket);
+    };
+
     class DFHACK_EXPORT PerfCounters
     {
     public:
@@ -92,18 +118,48 @@ namespace DFHack
         uint32_t total_overlay_ms;
         std::unordered_map<int32_t, uint32_t> event_manager_event_total_ms;
         std::unordered_map<int32_t, std::unordered_map<std::string, uint32_t>> event_manager_event_per_plugin_ms;
+        // number of game entities (units, constructions, etc.) examined per event type
+        std::unordered_map<int32_t, uint32_t> event_manager_event_scanned;
         std::unordered_map<std::string, uint32_t> update_per_plugin;
         std::unordered_map<std::string, uint32_t> state_change_per_plugin;
         std::unordered_map<std::string, uint32_t> update_lua_per_repeat;
         std::unordered_map<std::string, uint32_t> overlay_per_widget;
         std::unordered_map<std::string, uint32_t> zscreen_per_focus;
 
+        // latency histograms, only recorded while histograms are enabled
+        std::unordered_map<int32_t, std::unordered_map<std::string, PerfHistogram>> event_manager_event_per_plugin_us;
+        std::unordered_map<std::string, PerfHistogram> update_per_plugin_us;
+        std::unordered_map<std::string, PerfHistogram> update_lua_per_repeat_us;
+
+        // batched RPC calls (see ServerMain::setBatchBudgetUs). These are
+        // recorded whether or not the game is paused, since remote clients
+        // usually keep polling while it is.
+        uint32_t rpc_batched_calls;
+        uint32_t rpc_deferred_calls; // calls left for a later frame by the budget
+        uint32_t rpc_max_queue_depth;
+        PerfHistogram rpc_queue_wait_us;
+
         void reset(bool ignorePauseState = false);
         bool getIgnorePauseState();
 
+        bool getHistogramsEnabled() { return histograms_enabled; }
+        void setHistogramsEnabled(bool enabled) { histograms_enabled = enabled; }
+
+        // monotonic high resolution timestamp for use with recordLatency
+        static uint64_t getTimestampUs() {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // noop under the same conditions as incCounter
+        void recordLatency(PerfHistogram &histogram, uint64_t baseline_us);
+
         // noop if game is paused and getIgnorePauseState() returns false
         void incCounter(uint32_t &counter, uint32_t baseline_ms);
 
+        // noop under the same conditions as incCounter
+        void incCount(uint32_t &counter, uint32_t amount);
+
         // returns number of unpaused ms since last tick
         uint32_t registerTick(uint32_t baseline_ms);
 
@@ -111,6 +167,7 @@ namespace DFHack
 
     private:
         bool ignore_pause_state = false;
+        bool histograms_enabled = false;
 
         static const size_t RECENT_TICKS_HISTORY_SIZE = 1000;
         int32_t last_frame_counter;
@@ -219,6 +276,8 @@ namespace DFHack
 
         PerfCounters perf_counters;
         uint32_t getUnpausedMs() { return unpaused_ms; }
+        // incremented once per frame (paused or not) before any update hooks run
+        uint32_t getFrameCount() { return frame_count; }
 
         lua_State* getLuaState(bool bypass_assertion = false) {
             assert(bypass_assertion || isSuspended());
@@ -332,6 +391,7 @@ namespace DFHack
         lua_State* State;
 
         uint32_t unpaused_ms; // reset to 0 on map load
+        uint32_t frame_count = 0;
 
         friend class CoreService;
         friend class ServerConnection;
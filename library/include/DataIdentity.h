@@ -152,6 +152,10 @@ namespace DFHack
 
         virtual bool lua_insert2(lua_State *state, int fname_idx, void *ptr, int idx, int val_index) const;
 
+        // for bulk readers that walk the items without going through lua
+        int getItemCount(void *ptr) const { return item_count(ptr, COUNT_READ); }
+        void *getItemPointer(const type_identity *item, void *ptr, int idx) const { return item_pointer(item, ptr, idx); }
+
     protected:
         virtual int item_count(void *ptr, CountMode cnt) const = 0;
         virtual void *item_pointer(const type_identity *item, void *ptr, int idx) const = 0;
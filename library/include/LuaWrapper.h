@@ -107,6 +107,14 @@ namespace LuaWrapper {
  */
     constexpr auto UPVAL_CONTAINER_ID = lua_upvalueindex(4);
 
+/*
+ * Only for struct __index and __newindex: userdata with a cache of
+ * recently resolved fields. Shares its slot with UPVAL_CONTAINER_ID:
+ * the struct accessors are never container methods, and container
+ * methods never consult the field cache.
+ */
+    constexpr auto UPVAL_FIELD_CACHE = lua_upvalueindex(4);
+
 /*
  * Only for containers: light udata with item identity.
  */
@@ -238,6 +246,12 @@ namespace LuaWrapper {
 
     int method_wrapper_core(lua_State *state, function_identity_base *id);
 
+    /**
+     * Implements dfhack.columns: reads fields of every item of a container
+     * of structures into plain lua arrays.
+     */
+    int read_columns(lua_State *state);
+
     void IndexStatics(lua_State *state, int meta_idx, int ftable_idx, struct_identity *pstruct);
 
     void AttachDFGlobals(lua_State *state);
@@ -36,6 +36,8 @@ distribution.
 #include <memory>
 #include <sstream>
 #include <stdint.h>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #if defined(_MSC_VER)
@@ -180,6 +182,69 @@ inline int binsearch_index(const std::vector<CT*> &vec, typename CT::key_pointer
     return CT::binsearch_index(vec, key, exact);
 }
 
+/*
+ * Lookup of objects in a vector by their string id, e.g. raw tokens.
+ *
+ * The table is built on first use, and rebuilt if the vector moves, changes
+ * size, a hit no longer has the id it was indexed under, or a miss finds
+ * that the vector no longer holds the objects the table was built from.
+ * Call clear() if ids may be changed in place. Like linear_index, the first
+ * object with a given id wins.
+ */
+class token_index
+{
+    std::unordered_map<std::string, int> table;
+    // the object pointers the table was built from
+    std::vector<const void *> objects;
+    const void *source = nullptr;
+    bool built = false;
+
+    template <typename T, typename FN>
+    void build(T *const *src, size_t count, FN id_at)
+    {
+        table.clear();
+        table.reserve(count);
+        for (size_t i = 0; i < count; i++)
+            if (const std::string *id = id_at(i))
+                table.emplace(*id, int(i));
+        objects.assign(src, src + count);
+        source = src;
+        built = true;
+    }
+
+public:
+    void clear() { table.clear(); objects.clear(); built = false; }
+
+    // src is the array of object pointers; id_at(i) returns the id of the
+    // i-th object, or NULL to skip it
+    template <typename T, typename FN>
+    int find(T *const *src, size_t count, FN id_at, const std::string &token)
+    {
+        if (!built || src != source || count != objects.size())
+            build(src, count, id_at);
+        auto it = table.find(token);
+        if (it != table.end()) {
+            const std::string *id = id_at(it->second);
+            if (id && *id == token)
+                return it->second;
+        } else if (std::equal(objects.begin(), objects.end(), src)) {
+            return -1;
+        }
+
+        build(src, count, id_at);
+        it = table.find(token);
+        return it == table.end() ? -1 : it->second;
+    }
+
+    template <typename CT, typename MT>
+    int find(const std::vector<CT*> &vec, std::string MT::*field, const std::string &token)
+    {
+        return find(vec.data(), vec.size(), [&](size_t i) -> const std::string * {
+            return vec[i] ? &(vec[i]->*field) : nullptr;
+        }, token);
+    }
+};
+
 template <typename FT>
 int random_index(const std::vector<FT>& vec)
 {
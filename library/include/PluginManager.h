@@ -191,6 +191,11 @@ namespace DFHack
         {
             return name;
         }
+        // the name interned for frame trace spans; outlives the plugin
+        const char * getTraceName() const
+        {
+            return trace_name;
+        }
         plugin_state getState()
         {
             return state;
@@ -204,6 +209,7 @@ namespace DFHack
         std::vector <RPCService*> services;
         std::filesystem::path path;
         std::string name;
+        const char * trace_name;
         DFLibrary * plugin_lib;
         PluginManager * parent;
         plugin_state state;
@@ -43,7 +43,8 @@ namespace  DFHack
         RPC_REPLY_RESULT = -1,
         RPC_REPLY_FAIL = -2,
         RPC_REPLY_TEXT = -3,
-        RPC_REQUEST_QUIT = -4
+        RPC_REQUEST_QUIT = -4,
+        RPC_REPLY_PART = -5
     };
 
     struct RPCHandshakeHeader {
@@ -52,11 +53,21 @@ namespace  DFHack
 
         static const char REQUEST_MAGIC[9];
         static const char RESPONSE_MAGIC[9];
+
+        // highest protocol version this build speaks
+        static const int CURRENT_VERSION = 3;
+        // lowest version that allows compressed messages
+        static const int COMPRESSION_VERSION = 3;
     };
 
     struct RPCMessageHeader {
         static const int MAX_MESSAGE_SIZE = 64*1048576;
 
+        // set in the size field of compressed messages
+        static const int32_t COMPRESSED_FLAG = 0x40000000;
+        // payloads smaller than this are never worth compressing
+        static const int DEFAULT_COMPRESS_MIN_SIZE = 4096;
+
         int16_t id;
         int32_t size;
     };
@@ -66,8 +77,10 @@ namespace  DFHack
      * 1. Handshake
      *
      *   Client initiates connection by sending the handshake
-     *   request header. The server responds with the response
-     *   magic. Currently both versions must be 1.
+     *   request header with the highest version it supports.
+     *   The server responds with the response magic and the
+     *   version that will be used, which is the lower of the
+     *   two. Version 1 clients see no difference.
      *
      * 2. Interaction
      *
@@ -91,6 +104,23 @@ namespace  DFHack
      *   of the function if it succeeded, or RPC_REPLY_FAIL with the
      *   error code if it did not.
      *
+     *   In version 2, a function may also stream its output: it
+     *   is sent as any number of RPC_REPLY_PART messages of the
+     *   output type before the final RPC_REPLY_RESULT, and the
+     *   client merges them all (in protobuf MergeFrom order) to get
+     *   the full result. Every part is limited to MAX_MESSAGE_SIZE
+     *   on its own, but the total is not. For version 1 clients the
+     *   server merges the parts itself and sends a single result.
+     *
+     *   In version 3, either side may compress the payload of any
+     *   message except RPC_REPLY_FAIL and RPC_REQUEST_QUIT. Such
+     *   messages have COMPRESSED_FLAG set in the size field; the
+     *   remaining bits give the length of the payload on the wire,
+     *   which is the uncompressed length as a 32-bit integer
+     *   followed by a zlib stream. The uncompressed length is also
+     *   limited to MAX_MESSAGE_SIZE. Senders only compress large
+     *   payloads, and only if that makes them smaller.
+     *
      * 3. Disconnect
      *
      *   The client terminates the connection by sending an
@@ -241,9 +271,15 @@ namespace  DFHack
         int suspend_game();
         int resume_game();
 
+        // payloads at least this large are compressed if the server
+        // supports it; 0 disables compression
+        void set_compress_min_size(int size) { compress_min_size = size; }
+
     private:
         bool active, delete_output;
         CActiveSocket *socket;
+        int protocol_version;
+        int compress_min_size;
         color_ostream *p_default_output;
 
         RemoteFunction<dfproto::CoreBindRequest,dfproto::CoreBindReply> bind_call;
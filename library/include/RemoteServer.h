@@ -50,7 +50,32 @@ namespace  DFHack
         SF_DONT_SUSPEND = 2,
         // The function is considered safe to call from a remote computer.
         // All other functions cannot be allowed for security reasons.
-        SF_ALLOW_REMOTE = 4
+        SF_ALLOW_REMOTE = 4,
+        // Always run the call on its connection thread, even if batching
+        // is enabled. For functions whose run time has no useful bound.
+        SF_DONT_BATCH = 8
+    };
+
+    /* Destination for the parts of a streamed reply. */
+    class DFHACK_EXPORT RPCReplyStreamBase {
+    public:
+        // Queues one part of the reply for sending. Blocks while too much
+        // data is waiting to be written. Returns false if the connection
+        // failed, in which case the function should give up and return.
+        virtual bool write(const RPCFunctionBase::message_type &part) = 0;
+
+    protected:
+        virtual ~RPCReplyStreamBase() {}
+    };
+
+    template<typename Out>
+    class RPCReplyStream {
+        RPCReplyStreamBase *base;
+
+    public:
+        explicit RPCReplyStream(RPCReplyStreamBase *base) : base(base) {}
+
+        bool write(const Out &part) { return base->write(part); }
     };
 
     class DFHACK_EXPORT ServerFunctionBase : public RPCFunctionBase {
@@ -60,19 +85,27 @@ namespace  DFHack
 
         virtual command_result execute(color_ostream &stream) = 0;
 
+        // true if the reply is sent as a sequence of parts
+        virtual bool isStreaming() const { return false; }
+
         int16_t getId() { return id; }
 
     protected:
         friend class RPCService;
+        friend class ServerConnection;
 
         ServerFunctionBase(const message_type *in, const message_type *out,
                            RPCService *owner, const char *name, int flags)
-            : RPCFunctionBase(in, out), name(name), flags(flags), owner(owner), id(-1)
+            : RPCFunctionBase(in, out), name(name), flags(flags), owner(owner), id(-1),
+              reply_stream(NULL)
         {}
         virtual ~ServerFunctionBase() {}
 
         RPCService *owner;
         int16_t id;
+
+        // set by the connection for the duration of a call
+        RPCReplyStreamBase *reply_stream;
     };
 
     template<typename In, typename Out>
@@ -93,6 +126,34 @@ namespace  DFHack
         function_type fptr;
     };
 
+    /*
+     * A function that sends its output as a sequence of parts. Together with
+     * SF_DONT_SUSPEND this allows a function to hold the core lock only while
+     * gathering each part, while earlier parts are serialized and written to
+     * the socket.
+     */
+    template<typename In, typename Out>
+    class StreamingServerFunction : public ServerFunctionBase {
+    public:
+        typedef command_result (*function_type)(color_ostream &out, const In *input, RPCReplyStream<Out> &reply);
+
+        In *in() { return static_cast<In*>(RPCFunctionBase::in()); }
+
+        StreamingServerFunction(RPCService *owner, const char *name, int flags, function_type fptr)
+            : ServerFunctionBase(&In::default_instance(), &Out::default_instance(), owner, name, flags),
+              fptr(fptr) {}
+
+        virtual command_result execute(color_ostream &stream) {
+            RPCReplyStream<Out> reply(reply_stream);
+            return fptr(stream, in(), reply);
+        }
+
+        virtual bool isStreaming() const { return true; }
+
+    private:
+        function_type fptr;
+    };
+
     template<typename In>
     class VoidServerFunction : public ServerFunctionBase {
     public:
@@ -188,6 +249,16 @@ namespace  DFHack
             functions.push_back(new VoidServerFunction<In>(this, name, flags, fptr));
         }
 
+        template<typename In, typename Out>
+        void addStreamingFunction(
+            const char *name,
+            command_result (*fptr)(color_ostream &out, const In *input, RPCReplyStream<Out> &reply),
+            int flags = 0
+        ) {
+            assert(!owner);
+            functions.push_back(new StreamingServerFunction<In,Out>(this, name, flags, fptr));
+        }
+
     protected:
         ServerConnection *connection() { return owner; }
 
@@ -214,6 +285,8 @@ namespace  DFHack
         void dumpMethods(std::ostream & out) const;
     };
 
+    class ConnectionPool;
+
     class ServerConnection {
         class connection_ostream : public buffered_color_ostream {
             ServerConnection *owner;
@@ -225,15 +298,49 @@ namespace  DFHack
             connection_ostream(ServerConnection *owner) : owner(owner) {}
         };
 
+        class reply_stream;
+
         bool in_error;
+        bool connected;
         CActiveSocket *socket;
         connection_ostream stream;
+        int protocol_version;
+
+        // keeps text output buffered while a call runs on another thread
+        bool hold_output;
+
+        // writes streamed replies, and text printed while they are sent
+        reply_stream *replies;
+
+        // minimum payload size to compress when sending, or 0
+        int compressMinSize() const;
 
         std::vector<ServerFunctionBase*> functions;
 
         CoreService *core_service;
         std::map<std::string, RPCService*> plugin_services;
 
+        // receive buffers, kept across calls
+        std::vector<uint8_t> in_buffer, packed_buffer;
+
+        // data received ahead by the connection pool, consumed from recv_pos
+        std::vector<uint8_t> recv_buffer;
+        size_t recv_pos;
+
+        friend class ConnectionPool;
+
+        // reads from recv_buffer first, then blocks on the socket for the rest
+        bool readFull(void *buf, int size);
+        // reads what the socket has without blocking, stopping once a whole
+        // message is buffered; false on end of stream or error
+        bool receiveAvailable();
+        // true if recv_buffer holds the next handshake or request in full
+        bool hasFullMessage() const;
+
+        bool handshake(color_ostream &out);
+        // reads and answers one request; false if the connection should close
+        bool handleRequest(color_ostream &out);
+
         void threadFn();
         ServerConnection(CActiveSocket* socket);
         ~ServerConnection();
@@ -254,5 +361,43 @@ namespace  DFHack
 
         static std::future<bool> listen(int port);
         static void block();
+
+        /*
+         * Batched execution of suspending calls. While the budget is nonzero,
+         * calls without SF_DONT_SUSPEND are not run by their connection
+         * thread. Instead they are queued and run by Core::Update on the main
+         * thread, which already has the core suspended, so calls from all
+         * connections share one suspend window per frame instead of each
+         * taking the lock on its own. Calls still queued when the budget (in
+         * microseconds) runs out wait for the next frame. 0 disables batching.
+         * Streaming functions, functions with SF_DONT_BATCH, and calls from
+         * a client that holds the core through CoreSuspend, are always run
+         * by their connection thread.
+         */
+        static void setBatchBudgetUs(uint32_t budget_us);
+        static uint32_t getBatchBudgetUs();
+
+        // Only to be called by Core::Update
+        static void runBatchedCalls();
+
+        /*
+         * Replies with payloads at least this many bytes long are compressed
+         * for clients that support it. 0 disables compression.
+         */
+        static void setCompressMinSize(int size);
+        static int getCompressMinSize();
+
+        /*
+         * Connection handling. With a nonzero number of worker threads (on
+         * platforms with epoll), all connections are served by that many
+         * threads, which only pick up a connection once a whole request has
+         * arrived on it, and keep serving a client that holds the core
+         * through CoreSuspend until it resumes. Otherwise each connection
+         * gets a thread of its own. Once
+         * max_connections clients are connected, new ones are not accepted
+         * until one disconnects; 0 means no limit.
+         */
+        static void setWorkerThreads(int count);
+        static void setMaxConnections(int count);
     };
 }
@@ -139,6 +139,9 @@ namespace DFHack
         CoreService();
         ~CoreService();
 
+        // true between a CoreSuspend call and the matching CoreResume
+        bool isSuspending() const { return suspend_depth > 0; }
+
         command_result BindMethod(color_ostream &stream,
                                   const dfproto::CoreBindRequest *in,
                                   dfproto::CoreBindReply *out);
@@ -0,0 +1,119 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2012 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace DFHack
+{
+/*
+ * Hierarchical timing wheel. Level L has 256 slots, each covering 256^L
+ * time units; a timer sits at the lowest level whose window still contains
+ * both the current time and its expiry, and is moved down a level each
+ * time the clock enters its slot. Adding a timer is O(1), and advancing the
+ * clock costs O(1) per unit plus the timers that fire or move. Cancelled
+ * timers are not removed; the caller skips them when they come due.
+ */
+class TimerWheel {
+    static const int BITS = 8;
+    static const int SLOTS = 1 << BITS;
+    static const int LEVELS = 5;
+
+    struct Timer {
+        int64_t when;
+        int id;
+    };
+
+    std::vector<Timer> slots[LEVELS][SLOTS];
+    int64_t now = 0;
+    size_t count = 0;
+
+    void place(const Timer &timer) {
+        int level = 0;
+        while (level < LEVELS-1 && ((timer.when ^ now) >> (BITS * (level+1))) != 0)
+            level++;
+        slots[level][(timer.when >> (BITS * level)) & (SLOTS-1)].push_back(timer);
+    }
+
+    void cascade(int level) {
+        std::vector<Timer> timers;
+        timers.swap(slots[level][(now >> (BITS * level)) & (SLOTS-1)]);
+        for (auto &timer : timers)
+            place(timer);
+    }
+
+public:
+    bool empty() const { return count == 0; }
+
+    // current is the present time, used to resync an empty wheel
+    void add(int64_t current, int64_t when, int id) {
+        if (count == 0)
+            now = current;
+        place({std::max(when, now + 1), id});
+        count++;
+    }
+
+    // appends the ids of all timers due at or before bound to due, in the
+    // order they were added within each time unit
+    void advance(int64_t bound, std::vector<int> &due) {
+        while (count > 0 && now < bound) {
+            now++;
+            for (int level = 1; level < LEVELS; level++) {
+                if ((now >> (BITS * (level-1))) & (SLOTS-1))
+                    break;
+                cascade(level);
+            }
+
+            auto &slot = slots[0][now & (SLOTS-1)];
+            if (slot.empty())
+                continue;
+            size_t first = due.size();
+            for (auto &timer : slot)
+                due.push_back(timer.id);
+            // ids grow with insertion order
+            std::sort(due.begin() + first, due.end());
+            count -= slot.size();
+            slot.clear();
+        }
+        if (count == 0)
+            now = std::max(now, bound);
+    }
+
+    template<typename F>
+    void clear(F fn) {
+        for (auto &level : slots) {
+            for (auto &slot : level) {
+                for (auto &timer : slot)
+                    fn(timer.id);
+                slot.clear();
+            }
+        }
+        count = 0;
+    }
+};
+}
@@ -0,0 +1,86 @@
+/*
+https://github.com/peterix/dfhack
+Copyright (c) 2009-2012 Petr Mrázek (peterix@gmail.com)
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any
+damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any
+purpose, including commercial applications, and to alter it and
+redistribute it freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must
+not claim that you wrote the original software. If you use this
+software in a product, an acknowledgment in the product documentation
+would be appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and
+must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+distribution.
+*/
+
+#pragma once
+
+#include "Core.h"
+#include "Export.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/*! \file Trace.h
+ * Frame-level timeline tracing. Spans are recorded into a fixed-size ring
+ * buffer owned by the recording thread, so recording never takes a lock and
+ * never allocates after the first span on a thread. Old spans are overwritten
+ * as the buffer wraps. The recent history can be written out in the Chrome
+ * trace-event JSON format, which can be loaded in chrome://tracing or
+ * https://ui.perfetto.dev.
+ *
+ * \code{.cpp}
+ * void MyPlugin::expensive_step() {
+ *     DFHACK_TRACE_SPAN("myplugin/expensive_step");
+ *     ...
+ * }
+ * \endcode
+ */
+
+namespace DFHack {
+namespace Trace {
+    DFHACK_EXPORT bool isEnabled();
+    DFHACK_EXPORT void setEnabled(bool enabled);
+
+    // start_us and end_us are PerfCounters::getTimestampUs() values.
+    // name must outlive the trace buffer: either a string literal or a
+    // pointer returned by internName()
+    DFHACK_EXPORT void record(const char *name, uint64_t start_us, uint64_t end_us);
+
+    // returns a stable pointer for a dynamically built span name
+    DFHACK_EXPORT const char *internName(const std::string &name);
+
+    // writes all spans that ended within the last `seconds` seconds as a
+    // Chrome trace-event JSON document. returns the number of spans written.
+    DFHACK_EXPORT size_t dumpChromeTrace(std::ostream &out, uint32_t seconds);
+
+    class Span {
+        const char *name;
+        uint64_t start_us;
+    public:
+        explicit Span(const char *name)
+            : name(name), start_us(isEnabled() ? PerfCounters::getTimestampUs() : 0) {}
+        ~Span() {
+            if (start_us)
+                record(name, start_us, PerfCounters::getTimestampUs());
+        }
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+    };
+}
+}
+
+#define DFHACK_TRACE_CONCAT_(a, b) a##b
+#define DFHACK_TRACE_CONCAT(a, b) DFHACK_TRACE_CONCAT_(a, b)
+#define DFHACK_TRACE_SPAN(name) \
+    DFHack::Trace::Span DFHACK_TRACE_CONCAT(dfhack_trace_span_, __LINE__)(name)
@@ -99,6 +99,19 @@ DFHACK_EXPORT df::building *findAtTile(df::coord pos);
  */
 DFHACK_EXPORT bool findCivzonesAt(std::vector<df::building_civzonest*> *pvec, df::coord pos);
 
+/**
+ * Fill the vector with the buildings whose rectangle overlaps the box,
+ * optionally leaving out civzones. Returns true if any were found. The box
+ * is clamped to the map. Zones are looked up by the bounds they had on the
+ * first lookup of the frame, so a zone repainted without a call to
+ * notifyCivzoneModified() may be missed until the next frame.
+ */
+DFHACK_EXPORT bool getBuildingsInBox(std::vector<df::building *> &buildings, const cuboid &box,
+                                     bool include_civzones = true);
+DFHACK_EXPORT inline bool getBuildingsInBox(std::vector<df::building *> &buildings, df::coord pos1, df::coord pos2,
+                                            bool include_civzones = true)
+    { return getBuildingsInBox(buildings, cuboid(pos1, pos2), include_civzones); }
+
 /**
  * Allocates a building object using this type and position.
  */
@@ -9,6 +9,11 @@
 
 #include "df/unit_inventory_item.h"
 
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
 namespace df {
     struct construction;
     struct unit;
@@ -119,6 +124,62 @@ namespace DFHack {
             }
         };
 
+        /*
+         * The handlers registered for one event type, stored as an immutable
+         * snapshot. Adding or removing a handler builds a new list and swaps it
+         * in; dispatch holds on to the current snapshot, so it never allocates,
+         * and handlers that (un)register themselves mid-dispatch don't disturb
+         * the loop in progress. Handlers are grouped by plugin and kept in
+         * registration order within each plugin.
+         */
+        class HandlerList {
+        public:
+            typedef std::vector<EventHandler> list_t;
+
+            // the empty list is shared, so this never returns NULL
+            std::shared_ptr<const list_t> snapshot() const {
+                static const std::shared_ptr<const list_t> none = std::make_shared<const list_t>();
+                return current ? current : none;
+            }
+            bool empty() const { return !current; }
+            // changes every time a new snapshot is swapped in
+            uint32_t epoch() const { return version; }
+
+            void add(const EventHandler &handler) {
+                list_t list = current ? *current : list_t();
+                auto pos = std::upper_bound(list.begin(), list.end(), handler,
+                    [](const EventHandler &a, const EventHandler &b) { return std::less<Plugin*>()(a.plugin, b.plugin); });
+                list.insert(pos, handler);
+                set(std::move(list));
+            }
+
+            // removes every handler matching pred; returns false if none did
+            template<typename Pred>
+            bool removeIf(Pred pred) {
+                if (!current || std::none_of(current->begin(), current->end(), pred))
+                    return false;
+                list_t list;
+                list.reserve(current->size());
+                for (auto &handle : *current)
+                    if (!pred(handle))
+                        list.push_back(handle);
+                set(std::move(list));
+                return true;
+            }
+
+        private:
+            std::shared_ptr<const list_t> current;
+            uint32_t version = 0;
+
+            void set(list_t &&list) {
+                if (list.empty())
+                    current.reset();
+                else
+                    current = std::make_shared<const list_t>(std::move(list));
+                ++version;
+            }
+        };
+
         DFHACK_EXPORT void registerListener(EventType::EventType e, EventHandler handler);
         DFHACK_EXPORT int32_t registerTick(EventHandler handler, int32_t when, bool absolute=false);
         DFHACK_EXPORT void unregister(EventType::EventType e, EventHandler handler);
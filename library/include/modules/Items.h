@@ -40,6 +40,10 @@ distribution.
 #include "df/specific_ref.h"
 #include "df/unit_inventory_item.h"
 
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
 namespace df {
     struct body_part_raw;
     struct building_actual;
@@ -97,6 +101,32 @@ inline bool operator!= (const ItemTypeInfo &a, const ItemTypeInfo &b) {
     return a.type != b.type || a.subtype != b.subtype;
 }
 
+/**
+ * One bucket of the item census: the items in play that share all of these.
+ * flags only holds the bits in Items::getCensusFlags().
+ */
+struct ItemCensusKey {
+    df::item_type type;
+    int16_t subtype;
+    int16_t mat_type;
+    int32_t mat_index;
+    int16_t maker_race;
+    int16_t quality;
+    int16_t wear;
+    uint32_t flags;
+
+    bool operator==(const ItemCensusKey &o) const {
+        return type == o.type && subtype == o.subtype && mat_type == o.mat_type &&
+            mat_index == o.mat_index && maker_race == o.maker_race &&
+            quality == o.quality && wear == o.wear && flags == o.flags;
+    }
+};
+
+struct ItemCensusCount {
+    int32_t items = 0;
+    int32_t stack = 0; // sum of stack sizes
+};
+
 /**
  * The Items module
  * \ingroup grp_modules
@@ -110,6 +140,9 @@ DFHACK_EXPORT bool isCasteMaterial(df::item_type itype);
 DFHACK_EXPORT int getSubtypeCount(df::item_type itype);
 // Returns the raw definition for given item type and subtype or NULL.
 DFHACK_EXPORT df::itemdef *getSubtypeDef(df::item_type itype, int subtype);
+// Returns the subtype with the given raw token, or -1. Uses a hash table that
+// is dropped when a world is loaded or unloaded.
+DFHACK_EXPORT int findSubtype(df::item_type itype, const std::string &token);
 
 // Look for a particular item by ID.
 DFHACK_EXPORT df::item *findItemByID(int32_t id);
@@ -201,5 +234,68 @@ DFHACK_EXPORT bool isRouteVehicle(df::item *item);
 DFHACK_EXPORT bool isSquadEquipment(df::item *item);
 // Returns the item's capacity as a storage container.
 DFHACK_EXPORT int32_t getCapacity(df::item *item);
+
+/**
+ * The item census counts the items in play by ItemCensusKey, so tools that
+ * only need totals don't have to look at every item. It is brought up to
+ * date on the first query in each frame, by a sweep that only recomputes the
+ * key of items that are new, or whose census flags, wear or stack size
+ * changed. Changes made earlier in the same frame may not be counted yet.
+ */
+// The item flags the census is keyed on; exclude_flags can only use these.
+DFHACK_EXPORT uint32_t getCensusFlags();
+// Calls fn for every census bucket of the given item type.
+DFHACK_EXPORT void forEachCensusCount(df::item_type itype,
+    std::function<void(const ItemCensusKey &, const ItemCensusCount &)> fn);
+// Totals the census buckets that match; -1 matches anything. Items with any
+// of exclude_flags set, or with wear above max_wear, are left out.
+DFHACK_EXPORT ItemCensusCount getCensusCount(df::item_type itype, int16_t subtype = -1,
+    int16_t mat_type = -1, int32_t mat_index = -1, uint32_t exclude_flags = 0, int max_wear = 3);
+
+/**
+ * A set of items for repeated "which remaining item is closest to this spot"
+ * queries with removal, e.g. to hand out the nearest items to a list of jobs.
+ * Distance is max(|dx|, |dy|) + |dz|. Items are bucketed by map block, and a
+ * query only looks at blocks that could hold something closer than the best
+ * item found so far.
+ */
+class DFHACK_EXPORT NearestItemIndex {
+public:
+    void clear();
+    // Adds the item at its current position, or at the given one.
+    // Items that are already in the index, or that have no valid position
+    // (e.g. ones carried off the map), are left alone.
+    void add(df::item *item);
+    void add(df::item *item, df::coord pos);
+    // Returns false if the item isn't in the index.
+    bool remove(df::item *item);
+
+    size_t size() const { return by_item.size(); }
+    bool empty() const { return by_item.empty(); }
+
+    // Returns the item closest to pos, or NULL if the index is empty.
+    // Ties go to the item that was added first.
+    df::item *findNearest(df::coord pos, int *distance = NULL) const;
+
+    static int distance(df::coord a, df::coord b);
+
+private:
+    struct Entry {
+        df::coord pos;
+        df::item *item; // NULL once removed
+    };
+    struct Cell {
+        std::vector<size_t> entries; // ascending
+        size_t alive = 0;
+    };
+
+    std::vector<Entry> entries;
+    std::unordered_map<df::item *, size_t> by_item;
+    std::unordered_map<uint64_t, Cell> cells;
+    // block and z-level bounds of everything ever added since clear()
+    int bx_min = 0, bx_max = -1, by_min = 0, by_max = -1, z_min = 0, z_max = -1;
+
+    static uint64_t cellKey(int bx, int by, int z);
+};
 }
 }
@@ -36,6 +36,7 @@ distribution.
 
 #include <bitset>
 #include <cstring>
+#include <functional>
 #include <stdint.h>
 
 namespace df {
@@ -329,6 +330,7 @@ private:
     void init();
 
     bool valid:1;
+    bool referenced:1;
     bool dirty_designations:1;
     bool dirty_tiles:1;
     bool dirty_veins:1;
@@ -421,7 +423,12 @@ class DFHACK_EXPORT MapCache
     }
 
     /// get the map block at a *block* coord. Block coord = tile coord / 16
-    Block *BlockAt(DFCoord blockcoord);
+    Block *BlockAt(DFCoord blockcoord) {
+        // consecutive tile accesses usually hit the same block
+        if (last_block && blockcoord == last_bcoord)
+            return last_block;
+        return BlockAtSlow(blockcoord);
+    }
     /// get the map block at a tile coord.
     Block *BlockAtTile(DFCoord coord) {
         return BlockAt(df::coord(coord.x>>4,coord.y>>4,coord.z));
@@ -436,6 +443,13 @@ class DFHACK_EXPORT MapCache
     /// delete the block from memory
     void discardBlock(Block *block);
 
+    /// Limit the number of blocks kept in memory at once. When the limit is
+    /// exceeded, the least recently used blocks that have no pending changes
+    /// or tags are discarded, so Block pointers obtained earlier must not be
+    /// held across further accesses. 0 (the default) means no limit.
+    void setBlockLimit(size_t limit) { block_limit = limit; }
+    size_t getLoadedBlockCount() { return num_loaded; }
+
     df::tiletype baseTiletypeAt (DFCoord tilecoord)
     {
         Block *b = BlockAtTile(tilecoord);
@@ -583,12 +597,11 @@ class DFHACK_EXPORT MapCache
 
     void trash()
     {
-        std::map<DFCoord, Block *>::iterator p;
-        for(p = blocks.begin(); p != blocks.end(); p++)
-        {
-            delete p->second;
-        }
-        blocks.clear();
+        for (Block *b : block_table)
+            delete b;
+        block_table.clear();
+        num_loaded = 0;
+        last_block = NULL;
     }
 
     uint32_t maxBlockX() { return x_bmax; }
@@ -617,6 +630,69 @@ private:
     uint32_t z_max;
     std::vector<BiomeInfo> biomes;
     std::map<df::coord2d, df::world_region_details*> region_details;
-    std::map<DFCoord, Block *> blocks;
+
+    // Dense table of loaded blocks indexed by block coordinate. The table is
+    // allocated on first access; the blocks themselves are loaded lazily.
+    std::vector<Block *> block_table;
+    size_t num_loaded;
+    size_t block_limit;
+    size_t clock_hand;
+
+    DFCoord last_bcoord;
+    Block *last_block;
+
+    Block *BlockAtSlow(DFCoord blockcoord);
+    size_t blockIndex(DFCoord blockcoord) {
+        return (size_t(blockcoord.z) * y_bmax + blockcoord.y) * x_bmax + blockcoord.x;
+    }
+    Block *lookupBlock(DFCoord blockcoord) {
+        if (block_table.empty() ||
+            unsigned(blockcoord.x) >= x_bmax ||
+            unsigned(blockcoord.y) >= y_bmax ||
+            unsigned(blockcoord.z) >= z_max)
+            return NULL;
+        return block_table[blockIndex(blockcoord)];
+    }
+    void evictBlocks();
 };
+
+/**
+ * Read-only parallel map scans.
+ *
+ * The map is split into rows of blocks (one z level, one block y) which are
+ * handed out to a pool of worker threads. Every worker owns a private
+ * MapCache, so the callback may use any of the Block read accessors, but it
+ * must not modify the map, write through the cache or call anything that
+ * needs the core lock. The caller must hold a CoreSuspender for the whole
+ * scan, which is what keeps the map consistent while the workers read it.
+ *
+ * The callback is only called for valid (allocated) blocks.
+ */
+typedef std::function<void(size_t worker, Block *block)> BlockScanFn;
+
+/// number of workers a scan will use; 0 means one per hardware thread
+DFHACK_EXPORT size_t getScanWorkerCount(size_t max_workers = 0);
+
+/// runs fn for every block on the map; returns the number of workers used.
+/// exceptions thrown by fn stop the scan and are rethrown on this thread.
+DFHACK_EXPORT size_t parallelBlockScan(const BlockScanFn &fn, size_t max_workers = 0);
+
+/**
+ * Per-worker reduction over parallelBlockScan. Each worker folds blocks into
+ * its own default-constructed Acc through fn(acc, block), and the partial
+ * results are combined on the calling thread with merge(result, partial).
+ */
+template<typename Acc, typename Fn, typename Merge>
+Acc parallelBlockReduce(Fn &&fn, Merge &&merge, size_t max_workers = 0)
+{
+    std::vector<Acc> partial(getScanWorkerCount(max_workers));
+    size_t used = parallelBlockScan([&](size_t worker, Block *block) {
+        fn(partial[worker], block);
+    }, partial.size());
+
+    Acc result = std::move(partial[0]);
+    for (size_t i = 1; i < used; i++)
+        merge(result, partial[i]);
+    return result;
+}
 }
@@ -40,9 +40,12 @@ distribution.
 #include "df/block_flags.h"
 #include "df/feature_type.h"
 #include "df/flow_type.h"
+#include "df/map_block.h"
 #include "df/tile_dig_designation.h"
 #include "df/tiletype.h"
 
+#include <algorithm>
+
 namespace df {
     struct block_square_event;
     struct block_square_event_designation_priorityst;
@@ -176,6 +179,41 @@ inline bool is_valid_tile_coord(df::coord2d p) {
     return (p.x & ~15) == 0 && (p.y & ~15) == 0;
 }
 
+/**
+ * The tiles of a single map block that fall inside a cuboid, in block-local
+ * coordinates (0-15, inclusive bounds). DF stores per-tile block arrays
+ * (tiletype, designation, occupancy, ...) as [x][y], so looping x in the outer
+ * loop and y in the inner loop walks each array sequentially, and a whole
+ * block->designation[x] column can be processed as one contiguous run.
+ * \ingroup grp_maps
+ */
+struct block_span {
+    df::map_block *block;
+    // map tile coordinate of the block's (0,0) tile
+    int16_t base_x;
+    int16_t base_y;
+    int16_t z;
+    uint8_t x_min;
+    uint8_t x_max;
+    uint8_t y_min;
+    uint8_t y_max;
+
+    bool isFullBlock() const { return x_min == 0 && y_min == 0 && x_max == 15 && y_max == 15; }
+    df::coord getPos(int x, int y) const { return df::coord(base_x + x, base_y + y, z); }
+
+    /// Call "fn(x, y)" with block-local coordinates for each tile in the span,
+    /// in memory order. "fn" should return true to keep iterating. Returns
+    /// false if iteration was stopped early.
+    template<typename Fn>
+    bool forTile(Fn &&fn) const {
+        for (int x = x_min; x <= x_max; x++)
+            for (int y = y_min; y <= y_max; y++)
+                if (!fn(x, y))
+                    return false;
+        return true;
+    }
+};
+
 /**
  * Utility class representing a cuboid of df::coord.
  * \ingroup grp_maps
@@ -240,6 +278,13 @@ class cuboid {
     /// Can optionally attempt to create map blocks if they aren't allocated.
     /// "fn" should return true to keep iterating. Won't iterate if cuboid::clampMap() would fail.
     DFHACK_EXPORT void forBlock(std::function<bool(df::map_block *, cuboid)> fn, bool ensure_block = false) const;
+
+    /// Like forBlock, but inlinable and supplies the intersection as a block_span so
+    /// "fn" can work on the block's tile arrays directly instead of one df::coord at a time.
+    /// forBlock is implemented on top of this. "fn" takes a const block_span&
+    /// and should return true to keep iterating.
+    template<typename Fn>
+    void forBlockSpan(Fn &&fn, bool ensure_block = false) const;
 };
 
 /**
@@ -396,12 +441,134 @@ DFHACK_EXPORT bool isTileHeavyAquifer(int32_t x, int32_t y, int32_t z);
 inline bool isTileHeavyAquifer(df::coord pos) { return isTileHeavyAquifer(pos.x, pos.y, pos.z); }
 DFHACK_EXPORT bool setTileAquifer(int32_t x, int32_t y, int32_t z, bool heavy = false);
 inline bool setTileAquifer(df::coord pos, bool heavy = false) { return setTileAquifer(pos.x, pos.y, pos.z, heavy); }
-DFHACK_EXPORT int setAreaAquifer(df::coord pos1, df::coord pos2, bool heavy = false,
-    std::function<bool(df::coord, df::map_block *)> filter = [](df::coord pos, df::map_block *block) { return true; });
+// Sets or removes the aquifer on the tiles in the area for which filter(pos, block) returns true;
+// returns the number of tiles changed. These are templates (defined below) so that the filter
+// is inlined into the per-tile loop.
+template<typename Filter>
+int setAreaAquifer(df::coord pos1, df::coord pos2, bool heavy, Filter &&filter);
+inline int setAreaAquifer(df::coord pos1, df::coord pos2, bool heavy = false) {
+    return setAreaAquifer(pos1, pos2, heavy, [](df::coord, df::map_block *) { return true; });
+}
 DFHACK_EXPORT bool removeTileAquifer(int32_t x, int32_t y, int32_t z);
 inline bool removeTileAquifer(df::coord pos) { return removeTileAquifer(pos.x, pos.y, pos.z); }
-DFHACK_EXPORT int removeAreaAquifer(df::coord pos1, df::coord pos2,
-    std::function<bool(df::coord, df::map_block *)> filter = [](df::coord pos, df::map_block *block) { return true; });
+template<typename Filter>
+int removeAreaAquifer(df::coord pos1, df::coord pos2, Filter &&filter);
+inline int removeAreaAquifer(df::coord pos1, df::coord pos2) {
+    return removeAreaAquifer(pos1, pos2, [](df::coord, df::map_block *) { return true; });
+}
+}
+
+template<typename Fn>
+void cuboid::forBlockSpan(Fn &&fn, bool ensure_block) const
+{
+    auto c = *this; // Create a copy to modify.
+    if (!c.clampMap().isValid()) // No intersection.
+        return;
+
+    // Process z, y, then x.
+    for (int16_t x = (c.x_min >> 4) << 4; x <= c.x_max; x += 16)
+        for (int16_t y = (c.y_min >> 4) << 4; y <= c.y_max; y += 16)
+            for (int16_t z = c.z_max; z >= c.z_min; z--)
+            {
+                auto *block = ensure_block ? Maps::ensureTileBlock(x, y, z) : Maps::getTileBlock(x, y, z);
+                if (!block) // Skip unallocated block.
+                    continue;
+                block_span span;
+                span.block = block;
+                span.base_x = x;
+                span.base_y = y;
+                span.z = z;
+                span.x_min = uint8_t(std::max<int>(c.x_min - x, 0));
+                span.x_max = uint8_t(std::min<int>(c.x_max - x, 15));
+                span.y_min = uint8_t(std::max<int>(c.y_min - y, 0));
+                span.y_max = uint8_t(std::min<int>(c.y_max - y, 15));
+                if (!fn(static_cast<const block_span &>(span)))
+                    return; // Break iterator.
+            }
+}
+
+namespace Maps
+{
+// The work setAreaAquifer does on one block; returns the number of tiles changed.
+template<typename Filter>
+int setBlockAquifer(const block_span &span, bool heavy, Filter &&filter)
+{
+    df::map_block *block = span.block;
+    int blockAffectedCount = 0;
+    // Loop through the affected tiles in the block
+    span.forTile([&](int x, int y) {
+        if (filter(span.getPos(x, y), block)) {
+            blockAffectedCount++;
+            block->designation[x][y].bits.water_table = true;
+            block->occupancy[x][y].bits.heavy_aquifer = heavy;
+        }
+        return true; // Keep iterating tiles
+    });
+
+    // If any tile was set to be an aquifer, update the block
+    if (blockAffectedCount > 0) {
+        block->flags.bits.has_aquifer = true;
+        block->flags.bits.check_aquifer = true;
+        block->flags.bits.update_liquid = true;
+        block->flags.bits.update_liquid_twice = true;
+    }
+    return blockAffectedCount;
+}
+
+// The work removeAreaAquifer does on one block; returns the number of tiles changed.
+template<typename Filter>
+int removeBlockAquifer(const block_span &span, Filter &&filter)
+{
+    df::map_block *block = span.block;
+    int blockAffectedCount = 0;
+    int aquiferCount = 0;
+
+    // Loop through all tiles in the block, to see whether any aquifer is left
+    for (int x = 0; x < 16; x++) {
+        bool in_span_x = x >= span.x_min && x <= span.x_max;
+        for (int y = 0; y < 16; y++) {
+            auto &des = block->designation[x][y];
+            if (!des.bits.water_table)
+                continue;
+            if (in_span_x && y >= span.y_min && y <= span.y_max && filter(span.getPos(x, y), block)) {
+                blockAffectedCount++;
+                des.bits.water_table = false;
+                block->occupancy[x][y].bits.heavy_aquifer = false;
+            }
+            else
+                aquiferCount++;
+        }
+    }
+
+    // If none of the block's tiles are now aquifers, update the block
+    if (aquiferCount == 0) {
+        block->flags.bits.has_aquifer = false;
+        block->flags.bits.check_aquifer = false;
+    }
+    return blockAffectedCount;
+}
+
+template<typename Filter>
+int setAreaAquifer(df::coord pos1, df::coord pos2, bool heavy, Filter &&filter)
+{
+    int totalAffectedCount = 0;
+    cuboid(pos1, pos2).forBlockSpan([&](const block_span &span) {
+        totalAffectedCount += setBlockAquifer(span, heavy, filter);
+        return true; // Keep iterating blocks
+    });
+    return totalAffectedCount;
+}
+
+template<typename Filter>
+int removeAreaAquifer(df::coord pos1, df::coord pos2, Filter &&filter)
+{
+    int totalAffectedCount = 0;
+    cuboid(pos1, pos2).forBlockSpan([&](const block_span &span) {
+        totalAffectedCount += removeBlockAquifer(span, filter);
+        return true; // Keep iterating blocks
+    });
+    return totalAffectedCount;
+}
 }
 }
 #endif
@@ -172,6 +172,20 @@ namespace DFHack
     DFHACK_EXPORT bool isSoilInorganic(int material);
     DFHACK_EXPORT bool isStoneInorganic(int material);
 
+    /**
+     * Raw lookups by token, returning -1 if there is no such object. These
+     * use hash tables built on first use and dropped when a world is loaded
+     * or unloaded, so repeated lookups don't scan the raw vectors.
+     */
+    DFHACK_EXPORT int findBuiltinIndex(const std::string &token);
+    DFHACK_EXPORT int findInorganicIndex(const std::string &token);
+    DFHACK_EXPORT int findPlantIndex(const std::string &token);
+    DFHACK_EXPORT int findCreatureIndex(const std::string &token);
+    DFHACK_EXPORT int findCasteIndex(int creature, const std::string &token);
+    // index into the material vector of the plant or creature raw
+    DFHACK_EXPORT int findPlantMaterialIndex(int plant, const std::string &token);
+    DFHACK_EXPORT int findCreatureMaterialIndex(int creature, const std::string &token);
+
     typedef int32_t t_materialIndex;
     typedef int16_t t_materialType, t_itemType, t_itemSubtype;
 
@@ -33,6 +33,8 @@ distribution.
 #include "Error.h"
 #include "Export.h"
 
+#include <array>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -53,6 +55,8 @@ namespace DFHack
     public:
         static const size_t NumInts = 7;
 
+        // false once the item is deleted or the world is unloaded. Doesn't
+        // need the core suspended, so it is cheap enough to check per access.
         bool isValid() const;
 
         // Used for associating this data item with a map block tile mask
@@ -186,7 +190,12 @@ namespace DFHack
     {
         class Internal {
             static void clear(color_ostream& out);
+            // gathers the data with the core suspended and writes it out on
+            // a separate thread; only stores that changed are rewritten
             static void save(color_ostream& out);
+            // waits until the files from the last save() are written and
+            // reports any that couldn't be. Called at the end of every frame.
+            static void finishSave(color_ostream& out);
             static void load(color_ostream& out);
             friend class ::DFHack::Core;
         };
@@ -213,7 +222,46 @@ namespace DFHack
         // Fills the vector with references to each persistent item with a key that is
         // equal to the given key.
         DFHACK_EXPORT void getAllByKey(std::vector<PersistentDataItem> &vec, int entity_id, const std::string &key);
+        // Call fn with each persistent item with a key in [min, max), with the
+        // given key, or starting with the given prefix (all items if the prefix
+        // is empty), in key order and without building a vector. Iteration stops
+        // early if fn returns false. Returns false if fn added or deleted items,
+        // which also stops the iteration.
+        DFHACK_EXPORT bool forEachByKeyRange(int entity_id, const std::string &min, const std::string &max,
+            const std::function<bool(const PersistentDataItem &)> &fn);
+        DFHACK_EXPORT bool forEachByKey(int entity_id, const std::string &key,
+            const std::function<bool(const PersistentDataItem &)> &fn);
+        DFHACK_EXPORT bool forEachByPrefix(int entity_id, const std::string &prefix,
+            const std::function<bool(const PersistentDataItem &)> &fn);
         // Returns the number of seconds since the current savegame was saved or loaded.
         DFHACK_EXPORT uint32_t getUnsavedSeconds();
+
+        // The format used for writing the dfhack-*.dat files. Files in either
+        // format are loaded. JSON is larger and slower to load, but readable
+        // and understood by older DFHack versions, so it is the default. The
+        // choice is kept in dfhack-config/persistence.json.
+        enum class SaveFormat {
+            BINARY,
+            JSON
+        };
+        DFHACK_EXPORT SaveFormat getSaveFormat();
+        DFHACK_EXPORT void setSaveFormat(SaveFormat format);
+
+        // the saved fields of an item, as written to the dfhack-*.dat files
+        struct SavedEntry {
+            std::string key;
+            int fake_df_id;
+            std::string str_value;
+            std::array<int, PersistentDataItem::NumInts> int_values;
+
+            bool operator==(const SavedEntry &) const = default;
+        };
+
+        // For tests of the file formats: encodes the entries in the given
+        // format and decodes them again the way a save is loaded, without
+        // touching the stored data. The decoded entries are in key order.
+        // Returns false if they don't decode.
+        DFHACK_EXPORT bool roundTripSaveFormat(SaveFormat format, const std::vector<SavedEntry> &entries,
+            std::vector<SavedEntry> &decoded, size_t *bytes = nullptr);
     }
 }
@@ -192,6 +192,13 @@ DFHACK_EXPORT inline bool getUnitsInBox(std::vector<df::unit *> &units, int16_t
 DFHACK_EXPORT inline bool getUnitsInBox(std::vector<df::unit *> &units, df::coord pos1, df::coord pos2,
     std::function<bool(df::unit *)> filter = [](df::unit *u) { return true; })
     { return getUnitsInBox(units, cuboid(pos1, pos2), filter); }
+// Fill vector with units within radius tiles (straight-line distance) of center matching filter.
+DFHACK_EXPORT bool getUnitsInRadius(std::vector<df::unit *> &units, df::coord center, int radius,
+    std::function<bool(df::unit *)> filter = [](df::unit *u) { return true; });
+// Fill vector with up to count units matching filter, nearest to pos first. Ties are
+// broken by order in the active unit vector. The filter is called in no particular order.
+DFHACK_EXPORT bool getNearestUnits(std::vector<df::unit *> &units, df::coord pos, size_t count,
+    std::function<bool(df::unit *)> filter = [](df::unit *u) { return true; });
 
 // Noble string must be in form "CAPTAIN_OF_THE_GUARD", etc.
 DFHACK_EXPORT bool getUnitsByNobleRole(std::vector<df::unit *> &units, std::string noble);
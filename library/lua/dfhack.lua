@@ -156,6 +156,21 @@ function dfhack.with_onerror(cleanup_fn,fn,...)
     return dfhack.call_with_finalizer(0,false,cleanup_fn,fn,...)
 end
 
+-- Runs fn and records its run time as a span named name in the frame trace
+-- (see the devel/trace command). Costs one C call when tracing is disabled.
+---@generic T
+---@param name string
+---@param fn fun(...): T
+---@param ... any
+---@return T
+function dfhack.with_trace_span(name,fn,...)
+    if not dfhack.internal.isTraceEnabled() then
+        return fn(...)
+    end
+    local start_us = dfhack.internal.getPerfTimestampUs()
+    return dfhack.call_with_finalizer(2,true,dfhack.internal.recordTraceSpan,name,start_us,fn,...)
+end
+
 ---@param obj DFObject
 local function call_delete(obj)
     if obj then obj:delete() end
@@ -170,6 +185,47 @@ function dfhack.with_temp_object(obj,fn,...)
     return dfhack.call_with_finalizer(1,true,call_delete,obj,fn,obj,...)
 end
 
+-- Calls fn and records its run time in the per-repeat counters under name.
+---@param name string
+---@param fn function
+function dfhack.internal.runTimed(name, fn)
+    local now_ms = dfhack.getTickCount()
+    local now_us = dfhack.internal.getPerfTimestampUs()
+    safecall(fn)
+    dfhack.internal.recordRepeatRuntime(name, now_ms)
+    dfhack.internal.recordRepeatLatency(name, now_us)
+end
+
+-- Runs the timers that came due this frame; called from the core with the
+-- callback and name tables of dfhack.timeout and the due ids in order.
+-- Named timers (i.e. those from repeat-util) have their run time recorded
+-- under their name. Unnamed callbacks only get latency histograms, and only
+-- while those are enabled, keyed by where the callback was defined.
+---@param callbacks table<integer, function>
+---@param names table<integer, string>
+---@param ids integer[]
+function dfhack.internal.runTimers(callbacks, names, ids)
+    local histograms = dfhack.internal.getPerfHistogramsEnabled()
+    for _,id in ipairs(ids) do
+        local cb, name = callbacks[id], names[id]
+        names[id] = nil
+        if cb then
+            callbacks[id] = nil
+            if name then
+                dfhack.internal.runTimed(name, cb)
+            elseif histograms then
+                local info = debug.getinfo(cb, 'S')
+                local now_us = dfhack.internal.getPerfTimestampUs()
+                safecall(cb)
+                dfhack.internal.recordRepeatLatency(
+                    ('timeout@%s:%d'):format(info.short_src, info.linedefined), now_us)
+            else
+                safecall(cb)
+            end
+        end
+    end
+end
+
 dfhack.exception.__index = dfhack.exception
 
 -- Module loading
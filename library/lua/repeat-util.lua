@@ -35,17 +35,17 @@ end
 
 function scheduleEvery(name, time, timeUnits, func)
     cancel(name)
+    -- the timer dispatcher records the run time under the timer name
     local function helper()
-        local now_ms = dfhack.getTickCount()
         func()
-        dfhack.internal.recordRepeatRuntime(name, now_ms)
-
         if repeating[name] then
-            repeating[name] = dfhack.timeout(time, timeUnits, helper)
+            repeating[name] = dfhack.timeout(time, timeUnits, helper, name)
         end
     end
     repeating[name] = -1
-    helper()
+    -- the first run happens now rather than from the timer dispatcher, so
+    -- it is timed here
+    dfhack.internal.runTimed(name, helper)
 end
 
 function scheduleUnlessAlreadyScheduled(name, time, timeUnits, func)
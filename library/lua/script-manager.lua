@@ -288,9 +288,72 @@ local function print_sorted_timers(in_timers, width, rel1_ms, desc1, rel2_ms, de
     print(format_relative_time(width, 'all subtimers', sum, rel1_ms, desc1, rel2_ms, desc2))
 end
 
+local function print_sorted_counts(in_counts, width)
+    local sorted = {}
+    for name,count in pairs(in_counts) do
+        table.insert(sorted, {name=name, count=count})
+    end
+    table.sort(sorted, function(a, b) return a.count > b.count end)
+    local fmt = '%' .. tostring(width) .. 's %12d'
+    for _, elem in ipairs(sorted) do
+        if elem.count > 0 then
+            print(fmt:format(elem.name, elem.count))
+        end
+    end
+end
+
+local function print_sorted_histograms(in_histograms, width)
+    local sorted = {}
+    for name,histogram in pairs(in_histograms) do
+        table.insert(sorted, {name=name, h=histogram})
+    end
+    table.sort(sorted, function(a, b) return a.h.total_us > b.h.total_us end)
+    local fmt = '%' .. tostring(width) .. 's %10s %10s %10s %10s %10s'
+    print(fmt:format('', 'calls', 'p50 us', 'p99 us', 'max us', 'total us'))
+    for _, elem in ipairs(sorted) do
+        if elem.h.count > 0 then
+            print(fmt:format(elem.name, elem.h.count, elem.h.p50_us, elem.h.p99_us,
+                elem.h.max_us, elem.h.total_us))
+        end
+    end
+end
+
+local function print_histograms()
+    local histograms = dfhack.internal.getPerfHistograms()
+
+    for k,v in pairs(histograms.event_manager) do
+        print()
+        print()
+        local title = ('Event manager %s event latency per plugin'):format(k)
+        print(title)
+        print(('-'):rep(#title))
+        print()
+        print_sorted_histograms(v, 25)
+    end
+
+    if next(histograms.update_per_plugin) then
+        print()
+        print()
+        print('Update latency per plugin')
+        print('-------------------------')
+        print()
+        print_sorted_histograms(histograms.update_per_plugin, 25)
+    end
+
+    if next(histograms.update_lua_per_repeat) then
+        print()
+        print()
+        print('Lua timer latency')
+        print('-----------------')
+        print()
+        print_sorted_histograms(histograms.update_lua_per_repeat, 45)
+    end
+end
+
 function print_timers()
     local summary, em_per_event, em_per_plugin_per_event, update_per_plugin, state_change_per_plugin,
-        update_lua_per_repeat, overlay_per_widget, zscreen_per_focus = dfhack.internal.getPerfCounters()
+        update_lua_per_repeat, overlay_per_widget, zscreen_per_focus,
+        em_scanned_per_event = dfhack.internal.getPerfCounters()
 
     local elapsed = summary.elapsed_ms
     local total_update_time = summary.total_update_ms
@@ -340,6 +403,15 @@ function print_timers()
         print()
         print_sorted_timers(em_per_event, 25, summary.update_event_manager_ms, 'event manager', elapsed, 'elapsed')
 
+        if next(em_scanned_per_event) then
+            print()
+            print()
+            print('Event manager entities scanned per event type')
+            print('---------------------------------------------')
+            print()
+            print_sorted_counts(em_scanned_per_event, 25)
+        end
+
         for k,v in pairs(em_per_plugin_per_event) do
             if em_per_event[k] <= 0 then goto continue end
             print()
@@ -394,6 +466,23 @@ function print_timers()
         print()
         print_sorted_timers(zscreen_per_focus, 45, total_zscreen_time, 'zscreen', elapsed, 'elapsed')
     end
+
+    if summary.rpc_batched_calls > 0 then
+        print()
+        print()
+        print('Batched remote calls')
+        print('--------------------')
+        print()
+        print(('%20s %12d'):format('calls', summary.rpc_batched_calls))
+        print(('%20s %12d'):format('deferred', summary.rpc_deferred_calls))
+        print(('%20s %12d'):format('max queue depth', summary.rpc_max_queue_depth))
+        print()
+        print_sorted_histograms({['queue wait']=dfhack.internal.getPerfHistograms().rpc_queue_wait}, 20)
+    end
+
+    if dfhack.internal.getPerfHistogramsEnabled() then
+        print_histograms()
+    end
 end
 
 return _ENV
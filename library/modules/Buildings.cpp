@@ -109,14 +109,6 @@ using std::string;
 using std::unordered_map;
 using std::vector;
 
-struct CoordHash {
-    size_t operator()(const df::coord pos) const {
-        return pos.x*65537 + pos.y*17 + pos.z;
-    }
-};
-
-static unordered_map<df::coord, int32_t, CoordHash> locationToBuilding;
-
 static df::building_extents_type *getExtentTile(const df::building::T_room &room, df::coord2d tile)
 {
     if (!room.extents)
@@ -128,6 +120,162 @@ static df::building_extents_type *getExtentTile(const df::building::T_room &room
     return &room.extents[dx + dy*room.width];
 }
 
+namespace {
+    /*
+     * Buildings and civzones by map block, so tile and area lookups only
+     * look at the buildings whose bounding rectangle overlaps the blocks in
+     * question. Kept up to date by updateBuildings(), and reconciled with
+     * the building vector before lookups in case that hasn't run yet.
+     * Buildings can't change shape, but zones can be repainted in the UI,
+     * so zone bounds are rechecked on the first lookup in each frame, and
+     * right away when a tool calls notifyCivzoneModified().
+     */
+    class BuildingIndex {
+        struct Bounds {
+            int16_t x1, y1, x2, y2, z;
+            bool operator==(const Bounds &o) const {
+                return x1 == o.x1 && y1 == o.y1 && x2 == o.x2 && y2 == o.y2 && z == o.z;
+            }
+        };
+        struct Entry {
+            Bounds bounds;
+            uint32_t generation;
+        };
+
+        unordered_map<int32_t, Entry> entries;
+        // sorted building ids by block
+        unordered_map<uint64_t, vector<int32_t>> cells;
+
+        size_t synced_count = 0;
+        int32_t synced_next_id = -1;
+        uint32_t zones_checked_frame = 0;
+        uint32_t generation = 0;
+
+        static uint64_t cellKey(int x, int y, int z) {
+            return (uint64_t(uint16_t(z)) << 32) | (uint64_t(uint16_t(x >> 4)) << 16) | uint16_t(y >> 4);
+        }
+
+        static Bounds getBounds(df::building *bld) {
+            Bounds b;
+            b.x1 = std::min(bld->x1, bld->x2);
+            b.x2 = std::max(bld->x1, bld->x2);
+            b.y1 = std::min(bld->y1, bld->y2);
+            b.y2 = std::max(bld->y1, bld->y2);
+            b.z = bld->z;
+            if (bld->room.extents && bld->room.width > 0 && bld->room.height > 0) {
+                b.x1 = std::min<int16_t>(b.x1, bld->room.x);
+                b.y1 = std::min<int16_t>(b.y1, bld->room.y);
+                b.x2 = std::max<int16_t>(b.x2, bld->room.x + bld->room.width - 1);
+                b.y2 = std::max<int16_t>(b.y2, bld->room.y + bld->room.height - 1);
+            }
+            return b;
+        }
+
+        void link(int32_t id, const Bounds &b) {
+            for (int by = b.y1 >> 4; by <= b.y2 >> 4; by++) {
+                for (int bx = b.x1 >> 4; bx <= b.x2 >> 4; bx++) {
+                    auto &cell = cells[cellKey(bx << 4, by << 4, b.z)];
+                    cell.insert(std::lower_bound(cell.begin(), cell.end(), id), id);
+                }
+            }
+        }
+
+        void unlink(int32_t id, const Bounds &b) {
+            for (int by = b.y1 >> 4; by <= b.y2 >> 4; by++) {
+                for (int bx = b.x1 >> 4; bx <= b.x2 >> 4; bx++) {
+                    auto it = cells.find(cellKey(bx << 4, by << 4, b.z));
+                    if (it == cells.end())
+                        continue;
+                    auto &cell = it->second;
+                    auto pos = std::lower_bound(cell.begin(), cell.end(), id);
+                    if (pos != cell.end() && *pos == id)
+                        cell.erase(pos);
+                    if (cell.empty())
+                        cells.erase(it);
+                }
+            }
+        }
+
+        // returns the entry for bld, reindexing it if its bounds changed
+        Entry &refresh(df::building *bld) {
+            Bounds b = getBounds(bld);
+            auto it = entries.find(bld->id);
+            if (it == entries.end()) {
+                link(bld->id, b);
+                return entries.emplace(bld->id, Entry{b, generation}).first->second;
+            }
+            if (!(it->second.bounds == b)) {
+                unlink(bld->id, it->second.bounds);
+                link(bld->id, b);
+                it->second.bounds = b;
+            }
+            return it->second;
+        }
+
+    public:
+        void clear() {
+            entries.clear();
+            cells.clear();
+            synced_count = 0;
+            synced_next_id = -1;
+        }
+
+        void update(df::building *bld) {
+            refresh(bld);
+        }
+
+        void remove(int32_t id) {
+            auto it = entries.find(id);
+            if (it == entries.end())
+                return;
+            unlink(id, it->second.bounds);
+            entries.erase(it);
+        }
+
+        void sync() {
+            auto &vec = df::building::get_vector();
+            int32_t next_id = building_next_id ? *building_next_id : -1;
+            if (vec.size() != synced_count || next_id != synced_next_id) {
+                // buildings were added or removed since the last look
+                generation++;
+                for (auto bld : vec)
+                    refresh(bld).generation = generation;
+                for (auto it = entries.begin(); it != entries.end(); ) {
+                    if (it->second.generation != generation) {
+                        unlink(it->first, it->second.bounds);
+                        it = entries.erase(it);
+                    } else
+                        ++it;
+                }
+                synced_count = vec.size();
+                synced_next_id = next_id;
+                zones_checked_frame = Core::getInstance().getFrameCount();
+                return;
+            }
+
+            uint32_t frame = Core::getInstance().getFrameCount();
+            if (frame != zones_checked_frame) {
+                zones_checked_frame = frame;
+                for (auto zone : world->buildings.other.ANY_ZONE)
+                    refresh(zone);
+            }
+        }
+
+        // calls fn with the id of each building whose bounds may contain a
+        // tile of the given block, in id order
+        template<typename F>
+        void forBlock(int x, int y, int z, F fn) const {
+            auto it = cells.find(cellKey(x, y, z));
+            if (it == cells.end())
+                return;
+            for (int32_t id : it->second)
+                fn(id);
+        }
+    };
+
+    BuildingIndex building_index;
+}
+
 /*
  * A monitor to work around this bug, in its application to buildings:
  *
@@ -372,89 +520,115 @@ df::building *Buildings::findAtTile(df::coord pos)
     if (!occ || !occ->bits.building)
         return NULL;
 
-    // Try cache lookup in case it works:
-    auto cached = locationToBuilding.find(pos);
-    if (cached != locationToBuilding.end())
-    {
-        auto building = df::building::find(cached->second);
-
-        if (building && building->z == pos.z &&
-            building->isSettingOccupancy() &&
-            containsTile(building, pos))
-        {
-            return building;
-        }
-    }
+    building_index.sync();
 
-    // The authentic method, i.e. how the game generally does this:
-    auto &vec = df::building::get_vector();
-    for (size_t i = 0; i < vec.size(); i++)
-    {
-        auto bld = vec[i];
+    df::building *found = NULL;
+    building_index.forBlock(pos.x, pos.y, pos.z, [&](int32_t id) {
+        if (found)
+            return;
 
-        if (pos.z != bld->z ||
+        auto bld = df::building::find(id);
+        if (!bld || pos.z != bld->z ||
             pos.x < bld->x1 || pos.x > bld->x2 ||
             pos.y < bld->y1 || pos.y > bld->y2)
-            continue;
+            return;
 
         if (!bld->isSettingOccupancy())
-            continue;
+            return;
 
         if (bld->room.extents && bld->isExtentShaped())
         {
             auto etile = getExtentTile(bld->room, pos);
             if (!etile || !*etile)
-                continue;
+                return;
         }
 
-        return bld;
-    }
+        found = bld;
+    });
 
-    return NULL;
-}
-
-static unordered_map<int32_t, df::coord> corner1;
-static unordered_map<int32_t, df::coord> corner2;
-static void cacheBuilding(df::building *building) {
-    int32_t id = building->id;
-    df::coord p1(std::min(building->x1, building->x2), std::min(building->y1,building->y2), building->z);
-    df::coord p2(std::max(building->x1, building->x2), std::max(building->y1,building->y2), building->z);
-
-    corner1[id] = p1;
-    corner2[id] = p2;
-
-    for (int32_t x = p1.x; x <= p2.x; x++) {
-        for (int32_t y = p1.y; y <= p2.y; y++) {
-            df::coord pt(x, y, building->z);
-            if (Buildings::containsTile(building, pt)) {
-                locationToBuilding[pt] = id;
-            }
-        }
-    }
+    return found;
 }
 
 bool Buildings::findCivzonesAt(std::vector<df::building_civzonest*> *pvec,
                                df::coord pos) {
     pvec->clear();
 
-    for (df::building_civzonest* zone : world->buildings.other.ANY_ZONE)
-    {
-        if (pos.z != zone->z)
-            continue;
+    building_index.sync();
 
-        if (zone->room.extents && zone->isExtentShaped())
+    building_index.forBlock(pos.x, pos.y, pos.z, [&](int32_t id) {
+        auto bld = df::building::find(id);
+        if (!bld || bld->getType() != df::building_type::Civzone || pos.z != bld->z)
+            return;
+
+        auto zone = strict_virtual_cast<df::building_civzonest>(bld);
+        if (zone && zone->room.extents && zone->isExtentShaped())
         {
             auto etile = getExtentTile(zone->room, pos);
             if (!etile || !*etile)
-                continue;
+                return;
 
             pvec->push_back(zone);
         }
-    }
+    });
 
     return !pvec->empty();
 }
 
+bool Buildings::getBuildingsInBox(std::vector<df::building *> &buildings, const cuboid &box,
+                                  bool include_civzones)
+{
+    buildings.clear();
+    if (!Maps::IsValid())
+        return false;
+
+    // nothing is indexed outside the map, and the block loops below must
+    // stay bounded however large the requested box is
+    int32_t size_x, size_y, size_z;
+    Maps::getTileSize(size_x, size_y, size_z);
+    cuboid area;
+    area.x_min = std::max<int16_t>(box.x_min, 0);
+    area.y_min = std::max<int16_t>(box.y_min, 0);
+    area.z_min = std::max<int16_t>(box.z_min, 0);
+    area.x_max = std::min<int32_t>(box.x_max, size_x - 1);
+    area.y_max = std::min<int32_t>(box.y_max, size_y - 1);
+    area.z_max = std::min<int32_t>(box.z_max, size_z - 1);
+    if (!area.isValid())
+        return false;
+
+    building_index.sync();
+
+    for (int z = area.z_min; z <= area.z_max; z++)
+    {
+        for (int by = area.y_min >> 4; by <= area.y_max >> 4; by++)
+        {
+            for (int bx = area.x_min >> 4; bx <= area.x_max >> 4; bx++)
+            {
+                building_index.forBlock(bx << 4, by << 4, z, [&](int32_t id) {
+                    auto bld = df::building::find(id);
+                    if (!bld || bld->z != z)
+                        return;
+                    if (!include_civzones && bld->getType() == df::building_type::Civzone)
+                        return;
+
+                    int16_t x1 = std::min(bld->x1, bld->x2), x2 = std::max(bld->x1, bld->x2);
+                    int16_t y1 = std::min(bld->y1, bld->y2), y2 = std::max(bld->y1, bld->y2);
+                    if (x2 < area.x_min || x1 > area.x_max || y2 < area.y_min || y1 > area.y_max)
+                        return;
+
+                    // a building spanning several blocks is reported from the
+                    // first block of the box that it overlaps
+                    if (std::max<int>(x1, area.x_min) >> 4 != bx || std::max<int>(y1, area.y_min) >> 4 != by)
+                        return;
+
+                    buildings.push_back(bld);
+                });
+            }
+        }
+    }
+
+    return !buildings.empty();
+}
+
 df::building *Buildings::allocInstance(df::coord pos, df::building_type type, int subtype, int custom)
 {
     if (!building_next_id)
@@ -1449,15 +1623,15 @@ void Buildings::notifyCivzoneModified(df::building* bld)
     if (bld->getType() != building_type::Civzone)
         return;
 
+    building_index.update(bld);
+
     //remove zone here needs to be the slow method
     remove_zone_from_all_buildings(bld);
     add_zone_to_all_buildings(bld);
 }
 
 void Buildings::clearBuildings(color_ostream& out) {
-    corner1.clear();
-    corner2.clear();
-    locationToBuilding.clear();
+    building_index.clear();
 }
 
 void Buildings::updateBuildings(color_ostream&, void* ptr)
@@ -1466,32 +1640,9 @@ void Buildings::updateBuildings(color_ostream&, void* ptr)
     auto building = df::building::find(id);
 
     if (building)
-    {
-        bool is_civzone = !building->isSettingOccupancy();
-        if (!corner1.count(id) && !is_civzone)
-            cacheBuilding(building);
-    }
-    else if (corner1.count(id))
-    {
-        // existing building: destroy it
-        // note that civzones are lazy-destroyed in findCivzonesAt() and are
-        // not handled here
-        df::coord p1 = corner1[id];
-        df::coord p2 = corner2[id];
-
-        for ( int32_t x = p1.x; x <= p2.x; x++ ) {
-            for ( int32_t y = p1.y; y <= p2.y; y++ ) {
-                df::coord pt(x,y,p1.z);
-
-                auto cur = locationToBuilding.find(pt);
-                if (cur != locationToBuilding.end() && cur->second == id)
-                    locationToBuilding.erase(cur);
-            }
-        }
-
-        corner1.erase(id);
-        corner2.erase(id);
-    }
+        building_index.update(building);
+    else
+        building_index.remove(id);
 }
 
 static std::map<df::building_type, std::vector<std::string>> room_quality_names = {
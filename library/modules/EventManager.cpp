@@ -1,6 +1,7 @@
 #include "Core.h"
 #include "Console.h"
 #include "Debug.h"
+#include "Trace.h"
 #include "VTableInterpose.h"
 
 #include "modules/Buildings.h"
@@ -19,6 +20,7 @@
 #include "df/general_ref_unit_workerst.h"
 #include "df/global_objects.h"
 #include "df/historical_figure.h"
+#include "df/incident.h"
 #include "df/interaction.h"
 #include "df/item.h"
 #include "df/item_actual.h"
@@ -40,6 +42,7 @@
 #include <algorithm>
 #include <cstring>
 #include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -58,20 +61,22 @@ using namespace df::enums;
 /*
  * TODO:
  *  error checking
- *  consider a typedef instead of a struct for EventHandler
  **/
 
 static multimap<int32_t, EventHandler> tickQueue;
 
-//TODO: consider unordered_map of pairs, or unordered_map of unordered_set, or whatever
-static multimap<Plugin*, EventHandler> handlers[EventType::EVENT_MAX];
+static HandlerList handlers[EventType::EVENT_MAX];
 static int32_t eventLastTick[EventType::EVENT_MAX];
 
+static std::shared_ptr<const HandlerList::list_t> getHandlers(EventType::EventType e) {
+    return handlers[e].snapshot();
+}
+
 static const int32_t ticksPerYear = 403200;
 
 void DFHack::EventManager::registerListener(EventType::EventType e, EventHandler handler) {
     DEBUG(log).print("registering handler %p from plugin %s for event %d\n", handler.eventHandler, !handler.plugin ? "<null>" : handler.plugin->getName().c_str(), e);
-    handlers[e].insert(pair<Plugin*, EventHandler>(handler.plugin, handler));
+    handlers[e].add(handler);
 }
 
 int32_t DFHack::EventManager::registerTick(EventHandler handler, int32_t when, bool absolute) {
@@ -87,7 +92,7 @@ int32_t DFHack::EventManager::registerTick(EventHandler handler, int32_t when, b
     handler.freq = when;
     tickQueue.insert(pair<int32_t, EventHandler>(handler.freq, handler));
     DEBUG(log).print("registering handler %p from plugin %s for event TICK\n", handler.eventHandler, !handler.plugin ? "<null>" : handler.plugin->getName().c_str());
-    handlers[EventType::TICK].insert(pair<Plugin*,EventHandler>(handler.plugin,handler));
+    handlers[EventType::TICK].add(handler);
     return when;
 }
 
@@ -104,32 +109,21 @@ static void removeFromTickQueue(EventHandler getRidOf) {
 }
 
 void DFHack::EventManager::unregister(EventType::EventType e, EventHandler handler) {
-    for ( auto i = handlers[e].find(handler.plugin); i != handlers[e].end(); ) {
-        if ( (*i).first != handler.plugin )
-            break;
-        EventHandler &handle = (*i).second;
-        if ( handle != handler ) {
-            i++;
-            continue;
-        }
-        DEBUG(log).print("unregistering handler %p from plugin %s for event %d\n", handler.eventHandler, !handler.plugin ? "<null>" : handler.plugin->getName().c_str(), e);
-        i = handlers[e].erase(i);
-        if ( e == EventType::TICK )
-            removeFromTickQueue(handler);
-    }
+    if ( !handlers[e].removeIf([&](const EventHandler &h){ return h == handler; }) )
+        return;
+    DEBUG(log).print("unregistering handler %p from plugin %s for event %d\n", handler.eventHandler, !handler.plugin ? "<null>" : handler.plugin->getName().c_str(), e);
+    if ( e == EventType::TICK )
+        removeFromTickQueue(handler);
 }
 
 void DFHack::EventManager::unregisterAll(Plugin* plugin) {
     DEBUG(log).print("unregistering all handlers for plugin %s\n", !plugin ? "<null>" : plugin->getName().c_str());
-    for ( auto i = handlers[EventType::TICK].find(plugin); i != handlers[EventType::TICK].end(); i++ ) {
-        if ( (*i).first != plugin )
-            break;
-
-        removeFromTickQueue((*i).second);
-    }
-    for (auto &handler : handlers) {
-        handler.erase(plugin);
+    for (auto &handle : *getHandlers(EventType::TICK)) {
+        if ( handle.plugin == plugin )
+            removeFromTickQueue(handle);
     }
+    for (auto &list : handlers)
+        list.removeIf([&](const EventHandler &h){ return h.plugin == plugin; });
 }
 
 static void manageTickEvent(color_ostream& out);
@@ -225,7 +219,16 @@ static std::vector<JobCompleteData> prevJobs;
 static unordered_set<int32_t> activeUnits;
 
 //unit death
+//units that were alive on the active list at the last check. only these can fire a death event, so
+//the world->units.all vector (which includes every historical unit) never needs to be walked.
 static unordered_set<int32_t> livingUnits;
+//DF records every death as an incident, so while no incident has been added and the active list
+//hasn't changed size, nobody can have died or arrived and the active list isn't walked. a full check
+//still runs every deathRescanTicks, for units whose flags were changed some other way (e.g. by a script).
+static const int32_t deathRescanTicks = 100;
+static size_t lastIncidentCount;
+static size_t lastActiveCount;
+static int32_t lastDeathScanTick = -1;
 
 //item creation
 static int32_t nextItem;
@@ -245,6 +248,9 @@ namespace std {
 
 //construction
 static unordered_set<df::construction> constructions;
+//the construction vector as of the last check. if DF's vector still holds the same pointers at the
+//same positions, nothing has been built or removed and the hash set doesn't need to be touched.
+static vector<std::pair<df::construction*, df::coord>> constructionSnapshot;
 static bool gameLoaded;
 
 //syndrome
@@ -277,13 +283,23 @@ struct hash_pair {
     }
 };
 
+static void recordScanned(EventType::EventType eventType, size_t scanned) {
+    auto &counters = Core::getInstance().perf_counters;
+    counters.incCount(counters.event_manager_event_scanned[eventType], scanned);
+}
+
 static void run_handler(color_ostream& out, EventType::EventType eventType, const EventHandler & handle, void * arg) {
     auto &core = Core::getInstance();
     auto &counters = core.perf_counters;
+    bool histograms = counters.getHistogramsEnabled();
+    uint64_t start_us = histograms ? PerfCounters::getTimestampUs() : 0;
     uint32_t start_ms = core.p->getTickCount();
     const char * plugin_name = !handle.plugin ? "<null>" : handle.plugin->getName().c_str();
+    Trace::Span span(!handle.plugin ? "<null>" : handle.plugin->getTraceName());
     handle.eventHandler(out, arg);
     counters.incCounter(counters.event_manager_event_per_plugin_ms[eventType][plugin_name], start_ms);
+    if (histograms)
+        counters.recordLatency(counters.event_manager_event_per_plugin_us[eventType][plugin_name], start_us);
 }
 
 void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event event) {
@@ -304,8 +320,10 @@ void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event
         prevJobs.clear();
         tickQueue.clear();
         livingUnits.clear();
+        lastDeathScanTick = -1;
         buildings.clear();
         constructions.clear();
+        constructionSnapshot.clear();
         equipmentLog.clear();
         activeUnits.clear();
 
@@ -314,8 +332,8 @@ void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event
         lastReportUnitAttack = -1;
         gameLoaded = false;
 
-        multimap<Plugin*,EventHandler> copy(handlers[EventType::UNLOAD].begin(), handlers[EventType::UNLOAD].end());
-        for (auto &[_,handle] : copy) {
+        auto handles = getHandlers(EventType::UNLOAD);
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for map unloaded state change event\n");
             run_handler(out, EventType::UNLOAD, handle, nullptr);
         }
@@ -347,6 +365,7 @@ void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event
         lastJobId = -1 + *df::global::job_next_id;
 
         constructions.clear();
+        constructionSnapshot.clear();
         for (auto c : df::global::world->event.constructions) {
             if ( !c ) {
                 if ( Once::doOnce("EventManager.onLoad null constr") ) {
@@ -366,7 +385,7 @@ void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event
             buildings.insert(b->id);
         }
         lastSyndromeTime = -1;
-        for (auto unit : df::global::world->units.all) {
+        for (auto unit : df::global::world->units.active) {
             if (Units::isActive(unit)) {
                 activeUnits.emplace(unit->id);
             }
@@ -396,6 +415,25 @@ void DFHack::EventManager::onStateChange(color_ostream& out, state_change_event
     }
 }
 
+static const char *eventTraceNames[EventType::EVENT_MAX] = {
+    "EventManager/TICK",
+    "EventManager/JOB_INITIATED",
+    "EventManager/JOB_STARTED",
+    "EventManager/JOB_COMPLETED",
+    "EventManager/UNIT_NEW_ACTIVE",
+    "EventManager/UNIT_DEATH",
+    "EventManager/ITEM_CREATED",
+    "EventManager/BUILDING",
+    "EventManager/CONSTRUCTION",
+    "EventManager/SYNDROME",
+    "EventManager/INVASION",
+    "EventManager/INVENTORY_CHANGE",
+    "EventManager/REPORT",
+    "EventManager/UNIT_ATTACK",
+    "EventManager/UNLOAD",
+    "EventManager/INTERACTION",
+};
+
 void DFHack::EventManager::manageEvents(color_ostream& out) {
     static const std::array<eventManager_t, EventType::EVENT_MAX> eventManager = compileManagerArray();
     if ( !gameLoaded ) {
@@ -411,21 +449,30 @@ void DFHack::EventManager::manageEvents(color_ostream& out) {
 
     auto &core = Core::getInstance();
     auto &counters = core.perf_counters;
+    // the minimum frequency only changes when the handler snapshot does
+    static uint32_t freqEpoch[EventType::EVENT_MAX];
+    static int32_t minFrequency[EventType::EVENT_MAX];
     for ( size_t a = 0; a < EventType::EVENT_MAX; a++ ) {
         if ( handlers[a].empty() )
             continue;
-        int32_t eventFrequency = -100;
-        if ( a != EventType::TICK )
-            for (auto &[_,handle] : handlers[a]) {
-                if (handle.freq < eventFrequency || eventFrequency == -100 )
-                    eventFrequency = handle.freq;
-            }
-        else eventFrequency = 1;
+        if ( freqEpoch[a] != handlers[a].epoch() ) {
+            int32_t eventFrequency = -100;
+            if ( a != EventType::TICK )
+                for (auto &handle : *handlers[a].snapshot()) {
+                    if (handle.freq < eventFrequency || eventFrequency == -100 )
+                        eventFrequency = handle.freq;
+                }
+            else eventFrequency = 1;
+            minFrequency[a] = eventFrequency;
+            freqEpoch[a] = handlers[a].epoch();
+        }
+        int32_t eventFrequency = minFrequency[a];
 
         if ( tick >= eventLastTick[a] && tick - eventLastTick[a] < eventFrequency )
             continue;
 
         uint32_t start_ms = core.p->getTickCount();
+        Trace::Span span(eventTraceNames[a]);
         eventManager[a](out);
         eventLastTick[a] = tick;
         counters.incCounter(counters.event_manager_event_total_ms[a], start_ms);
@@ -440,7 +487,7 @@ static void manageTickEvent(color_ostream& out) {
     while ( !tickQueue.empty() ) {
         if ( tick < (*tickQueue.begin()).first )
             break;
-        EventHandler &handle = (*tickQueue.begin()).second;
+        EventHandler handle = (*tickQueue.begin()).second;
         tickQueue.erase(tickQueue.begin());
         DEBUG(log,out).print("calling handler for tick event\n");
         run_handler(out, EventType::TICK, handle, (void*)intptr_t(tick));
@@ -448,17 +495,7 @@ static void manageTickEvent(color_ostream& out) {
     }
     if ( toRemove.empty() )
         return;
-    for ( auto a = handlers[EventType::TICK].begin(); a != handlers[EventType::TICK].end(); ) {
-        EventHandler &handle = (*a).second;
-        if ( toRemove.find(handle) == toRemove.end() ) {
-            a++;
-            continue;
-        }
-        a = handlers[EventType::TICK].erase(a);
-        toRemove.erase(handle);
-        if ( toRemove.empty() )
-            break;
-    }
+    handlers[EventType::TICK].removeIf([&](const EventHandler &h){ return toRemove.count(h) != 0; });
 }
 
 static void manageJobInitiatedEvent(color_ostream& out) {
@@ -474,14 +511,14 @@ static void manageJobInitiatedEvent(color_ostream& out) {
     if ( lastJobId+1 == *df::global::job_next_id ) {
         return; //no new jobs
     }
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::JOB_INITIATED].begin(), handlers[EventType::JOB_INITIATED].end());
+    auto handles = getHandlers(EventType::JOB_INITIATED);
 
     for ( df::job_list_link* link = &df::global::world->jobs.list; link != nullptr; link = link->next ) {
         if ( link->item == nullptr )
             continue;
         if ( link->item->id <= lastJobId )
             continue;
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for job initiated event\n");
             run_handler(out, EventType::JOB_INITIATED, handle, (void*)link->item);
         }
@@ -495,7 +532,7 @@ static void manageJobStartedEvent(color_ostream& out) {
         return;
 
     // iterate event handler callbacks
-    multimap<Plugin*, EventHandler> copy(handlers[EventType::JOB_STARTED].begin(), handlers[EventType::JOB_STARTED].end());
+    auto handles = getHandlers(EventType::JOB_STARTED);
 
     std::vector<int32_t> newStartedJobs;
     newStartedJobs.reserve(startedJobs.size());
@@ -513,7 +550,7 @@ static void manageJobStartedEvent(color_ostream& out) {
              * where memory access tends to be all over the place.
              */
             if (!std::binary_search(startedJobs.begin(), startedJobs.end(), jobId)) {
-                for (auto &[_,handle] : copy) {
+                for (auto &handle : *handles) {
                     DEBUG(log,out).print("calling handler for job started event\n");
                     run_handler(out, EventType::JOB_STARTED, handle, jobPtr);
                 }
@@ -530,7 +567,7 @@ static void manageJobCompletedEvent(color_ostream& out) {
     if (!df::global::world)
         return;
 
-    multimap<Plugin*, EventHandler> copy(handlers[EventType::JOB_COMPLETED].begin(), handlers[EventType::JOB_COMPLETED].end());
+    auto handles = getHandlers(EventType::JOB_COMPLETED);
     std::vector<JobCompleteData> nowJobs;
     // predict the size in advance, this will prevent or reduce memory reallocation.
     nowJobs.reserve(prevJobs.size());
@@ -669,7 +706,7 @@ static void manageJobCompletedEvent(color_ostream& out) {
                 auto seenIt = seenJobs.find(prevJob.id);
                 if (seenIt != seenJobs.end()) {
                     df::job& seenJob = *seenIt->second;
-                    for (auto& [_, handle] : copy) {
+                    for (auto &handle : *handles) {
                         DEBUG(log, out).print("calling handler for job completed event\n");
                         run_handler(out, EventType::JOB_COMPLETED, handle, (void*)&seenJob);
                     }
@@ -685,7 +722,7 @@ static void manageJobCompletedEvent(color_ostream& out) {
                 if (seenIt != seenJobs.end()) {
                     df::job& seenJob = *seenIt->second;
                     // still false positive if cancelled at EXACTLY the right time, but experiments show this doesn't happen
-                    for (auto& [_, handle] : copy) {
+                    for (auto &handle : *handles) {
                         DEBUG(log, out).print("calling handler for repeated job completed event\n");
                         run_handler(out, EventType::JOB_COMPLETED, handle, (void*)&seenJob);
                     }
@@ -723,7 +760,7 @@ static void manageNewUnitActiveEvent(color_ostream& out) {
     if (!df::global::world)
         return;
 
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::UNIT_NEW_ACTIVE].begin(), handlers[EventType::UNIT_NEW_ACTIVE].end());
+    auto handles = getHandlers(EventType::UNIT_NEW_ACTIVE);
     unordered_set<int32_t> next_activeUnits;
     vector<int32_t> newly_active_unit_ids;
     for (df::unit* unit : df::global::world->units.active) {
@@ -734,7 +771,7 @@ static void manageNewUnitActiveEvent(color_ostream& out) {
             newly_active_unit_ids.emplace_back(unit->id);
     }
     for (int32_t unit_id : newly_active_unit_ids) {
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for new unit event\n");
             run_handler(out, EventType::UNIT_NEW_ACTIVE, handle, (void*) intptr_t(unit_id)); // intptr_t() avoids cast from smaller type warning
         }
@@ -746,24 +783,47 @@ static void manageNewUnitActiveEvent(color_ostream& out) {
 static void manageUnitDeathEvent(color_ostream& out) {
     if (!df::global::world)
         return;
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::UNIT_DEATH].begin(), handlers[EventType::UNIT_DEATH].end());
+    auto handles = getHandlers(EventType::UNIT_DEATH);
+    size_t scanned = 0;
+
+    size_t incident_count = df::incident::get_vector().size();
+    size_t active_count = df::global::world->units.active.size();
+    int32_t tick = df::global::world->frame_counter;
+    if (lastDeathScanTick >= 0 && incident_count == lastIncidentCount && active_count == lastActiveCount &&
+            tick >= lastDeathScanTick && tick - lastDeathScanTick < deathRescanTicks) {
+        recordScanned(EventType::UNIT_DEATH, 0);
+        return;
+    }
+    lastIncidentCount = incident_count;
+    lastActiveCount = active_count;
+    lastDeathScanTick = tick;
+
+    // a unit can only be alive and active while it is on the active list
+    unordered_set<int32_t> next_livingUnits;
+    for (auto unit : df::global::world->units.active) {
+        ++scanned;
+        if ( Units::isActive(unit) )
+            next_livingUnits.emplace(unit->id);
+    }
+
+    // only the units that stopped being alive and active since the last check are looked up.
+    // units that have left the map alive are dropped, and are tracked again if they come back
     vector<int32_t> dead_unit_ids;
-    for (auto unit : df::global::world->units.all) {
-        //if ( unit->counters.death_id == -1 ) {
-        if ( Units::isActive(unit) ) {
-            livingUnits.insert(unit->id);
-            continue;
-        }
-        if (!Units::isDead(unit)) continue; // for units that have left the map but aren't dead
-        //dead: if dead since last check, trigger events
-        if ( livingUnits.find(unit->id) == livingUnits.end() )
+    for (int32_t unit_id : livingUnits) {
+        if (next_livingUnits.count(unit_id))
             continue;
-        livingUnits.erase(unit->id);
-        dead_unit_ids.emplace_back(unit->id);
+        ++scanned;
+        df::unit* unit = df::unit::find(unit_id);
+        if ( unit && Units::isDead(unit) )
+            dead_unit_ids.emplace_back(unit_id);
     }
+    livingUnits = std::move(next_livingUnits);
+    recordScanned(EventType::UNIT_DEATH, scanned);
 
+    // keep the historical ascending-id firing order
+    std::sort(dead_unit_ids.begin(), dead_unit_ids.end());
     for (int32_t unit_id : dead_unit_ids) {
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for unit death event\n");
             run_handler(out, EventType::UNIT_DEATH, handle, (void*)intptr_t(unit_id));
         }
@@ -779,7 +839,7 @@ static void manageItemCreationEvent(color_ostream& out) {
         return;
     }
 
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::ITEM_CREATED].begin(), handlers[EventType::ITEM_CREATED].end());
+    auto handles = getHandlers(EventType::ITEM_CREATED);
     size_t index = df::item::binsearch_index(df::global::world->items.all, nextItem, false);
     if ( index != 0 ) index--;
 
@@ -806,7 +866,7 @@ static void manageItemCreationEvent(color_ostream& out) {
 
     // handle all created items
     for (int32_t item_id : created_items) {
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for item created event\n");
             run_handler(out, EventType::ITEM_CREATED, handle, (void*)intptr_t(item_id));
         }
@@ -824,7 +884,7 @@ static void manageBuildingEvent(color_ostream& out) {
      * TODO: could be faster
      * consider looking at jobs: building creation / destruction
      **/
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::BUILDING].begin(), handlers[EventType::BUILDING].end());
+    auto handles = getHandlers(EventType::BUILDING);
     //first alert people about new buildings
     vector<int32_t> new_buildings;
     for ( int32_t a = nextBuilding; a < *df::global::building_next_id; a++ ) {
@@ -849,7 +909,7 @@ static void manageBuildingEvent(color_ostream& out) {
             continue;
         }
 
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for destroyed building event\n");
             run_handler(out, EventType::BUILDING, handle, (void*)intptr_t(id));
         }
@@ -858,7 +918,7 @@ static void manageBuildingEvent(color_ostream& out) {
 
     //alert people about newly created buildings
     std::for_each(new_buildings.begin(), new_buildings.end(), [&](int32_t building){
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for created building event\n");
             run_handler(out, EventType::BUILDING, handle, (void*)intptr_t(building));
         }
@@ -870,7 +930,23 @@ static void manageConstructionEvent(color_ostream& out) {
         return;
     //unordered_set<df::construction*> constructionsNow(df::global::world->event.constructions.begin(), df::global::world->event.constructions.end());
 
-    multimap<Plugin*, EventHandler> copy(handlers[EventType::CONSTRUCTION].begin(), handlers[EventType::CONSTRUCTION].end());
+    auto handles = getHandlers(EventType::CONSTRUCTION);
+
+    auto &world_constructions = df::global::world->event.constructions;
+    bool unchanged = world_constructions.size() == constructionSnapshot.size();
+    for ( size_t i = 0; unchanged && i < world_constructions.size(); i++ ) {
+        auto c = world_constructions[i];
+        unchanged = constructionSnapshot[i].first == c && constructionSnapshot[i].second == c->pos;
+    }
+    if ( unchanged ) {
+        recordScanned(EventType::CONSTRUCTION, world_constructions.size());
+        return;
+    }
+    constructionSnapshot.clear();
+    constructionSnapshot.reserve(world_constructions.size());
+    for (auto c : world_constructions)
+        constructionSnapshot.emplace_back(c, c->pos);
+    recordScanned(EventType::CONSTRUCTION, 2 * world_constructions.size());
 
     unordered_set<df::construction> next_construction_set; // will be swapped with constructions
     next_construction_set.reserve(constructions.bucket_count());
@@ -895,7 +971,7 @@ static void manageConstructionEvent(color_ostream& out) {
     // now next_construction_set contains all the constructions that were removed (not found in df::global::world->event.constructions)
     for (auto& construction : next_construction_set) {
         // handle construction removed event
-        for (const auto &[_,handle]: copy) {
+        for (const auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for destroyed construction event\n");
             run_handler(out, EventType::CONSTRUCTION, handle, (void*) &construction);
         }
@@ -903,7 +979,7 @@ static void manageConstructionEvent(color_ostream& out) {
 
     // now handle all the new constructions
     for (auto& construction : new_constructions) {
-        for (const auto &[_,handle]: copy) {
+        for (const auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for created construction event\n");
             run_handler(out, EventType::CONSTRUCTION, handle, (void*) &construction);
         }
@@ -913,16 +989,15 @@ static void manageConstructionEvent(color_ostream& out) {
 static void manageSyndromeEvent(color_ostream& out) {
     if (!df::global::world)
         return;
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::SYNDROME].begin(), handlers[EventType::SYNDROME].end());
+    auto handles = getHandlers(EventType::SYNDROME);
     int32_t highestTime = -1;
 
     std::vector<SyndromeData> new_syndrome_data;
-    for (auto unit : df::global::world->units.all) {
-
-/*
-        if ( unit->flags1.bits.inactive )
-            continue;
-*/
+    size_t scanned = 0;
+    // syndromes are only acquired by units that are being simulated, so historical
+    // units in world->units.all that are not on the active list can be skipped
+    for (auto unit : df::global::world->units.active) {
+        ++scanned;
         for ( size_t b = 0; b < unit->syndromes.active.size(); b++ ) {
             df::unit_syndrome* syndrome = unit->syndromes.active[b];
             int32_t startTime = syndrome->year*ticksPerYear + syndrome->year_time;
@@ -934,8 +1009,9 @@ static void manageSyndromeEvent(color_ostream& out) {
             new_syndrome_data.emplace_back(unit->id, b);
         }
     }
+    recordScanned(EventType::SYNDROME, scanned);
     for (auto& data : new_syndrome_data) {
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for syndrome event\n");
             run_handler(out, EventType::SYNDROME, handle, (void*)&data);
         }
@@ -947,22 +1023,37 @@ static void manageSyndromeEvent(color_ostream& out) {
 static void manageInvasionEvent(color_ostream& out) {
     if (!df::global::plotinfo)
         return;
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::INVASION].begin(), handlers[EventType::INVASION].end());
+    auto handles = getHandlers(EventType::INVASION);
 
     if ( df::global::plotinfo->invasions.next_id <= nextInvasion )
         return;
     nextInvasion = df::global::plotinfo->invasions.next_id;
 
-    for (auto &[_,handle] : copy) {
+    for (auto &handle : *handles) {
         DEBUG(log,out).print("calling handler for invasion event\n");
         run_handler(out, EventType::INVASION, handle, (void*)intptr_t(nextInvasion-1));
     }
 }
 
+// cheap ordered comparison against the last seen inventory; only units that fail this
+// get the full per-item diff below
+static bool isInventoryUnchanged(const vector<InventoryItem>& logged, df::unit* unit) {
+    if ( logged.size() != unit->inventory.size() )
+        return false;
+    for ( size_t a = 0; a < logged.size(); a++ ) {
+        const df::unit_inventory_item& item0 = logged[a].item;
+        df::unit_inventory_item* item1 = unit->inventory[a];
+        if ( logged[a].itemId != item1->item->id || item0.mode != item1->mode
+                || item0.body_part_id != item1->body_part_id || item0.wound_id != item1->wound_id )
+            return false;
+    }
+    return true;
+}
+
 static void manageEquipmentEvent(color_ostream& out) {
     if (!df::global::world)
         return;
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::INVENTORY_CHANGE].begin(), handlers[EventType::INVENTORY_CHANGE].end());
+    auto handles = getHandlers(EventType::INVENTORY_CHANGE);
 
     unordered_map<int32_t, InventoryItem> itemIdToInventoryItem;
     unordered_set<int32_t> currentlyEquipped;
@@ -978,15 +1069,17 @@ static void manageEquipmentEvent(color_ostream& out) {
     // and then once we are done we delete everything.
     vector<InventoryItem*> changed_items;
 
-    for (auto unit : df::global::world->units.all) {
-        itemIdToInventoryItem.clear();
-        currentlyEquipped.clear();
-        /*if ( unit->flags1.bits.inactive )
-            continue;
-        */
-
+    size_t scanned = 0;
+    // inventories only change for units that are on the map
+    for (auto unit : df::global::world->units.active) {
+        ++scanned;
         auto oldEquipment = equipmentLog.find(unit->id);
         bool hadEquipment = oldEquipment != equipmentLog.end();
+        if ( hadEquipment && isInventoryUnchanged(oldEquipment->second, unit) )
+            continue;
+
+        itemIdToInventoryItem.clear();
+        currentlyEquipped.clear();
         vector<InventoryItem>* temp;
         if ( hadEquipment ) {
             temp = &((*oldEquipment).second);
@@ -1041,22 +1134,23 @@ static void manageEquipmentEvent(color_ostream& out) {
             equipment.push_back(item);
         }
     }
+    recordScanned(EventType::INVENTORY_CHANGE, scanned);
 
     // now handle events
     std::for_each(equipment_pickups.begin(), equipment_pickups.end(), [&](InventoryChangeData& data) {
-        for (auto &[_, handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for new item equipped inventory change event\n");
             run_handler(out, EventType::INVENTORY_CHANGE, handle, (void*) &data);
         }
     });
     std::for_each(equipment_drops.begin(), equipment_drops.end(), [&](InventoryChangeData& data) {
-        for (auto &[_, handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for dropped item inventory change event\n");
             run_handler(out, EventType::INVENTORY_CHANGE, handle, (void*) &data);
         }
     });
     std::for_each(equipment_changes.begin(), equipment_changes.end(), [&](InventoryChangeData& data) {
-        for (auto &[_, handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for inventory change event\n");
             run_handler(out, EventType::INVENTORY_CHANGE, handle, (void*) &data);
         }
@@ -1092,7 +1186,7 @@ static void updateReportToRelevantUnits() {
 static void manageReportEvent(color_ostream& out) {
     if (!df::global::world)
         return;
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::REPORT].begin(), handlers[EventType::REPORT].end());
+    auto handles = getHandlers(EventType::REPORT);
     std::vector<df::report*>& reports = df::global::world->status.reports;
     size_t idx = df::report::binsearch_index(reports, lastReport, false);
     // returns the index to the key equal to or greater than the key provided
@@ -1103,7 +1197,7 @@ static void manageReportEvent(color_ostream& out) {
 
     for ( ; idx < reports.size(); idx++ ) {
         df::report* report = reports[idx];
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for report event\n");
             run_handler(out, EventType::REPORT, handle, (void*)intptr_t(report->id));
         }
@@ -1123,7 +1217,7 @@ static df::unit_wound* getWound(df::unit* attacker, df::unit* defender) {
 static void manageUnitAttackEvent(color_ostream& out) {
     if (!df::global::world)
         return;
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::UNIT_ATTACK].begin(), handlers[EventType::UNIT_ATTACK].end());
+    auto handles = getHandlers(EventType::UNIT_ATTACK);
     std::vector<df::report*>& reports = df::global::world->status.reports;
     size_t idx = df::report::binsearch_index(reports, lastReportUnitAttack, false);
     // returns the index to the key equal to or greater than the key provided
@@ -1180,7 +1274,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             data.wound = wound1->id;
 
             already_done.emplace(unit1->id, unit2->id);
-            for (auto &[_,handle] : copy) {
+            for (auto &handle : *handles) {
                 DEBUG(log,out).print("calling handler for unit1 attack unit attack event\n");
                 run_handler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
@@ -1192,7 +1286,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             data.wound = wound2->id;
 
             already_done.emplace(unit1->id, unit2->id);
-            for (auto &[_,handle] : copy) {
+            for (auto &handle : *handles) {
                 DEBUG(log,out).print("calling handler for unit2 attack unit attack event\n");
                 run_handler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
@@ -1204,7 +1298,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             data.wound = -1;
 
             already_done.emplace(unit1->id, unit2->id);
-            for (auto &[_,handle] : copy) {
+            for (auto &handle : *handles) {
                 DEBUG(log,out).print("calling handler for unit1 killed unit attack event\n");
                 run_handler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
@@ -1216,7 +1310,7 @@ static void manageUnitAttackEvent(color_ostream& out) {
             data.wound = -1;
 
             already_done.emplace(unit1->id, unit2->id);
-            for (auto &[_,handle] : copy) {
+            for (auto &handle : *handles) {
                 DEBUG(log,out).print("calling handler for unit2 killed unit attack event\n");
                 run_handler(out, EventType::UNIT_ATTACK, handle, (void*)&data);
             }
@@ -1410,7 +1504,7 @@ static vector<df::unit*> gatherRelevantUnits(color_ostream& out, df::report* r1,
 static void manageInteractionEvent(color_ostream& out) {
     if (!df::global::world)
         return;
-    multimap<Plugin*,EventHandler> copy(handlers[EventType::INTERACTION].begin(), handlers[EventType::INTERACTION].end());
+    auto handles = getHandlers(EventType::INTERACTION);
     std::vector<df::report*>& reports = df::global::world->status.reports;
     size_t a = df::report::binsearch_index(reports, lastReportInteraction, false);
     while (a < reports.size() && reports[a]->id <= lastReportInteraction) {
@@ -1474,7 +1568,7 @@ static void manageInteractionEvent(color_ostream& out) {
         lastAttacker = df::unit::find(data.attacker);
         //lastDefender = df::unit::find(data.defender);
         //fire event
-        for (auto &[_,handle] : copy) {
+        for (auto &handle : *handles) {
             DEBUG(log,out).print("calling handler for interaction event\n");
             run_handler(out, EventType::INTERACTION, handle, (void*)&data);
         }
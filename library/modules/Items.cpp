@@ -64,6 +64,7 @@ distribution.
 #include "df/general_ref_unit_itemownerst.h"
 #include "df/historical_entity.h"
 #include "df/item.h"
+#include "df/item_actual.h"
 #include "df/item_bookst.h"
 #include "df/item_magicalst.h"
 #include "df/item_plant_growthst.h"
@@ -108,6 +109,7 @@ distribution.
 #include "df/written_content.h"
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 using std::string;
@@ -197,26 +199,11 @@ bool ItemTypeInfo::find(const string &token)
     if (items.size() == 1)
         return true;
 
-    auto &defs = world->raws.itemdefs;
-    switch (type)
-    {
-#define ITEM(type,vec,tclass) \
-    case type: \
-        for (size_t i = 0; i < defs.vec.size(); i++) { \
-            if (defs.vec[i]->id == items[1]) { \
-                subtype = i; custom = defs.vec[i]; return true; \
-            } \
-        } \
-        break;
-ITEMDEF_VECTORS
-#undef ITEM
-
-    default:
-        if (items[1] == "NONE")
-            return true;
-        break;
-    }
+    if (Items::getSubtypeCount(type) < 0)
+        return items[1] == "NONE";
 
+    subtype = Items::findSubtype(type, items[1]);
+    custom = Items::getSubtypeDef(type, subtype);
     return (subtype >= 0);
 }
 
@@ -465,6 +452,205 @@ ITEMDEF_VECTORS
         return NULL;
     }
 }
+
+static std::unordered_map<int, token_index> itemdef_index;
+
+namespace {
+    struct CensusKeyHash {
+        size_t operator()(const ItemCensusKey &k) const {
+            uint64_t h = (uint64_t(uint16_t(k.type)) << 48) | (uint64_t(uint16_t(k.subtype)) << 32) |
+                (uint64_t(uint16_t(k.mat_type)) << 16) | uint16_t(k.maker_race);
+            h = h * 0x9E3779B97F4A7C15ull ^ ((uint64_t(uint32_t(k.mat_index)) << 32) |
+                (uint64_t(uint16_t(k.quality)) << 16) | uint16_t(k.wear));
+            h = h * 0x9E3779B97F4A7C15ull ^ k.flags;
+            return size_t(h ^ (h >> 29));
+        }
+    };
+
+    uint32_t census_flag_mask() {
+        df::item_flags flags;
+        flags.whole = 0;
+        #define F(x) flags.bits.x = true;
+        F(dump); F(forbid); F(garbage_collect);
+        F(hostile); F(on_fire); F(rotten); F(trader);
+        F(in_building); F(construction); F(artifact);
+        F(in_job); F(owned); F(removed); F(melt);
+        F(in_inventory); F(encased); F(spider_web);
+        #undef F
+        return flags.whole;
+    }
+
+    /*
+     * Counts of the items in play by ItemCensusKey, swept on the first query
+     * in each frame so every tool asking in the same frame shares one pass.
+     * The records are kept sorted by item id, like items.other.IN_PLAY, so a
+     * sweep is a merge of the two: only items it hasn't seen before (the ones
+     * ITEM_CREATED would report) get the rest of their key read, the others
+     * just have their census flags, wear and stack size compared, and records
+     * with no item left are subtracted using their recorded key. Where wear
+     * and stack size are the item_actual fields, which is the case for nearly
+     * all items, they are compared without a virtual call.
+     */
+    class ItemCensus {
+        struct Record {
+            int32_t id;
+            int32_t stack;
+            ItemCensusKey key;
+            // getWear() and getStackSize() return the item_actual fields
+            bool direct;
+        };
+        typedef std::unordered_map<ItemCensusKey, ItemCensusCount, CensusKeyHash> Buckets;
+
+        vector<Record> records, next_records;
+        std::unordered_map<int, Buckets> by_type;
+        bool valid = false;
+        bool warned_unsorted = false;
+        uint32_t swept_frame = 0;
+
+        void count(const ItemCensusKey &key, int32_t stack, int sign) {
+            auto &buckets = by_type[key.type];
+            auto it = buckets.emplace(key, ItemCensusCount()).first;
+            it->second.items += sign;
+            it->second.stack += sign * stack;
+            if (it->second.items <= 0)
+                buckets.erase(it);
+        }
+
+        // returns false if IN_PLAY turns out not to be sorted by id, leaving
+        // the counts half updated
+        bool merge() {
+            auto &vec = world->items.other.IN_PLAY;
+            next_records.clear();
+            next_records.reserve(vec.size());
+
+            size_t old = 0;
+            int32_t last_id = -1;
+            for (auto item : vec) {
+                if (!records.empty() && item->id <= last_id)
+                    return false;
+                last_id = item->id;
+
+                for (; old < records.size() && records[old].id < item->id; old++)
+                    count(records[old].key, records[old].stack, -1);
+
+                uint32_t flags = item->flags.whole & flag_mask;
+                int16_t wear;
+                int32_t stack;
+
+                next_records.emplace_back();
+                Record &rec = next_records.back();
+                if (old < records.size() && records[old].id == item->id) {
+                    rec = records[old++];
+                    if (rec.direct) {
+                        auto actual = static_cast<df::item_actual *>(item);
+                        wear = actual->wear;
+                        stack = actual->stack_size;
+                    } else {
+                        wear = item->getWear();
+                        stack = item->getStackSize();
+                    }
+                    if (rec.key.flags == flags && rec.key.wear == wear && rec.stack == stack)
+                        continue;
+                    count(rec.key, rec.stack, -1);
+                } else {
+                    wear = item->getWear();
+                    stack = item->getStackSize();
+                    auto actual = virtual_cast<df::item_actual>(item);
+                    rec.direct = actual && actual->wear == wear && actual->stack_size == stack;
+                    rec.id = item->id;
+                    rec.key.type = item->getType();
+                    rec.key.subtype = item->getSubtype();
+                    rec.key.mat_type = item->getActualMaterial();
+                    rec.key.mat_index = item->getActualMaterialIndex();
+                    rec.key.maker_race = item->getMakerRace();
+                    rec.key.quality = item->getQuality();
+                }
+                rec.key.flags = flags;
+                rec.key.wear = wear;
+                rec.stack = stack;
+                count(rec.key, stack, 1);
+            }
+            for (; old < records.size(); old++)
+                count(records[old].key, records[old].stack, -1);
+
+            records.swap(next_records);
+            return true;
+        }
+
+    public:
+        const uint32_t flag_mask = census_flag_mask();
+
+        void clear() {
+            records.clear();
+            by_type.clear();
+            valid = false;
+        }
+
+        void sweep() {
+            // the game tick doesn't advance while paused, but items still
+            // change, so this goes by frames
+            uint32_t frame = Core::getInstance().getFrameCount();
+            if (valid && swept_frame == frame)
+                return;
+
+            if (!merge()) {
+                // count from scratch; with no records, merge() can't fail.
+                // This costs a full count per sweep, so it's worth knowing
+                // if some tool leaves IN_PLAY unsorted.
+                if (!warned_unsorted) {
+                    WARN(items).print("items.other.IN_PLAY is not sorted by id; "
+                        "recounting the item census from scratch\n");
+                    warned_unsorted = true;
+                }
+                clear();
+                merge();
+            }
+            valid = true;
+            swept_frame = frame;
+        }
+
+        template<typename F>
+        void forType(df::item_type itype, F fn) const {
+            auto it = by_type.find(itype);
+            if (it == by_type.end())
+                return;
+            for (auto &bucket : it->second)
+                fn(bucket.first, bucket.second);
+        }
+    };
+
+    ItemCensus item_census;
+}
+
+void items_onStateChange(color_ostream &out, state_change_event event)
+{
+    switch (event) {
+    case SC_WORLD_LOADED:
+    case SC_WORLD_UNLOADED:
+        itemdef_index.clear();
+        item_census.clear();
+        break;
+    default:
+        break;
+    }
+}
+
+int Items::findSubtype(df::item_type itype, const std::string &token)
+{   using namespace df::enums::item_type;
+    auto &defs = world->raws.itemdefs;
+
+    switch (itype)
+    {
+#define ITEM(type,vec,tclass) \
+    case type: \
+        return itemdef_index[itype].find(defs.vec, &df::itemdef::id, token);
+ITEMDEF_VECTORS
+#undef ITEM
+
+    default:
+        return -1;
+    }
+}
 #undef ITEMDEF_VECTORS
 
 df::item *Items::findItemByID(int32_t id) {
@@ -2083,3 +2269,129 @@ int32_t Items::getCapacity(df::item *item) {
     }
     return 0;
 }
+
+uint32_t Items::getCensusFlags() {
+    return item_census.flag_mask;
+}
+
+void Items::forEachCensusCount(df::item_type itype,
+    std::function<void(const ItemCensusKey &, const ItemCensusCount &)> fn)
+{
+    item_census.sweep();
+    item_census.forType(itype, fn);
+}
+
+ItemCensusCount Items::getCensusCount(df::item_type itype, int16_t subtype,
+    int16_t mat_type, int32_t mat_index, uint32_t exclude_flags, int max_wear)
+{
+    ItemCensusCount total;
+    item_census.sweep();
+    item_census.forType(itype, [&](const ItemCensusKey &key, const ItemCensusCount &count) {
+        if ((subtype != -1 && key.subtype != subtype) ||
+            (mat_type != -1 && key.mat_type != mat_type) ||
+            (mat_index != -1 && key.mat_index != mat_index) ||
+            (key.flags & exclude_flags) || key.wear > max_wear)
+            return;
+        total.items += count.items;
+        total.stack += count.stack;
+    });
+    return total;
+}
+
+uint64_t Items::NearestItemIndex::cellKey(int bx, int by, int z) {
+    return (uint64_t(uint16_t(z)) << 32) | (uint64_t(uint16_t(bx)) << 16) | uint16_t(by);
+}
+
+int Items::NearestItemIndex::distance(df::coord a, df::coord b) {
+    return std::max(abs(a.x - b.x), abs(a.y - b.y)) + abs(a.z - b.z);
+}
+
+void Items::NearestItemIndex::clear() {
+    entries.clear();
+    by_item.clear();
+    cells.clear();
+    bx_min = by_min = z_min = 0;
+    bx_max = by_max = z_max = -1;
+}
+
+void Items::NearestItemIndex::add(df::item *item) {
+    CHECK_NULL_POINTER(item);
+    add(item, Items::getPosition(item));
+}
+
+void Items::NearestItemIndex::add(df::item *item, df::coord pos) {
+    CHECK_NULL_POINTER(item);
+    if (!pos.isValid() || !by_item.emplace(item, entries.size()).second)
+        return;
+
+    int bx = pos.x >> 4, by = pos.y >> 4;
+    if (entries.empty()) {
+        bx_min = bx_max = bx;
+        by_min = by_max = by;
+        z_min = z_max = pos.z;
+    } else {
+        bx_min = std::min(bx_min, bx); bx_max = std::max(bx_max, bx);
+        by_min = std::min(by_min, by); by_max = std::max(by_max, by);
+        z_min = std::min(z_min, int(pos.z)); z_max = std::max(z_max, int(pos.z));
+    }
+
+    auto &cell = cells[cellKey(bx, by, pos.z)];
+    cell.entries.push_back(entries.size());
+    cell.alive++;
+    entries.push_back({pos, item});
+}
+
+bool Items::NearestItemIndex::remove(df::item *item) {
+    auto it = by_item.find(item);
+    if (it == by_item.end())
+        return false;
+    auto &entry = entries[it->second];
+    cells[cellKey(entry.pos.x >> 4, entry.pos.y >> 4, entry.pos.z)].alive--;
+    entry.item = NULL;
+    by_item.erase(it);
+    return true;
+}
+
+df::item *Items::NearestItemIndex::findNearest(df::coord pos, int *distance) const {
+    if (by_item.empty())
+        return NULL;
+
+    // the farthest any indexed item can be from pos
+    int x_far = std::max(abs(pos.x - bx_min * 16), abs(pos.x - (bx_max * 16 + 15)));
+    int y_far = std::max(abs(pos.y - by_min * 16), abs(pos.y - (by_max * 16 + 15)));
+    int z_far = std::max(abs(pos.z - z_min), abs(pos.z - z_max));
+    int max_dist = std::max(x_far, y_far) + z_far;
+
+    int best_dist = INT_MAX;
+    size_t best = 0;
+
+    // Look at every block that could hold an item within search_dist, and
+    // widen the search until the best item found is within it. Anything in
+    // a block that wasn't looked at is farther away than search_dist.
+    for (int search_dist = 16; ; search_dist *= 2) {
+        for (int z = std::max(z_min, pos.z - search_dist); z <= std::min(z_max, pos.z + search_dist); z++) {
+            int reach = search_dist - abs(z - pos.z);
+            for (int by = std::max(by_min, (pos.y - reach) >> 4); by <= std::min(by_max, (pos.y + reach) >> 4); by++) {
+                for (int bx = std::max(bx_min, (pos.x - reach) >> 4); bx <= std::min(bx_max, (pos.x + reach) >> 4); bx++) {
+                    auto it = cells.find(cellKey(bx, by, z));
+                    if (it == cells.end() || !it->second.alive)
+                        continue;
+                    for (size_t idx : it->second.entries) {
+                        auto &entry = entries[idx];
+                        if (!entry.item)
+                            continue;
+                        int dist = NearestItemIndex::distance(pos, entry.pos);
+                        if (dist < best_dist || (dist == best_dist && idx < best))
+                            best_dist = dist, best = idx;
+                    }
+                }
+            }
+        }
+        if (best_dist <= search_dist || search_dist >= max_dist)
+            break;
+    }
+
+    if (distance)
+        *distance = best_dist;
+    return entries[best].item;
+}
@@ -31,6 +31,7 @@ distribution.
 #include "MemAccess.h"
 #include "MiscUtils.h"
 #include "ModuleFactory.h"
+#include "Trace.h"
 #include "VersionInfo.h"
 
 #include "modules/Buildings.h"
@@ -71,7 +72,13 @@ distribution.
 #include "df/world_underground_region.h"
 #include "df/z_level_flags.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 #include <map>
 #include <set>
@@ -109,6 +116,7 @@ MapExtras::Block::Block(MapCache *parent, DFCoord _bcoord) :
     dirty_temperatures = false;
     dirty_occupancies = false;
     valid = false;
+    referenced = false;
     bcoord = _bcoord;
     block = Maps::getBlock(bcoord);
     tags = NULL;
@@ -1237,6 +1245,10 @@ bool MapExtras::Block::removeItemOnGround(df::item *item)
 MapExtras::MapCache::MapCache()
 {
     valid = 0;
+    num_loaded = 0;
+    block_limit = 0;
+    clock_hand = 0;
+    last_block = NULL;
     Maps::getSize(x_bmax, y_bmax, z_max);
     x_tmax = x_bmax*16; y_tmax = y_bmax*16;
     std::vector<df::coord2d> geoidx;
@@ -1312,11 +1324,10 @@ bool MapExtras::MapCache::WriteAll()
         df::job* job = job_link->item;
         df::coord pos = job->pos;
         df::coord blockpos(pos.x>>4,pos.y>>4,pos.z);
-        auto iter = blocks.find(blockpos);
-        if (iter == blocks.end())
+        auto block = lookupBlock(blockpos);
+        if (!block)
             continue;
         df::coord2d bpos(pos.x - (blockpos.x<<4),pos.y - (blockpos.y<<4));
-        auto block = iter->second;
         if (!block->designated_tiles.test(bpos.x+bpos.y*16))
             continue;
         bool is_designed = ENUM_ATTR(job_type,is_designation,job->job_type);
@@ -1326,48 +1337,169 @@ bool MapExtras::MapCache::WriteAll()
         // processing.
         Job::removeJob(job);
     }
-    std::map<DFCoord, Block *>::iterator p;
-    for(p = blocks.begin(); p != blocks.end(); p++)
+    for (Block *b : block_table)
     {
-        p->second->Write();
+        if (b)
+            b->Write();
     }
     return true;
 }
 
-MapExtras::Block *MapExtras::MapCache::BlockAt(DFCoord blockcoord)
+MapExtras::Block *MapExtras::MapCache::BlockAtSlow(DFCoord blockcoord)
 {
     if(!valid)
         return 0;
-    std::map <DFCoord, Block*>::iterator iter = blocks.find(blockcoord);
-    if(iter != blocks.end())
+    if(unsigned(blockcoord.x) >= x_bmax ||
+       unsigned(blockcoord.y) >= y_bmax ||
+       unsigned(blockcoord.z) >= z_max)
+        return 0;
+
+    if (block_table.empty())
+        block_table.resize(size_t(x_bmax) * y_bmax * z_max, NULL);
+
+    Block *&slot = block_table[blockIndex(blockcoord)];
+    if (!slot)
     {
-        return (*iter).second;
+        if (block_limit && num_loaded >= block_limit)
+            evictBlocks();
+        slot = new Block(this, blockcoord);
+        num_loaded++;
     }
-    else
+    slot->referenced = true;
+    last_bcoord = blockcoord;
+    last_block = slot;
+    return slot;
+}
+
+// Second-chance (clock) approximation of LRU over the block table. Blocks
+// with pending writes, tags, item counts, or designated tiles are never evicted.
+void MapExtras::MapCache::evictBlocks()
+{
+    size_t target = block_limit - block_limit / 8;
+    size_t table_size = block_table.size();
+    // two full sweeps are enough to clear every reference bit once
+    for (size_t steps = 0; num_loaded > target && steps < 2 * table_size; steps++)
     {
-        if(unsigned(blockcoord.x) < x_bmax &&
-           unsigned(blockcoord.y) < y_bmax &&
-           unsigned(blockcoord.z) < z_max)
+        clock_hand = (clock_hand + 1) % table_size;
+        Block *b = block_table[clock_hand];
+        if (!b || b == last_block)
+            continue;
+        if (b->referenced)
         {
-            Block * nblo = new Block(this, blockcoord);
-            blocks[blockcoord] = nblo;
-            return nblo;
+            b->referenced = false;
+            continue;
         }
-        return 0;
+        if (b->isDirty() || b->tags || b->item_counts || b->designated_tiles.any())
+            continue;
+        block_table[clock_hand] = NULL;
+        num_loaded--;
+        delete b;
     }
 }
 
 void MapExtras::MapCache::discardBlock(Block *block)
 {
-    blocks.erase(block->bcoord);
+    Block *&slot = block_table[blockIndex(block->bcoord)];
+    if (slot == block)
+    {
+        slot = NULL;
+        num_loaded--;
+    }
+    if (last_block == block)
+        last_block = NULL;
     delete block;
 }
 
 void MapExtras::MapCache::resetTags()
 {
-    for (auto it = blocks.begin(); it != blocks.end(); ++it)
+    for (Block *b : block_table)
     {
-        delete[] it->second->tags;
-        it->second->tags = NULL;
+        if (!b)
+            continue;
+        delete[] b->tags;
+        b->tags = NULL;
+    }
+}
+
+size_t MapExtras::getScanWorkerCount(size_t max_workers)
+{
+    // more workers than this just contend on memory bandwidth
+    static const size_t MAX_SCAN_WORKERS = 16;
+
+    size_t count = std::thread::hardware_concurrency();
+    if (count == 0)
+        count = 1;
+    if (count > MAX_SCAN_WORKERS)
+        count = MAX_SCAN_WORKERS;
+    if (max_workers && count > max_workers)
+        count = max_workers;
+    return count;
+}
+
+size_t MapExtras::parallelBlockScan(const BlockScanFn &fn, size_t max_workers)
+{
+    DFHACK_TRACE_SPAN("MapCache/parallelBlockScan");
+
+    uint32_t x_max = 0, y_max = 0, z_max = 0;
+    Maps::getSize(x_max, y_max, z_max);
+    size_t num_rows = size_t(y_max) * z_max;
+    if (!num_rows)
+        return 0;
+
+    size_t num_workers = std::min(getScanWorkerCount(max_workers), num_rows);
+
+    std::atomic<size_t> next_row(0);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    auto worker = [&](size_t id) {
+        try
+        {
+            MapCache map;
+            for (size_t row = next_row++; row < num_rows; row = next_row++)
+            {
+                int16_t z = row / y_max;
+                int16_t y = row % y_max;
+                for (uint32_t x = 0; x < x_max; x++)
+                {
+                    Block *b = map.BlockAt(DFCoord(x, y, z));
+                    if (b && b->is_valid())
+                        fn(id, b);
+                }
+                // rows are independent, so keep the cache from growing
+                map.trash();
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+            // stop handing out work
+            next_row = num_rows;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_workers - 1);
+    for (size_t i = 1; i < num_workers; i++)
+    {
+        try
+        {
+            threads.emplace_back(worker, i);
+        }
+        catch (std::system_error &)
+        {
+            // out of threads; the ones we have will pick up the slack
+            break;
+        }
     }
+    worker(0);
+    for (auto &thread : threads)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+    // worker ids are contiguous from 0, even if we ran out of threads
+    return threads.size() + 1;
 }
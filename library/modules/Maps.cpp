@@ -205,21 +205,9 @@ void cuboid::forCoord(std::function<bool(df::coord)> fn, bool row_major) const
 
 void cuboid::forBlock(std::function<bool(df::map_block *, cuboid)> fn, bool ensure_block) const
 {
-    auto c = *this; // Create a copy to modify.
-    if (!c.clampMap().isValid()) // No intersection.
-        return;
-
-    // Process z, y, then x.
-    for (int16_t x = (c.x_min >> 4) << 4; x <= c.x_max; x += 16)
-        for (int16_t y = (c.y_min >> 4) << 4; y <= c.y_max; y += 16)
-            for (int16_t z = c.z_max; z >= c.z_min; z--)
-            {
-                auto *block = ensure_block ? Maps::ensureTileBlock(x, y, z) : Maps::getTileBlock(x, y, z);
-                if (!block) // Skip unallocated block.
-                    continue;
-                else if (!fn(block, cuboid(block).clamp(c)))
-                    return; // Break iterator.
-            }
+    forBlockSpan([&](const block_span &span) {
+        return fn(span.block, cuboid(span.getPos(span.x_min, span.y_min), span.getPos(span.x_max, span.y_max)));
+    }, ensure_block);
 }
 
 /*
@@ -1176,38 +1164,6 @@ bool Maps::setTileAquifer(int32_t x, int32_t y, int32_t z, bool heavy) {
     return true;
 }
 
-int Maps::setAreaAquifer(df::coord pos1, df::coord pos2, bool heavy, std::function<bool(df::coord, df::map_block *)> filter) {
-    int totalAffectedCount = 0;
-    cuboid bounds(pos1, pos2);
-
-    // Loop through the affected blocks
-    bounds.forBlock([&](df::map_block *block, cuboid intersect) {
-        int blockAffectedCount = 0;
-        // Loop through the affected tiles in the block
-        intersect.forCoord([&](df::coord pos) {
-            if (filter(pos, block)) {
-                blockAffectedCount++;
-                block->designation[pos.x&15][pos.y&15].bits.water_table = true;
-                block->occupancy[pos.x&15][pos.y&15].bits.heavy_aquifer = heavy;
-            }
-            return true; // Keep iterating tiles
-        });
-
-        // If any tile was set to be an aquifer, update the block
-        if (blockAffectedCount > 0) {
-            block->flags.bits.has_aquifer = true;
-            block->flags.bits.check_aquifer = true;
-            block->flags.bits.update_liquid = true;
-            block->flags.bits.update_liquid_twice = true;
-            totalAffectedCount += blockAffectedCount;
-        }
-
-        return true; // Keep iterating blocks
-    });
-
-    return totalAffectedCount;
-}
-
 bool Maps::removeTileAquifer(int32_t x, int32_t y, int32_t z) {
     df::map_block *block = Maps::getTileBlock(x, y, z);
     if (!block)
@@ -1235,42 +1191,3 @@ bool Maps::removeTileAquifer(int32_t x, int32_t y, int32_t z) {
     }
     return true;
 }
-
-int Maps::removeAreaAquifer(df::coord pos1, df::coord pos2, std::function<bool(df::coord, df::map_block *)> filter) {
-    int totalAffectedCount = 0;
-    cuboid bounds(pos1, pos2);
-
-    // Loop through the affected blocks
-    bounds.forBlock([&](df::map_block *block, cuboid intersect) {
-        int blockAffectedCount = 0;
-        int aquiferCount = 0;
-        cuboid block_bounds(block);
-
-        // Loop through all tiles in the block
-        block_bounds.forCoord([&](df::coord pos) {
-            auto &des = block->designation[pos.x&15][pos.y&15];
-            if (des.bits.water_table) {
-                if (intersect.containsPos(pos) && filter(pos, block)) {
-                    blockAffectedCount++;
-                    des.bits.water_table = false;
-                    block->occupancy[pos.x&15][pos.y&15].bits.heavy_aquifer = false;
-                }
-                else
-                    aquiferCount++;
-            }
-
-            return true; // Keep iterating tiles
-        });
-
-        // If none of the block's tiles are now aquifers, update the block
-        if (aquiferCount == 0) {
-            block->flags.bits.has_aquifer = false;
-            block->flags.bits.check_aquifer = false;
-        }
-        totalAffectedCount += blockAffectedCount;
-
-        return true; // Keep iterating blocks
-    });
-
-    return totalAffectedCount;
-}
@@ -58,6 +58,7 @@ distribution.
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <cstring>
 
 using std::string;
@@ -216,13 +217,9 @@ bool MaterialInfo::findBuiltin(const std::string &token)
         return true;
     }
 
-    auto &raws = world->raws;
-    for (int i = 0; i < NUM_BUILTIN; i++)
-    {
-        auto obj = raws.mat_table.builtin[i];
-        if (obj && obj->id == token)
-            return decode(i, -1);
-    }
+    int i = findBuiltinIndex(token);
+    if (i >= 0)
+        return decode(i, -1);
     return decode(-1);
 }
 
@@ -236,13 +233,9 @@ bool MaterialInfo::findInorganic(const std::string &token)
         return true;
     }
 
-    auto &raws = world->raws;
-    for (size_t i = 0; i < raws.inorganics.all.size(); i++)
-    {
-        df::inorganic_raw *p = raws.inorganics.all[i];
-        if (p->id == token)
-            return decode(0, i);
-    }
+    int i = findInorganicIndex(token);
+    if (i >= 0)
+        return decode(0, i);
     return decode(-1);
 }
 
@@ -250,23 +243,20 @@ bool MaterialInfo::findPlant(const std::string &token, const std::string &subtok
 {
     if (token.empty())
         return decode(-1);
-    auto &raws = world->raws;
-    for (size_t i = 0; i < raws.plants.all.size(); i++)
-    {
-        df::plant_raw *p = raws.plants.all[i];
-        if (p->id != token)
-            continue;
-
-        // As a special exception, return the structural material with empty subtoken
-        if (subtoken.empty())
-            return decode(p->material_defs.type[plant_material_def::basic_mat], p->material_defs.idx[plant_material_def::basic_mat]);
-
-        for (size_t j = 0; j < p->material.size(); j++)
-            if (p->material[j]->id == subtoken)
-                return decode(PLANT_BASE+j, i);
+    int i = findPlantIndex(token);
+    if (i < 0)
+        return decode(-1);
 
-        break;
+    // As a special exception, return the structural material with empty subtoken
+    if (subtoken.empty())
+    {
+        df::plant_raw *p = world->raws.plants.all[i];
+        return decode(p->material_defs.type[plant_material_def::basic_mat], p->material_defs.idx[plant_material_def::basic_mat]);
     }
+
+    int j = findPlantMaterialIndex(i, subtoken);
+    if (j >= 0)
+        return decode(PLANT_BASE+j, i);
     return decode(-1);
 }
 
@@ -274,19 +264,10 @@ bool MaterialInfo::findCreature(const std::string &token, const std::string &sub
 {
     if (token.empty() || subtoken.empty())
         return decode(-1);
-    auto &raws = world->raws;
-    for (size_t i = 0; i < raws.creatures.all.size(); i++)
-    {
-        df::creature_raw *p = raws.creatures.all[i];
-        if (p->creature_id != token)
-            continue;
-
-        for (size_t j = 0; j < p->material.size(); j++)
-            if (p->material[j]->id == subtoken)
-                return decode(CREATURE_BASE+j, i);
-
-        break;
-    }
+    int i = findCreatureIndex(token);
+    int j = findCreatureMaterialIndex(i, subtoken);
+    if (j >= 0)
+        return decode(CREATURE_BASE+j, i);
     return decode(-1);
 }
 
@@ -600,6 +581,75 @@ bool DFHack::isStoneInorganic(int material)
     return true;
 }
 
+namespace {
+    token_index builtin_index, inorganic_index, plant_index, creature_index;
+    // per-raw material and caste tables, keyed by the address of the vector
+    std::unordered_map<const void *, token_index> subtoken_index;
+
+    template <typename CT, typename MT>
+    int find_subtoken(const std::vector<CT*> &vec, std::string MT::*field, const std::string &token)
+    {
+        return subtoken_index[&vec].find(vec, field, token);
+    }
+}
+
+void materials_onStateChange(color_ostream &out, state_change_event event)
+{
+    switch (event) {
+    case SC_WORLD_LOADED:
+    case SC_WORLD_UNLOADED:
+        builtin_index.clear();
+        inorganic_index.clear();
+        plant_index.clear();
+        creature_index.clear();
+        subtoken_index.clear();
+        break;
+    default:
+        break;
+    }
+}
+
+int DFHack::findBuiltinIndex(const std::string &token)
+{
+    auto &builtin = world->raws.mat_table.builtin;
+    return builtin_index.find(&builtin[0], MaterialInfo::NUM_BUILTIN, [&](size_t i) -> const std::string * {
+        return builtin[i] ? &builtin[i]->id : nullptr;
+    }, token);
+}
+
+int DFHack::findInorganicIndex(const std::string &token)
+{
+    return inorganic_index.find(world->raws.inorganics.all, &df::inorganic_raw::id, token);
+}
+
+int DFHack::findPlantIndex(const std::string &token)
+{
+    return plant_index.find(world->raws.plants.all, &df::plant_raw::id, token);
+}
+
+int DFHack::findCreatureIndex(const std::string &token)
+{
+    return creature_index.find(world->raws.creatures.all, &df::creature_raw::creature_id, token);
+}
+
+int DFHack::findCasteIndex(int creature, const std::string &token)
+{
+    auto raw = vector_get(world->raws.creatures.all, creature);
+    return raw ? find_subtoken(raw->caste, &df::caste_raw::caste_id, token) : -1;
+}
+
+int DFHack::findPlantMaterialIndex(int plant, const std::string &token)
+{
+    auto raw = vector_get(world->raws.plants.all, plant);
+    return raw ? find_subtoken(raw->material, &df::material::id, token) : -1;
+}
+
+int DFHack::findCreatureMaterialIndex(int creature, const std::string &token)
+{
+    auto raw = vector_get(world->raws.creatures.all, creature);
+    return raw ? find_subtoken(raw->material, &df::material::id, token) : -1;
+}
+
 std::unique_ptr<Module> DFHack::createMaterials()
 {
     return std::make_unique<Materials>();
@@ -28,6 +28,7 @@ distribution.
 #include "Internal.h"
 #include "LuaTools.h"
 #include "MemAccess.h"
+#include "Trace.h"
 
 #include "modules/DFSDL.h"
 #include "modules/Filesystem.h"
@@ -40,32 +41,112 @@ distribution.
 
 #include <json/json.h>
 
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace DFHack {
     DBG_DECLARE(core, persistence, DebugCategory::LINFO);
 }
 
 using namespace DFHack;
 
-static std::unordered_map<int, std::multimap<std::string, std::shared_ptr<Persistence::DataEntry>>> store;
-static std::unordered_map<size_t, std::shared_ptr<Persistence::DataEntry>> entry_cache;
 
 static uint32_t lastLoadSaveTickCount = 0;
 
-size_t next_entry_id = 0;   // goes more positive
 int next_fake_df_id = -101; // goes more negative
 
+using Persistence::SavedEntry;
+
+static Json::Value toJSON(const SavedEntry &entry) {
+    Json::Value json(Json::objectValue);
+    json["k"] = entry.key;
+    if (entry.fake_df_id < 0)
+        json["f"] = entry.fake_df_id;
+    if (entry.str_value.size())
+        json["s"] = entry.str_value;
+    size_t num_set_ints = 0;
+    for (size_t i = 0; i < PersistentDataItem::NumInts; i++) {
+        if (entry.int_values.at(i) != -1)
+            num_set_ints = i + 1;
+    }
+    if (num_set_ints) {
+        Json::Value ints(Json::arrayValue);
+        for (size_t i = 0; i < num_set_ints; i++)
+            ints.append(entry.int_values.at(i));
+        json["i"] = std::move(ints);
+    }
+    return json;
+}
+
+namespace {
+    /*
+     * Binary format for the entity store files. After the magic and version
+     * byte, every number is a varint (zigzag encoded if signed) and every
+     * string is a length followed by its bytes:
+     *
+     *   key count, keys
+     *   entry count, then for each entry:
+     *     key index, fake_df_id, str_value, int count, ints
+     *
+     * Keys are stored once and referenced by index, since most stores use
+     * the same few keys for many entries. Trailing ints that are -1 are
+     * omitted. Files without the magic are read as JSON.
+     */
+    const char BINARY_MAGIC[] = "DFHP";
+    const size_t BINARY_MAGIC_LEN = 4;
+    const uint8_t BINARY_VERSION = 1;
+
+    // read from the config file on first use
+    Persistence::SaveFormat save_format = Persistence::SaveFormat::JSON;
+    std::once_flag save_format_read;
+
+    // everything the save thread needs, gathered with the core suspended
+    struct SaveJob {
+        Persistence::SaveFormat format;
+        // files that are rewritten on every save
+        std::vector<std::pair<std::filesystem::path, std::string>> files;
+        // entity stores that changed since the last save
+        std::map<int, std::vector<SavedEntry>> changed;
+    };
+
+    std::thread save_thread;
+
+    // written by the save thread while it runs, read by finishSave
+    std::vector<std::string> failed_writes;
+    std::vector<int> failed_stores;
+}
+
 struct Persistence::DataEntry {
-    const size_t entry_id;
     const int entity_id;
     const std::string key;
     int fake_df_id;
     std::string str_value;
     std::array<int, PersistentDataItem::NumInts> int_values;
 
+    // cleared (with the core suspended) when the entry is removed from the
+    // store. Handles keep the entry itself alive, so checking validity needs
+    // neither the core lock nor a lookup.
+    std::atomic<bool> live{true};
+
+    // the changed flag of the store holding the entry; only used while live
+    bool *store_changed = nullptr;
+
     explicit DataEntry(int entity_id, const std::string &key)
-    : entry_id(next_entry_id++), entity_id(entity_id), key(key) {
+    : entity_id(entity_id), key(key) {
         fake_df_id = 0;
         for (size_t i = 0; i < PersistentDataItem::NumInts; i++)
             int_values.at(i) = -1;
@@ -82,32 +163,87 @@ struct Persistence::DataEntry {
         }
     }
 
-    Json::Value toJSON() const {
-        Json::Value json(Json::objectValue);
-        json["k"] = key;
-        if (fake_df_id < 0)
-            json["f"] = fake_df_id;
-        if (str_value.size())
-            json["s"] = str_value;
-        size_t num_set_ints = 0;
-        for (size_t i = 0; i < PersistentDataItem::NumInts; i++) {
-            if (int_values.at(i) != -1)
-                num_set_ints = i + 1;
-        }
-        if (num_set_ints) {
-            Json::Value ints(Json::arrayValue);
-            for (size_t i = 0; i < num_set_ints; i++)
-                ints.append(int_values.at(i));
-            json["i"] = std::move(ints);
-        }
-        return json;
+    SavedEntry save() const {
+        return SavedEntry{key, fake_df_id, str_value, int_values};
+    }
+
+    // called by the accessors that can modify the entry; a conservative
+    // guess, since they can't tell a read through a reference from a write
+    void touch() {
+        if (store_changed)
+            *store_changed = true;
     }
 
     bool isReferencedBy(const PersistentDataItem & item) {
         return item.data.get() == this;
     }
+
+    bool isLive() const {
+        return live.load(std::memory_order_acquire);
+    }
+
+    void kill() {
+        live.store(false, std::memory_order_release);
+    }
+};
+
+typedef std::multimap<std::string, std::shared_ptr<Persistence::DataEntry>> EntryMap;
+
+// The items of one entity, ordered by key for range queries, plus a hash
+// index from each key to its first item for exact lookups. The index refers
+// to the keys in the map nodes, so each distinct key is stored only once.
+struct EntityStore {
+    EntryMap entries;
+    std::unordered_map<std::string_view, EntryMap::iterator> first_by_key;
+    // set when items are added, removed or possibly modified, so saving can
+    // skip stores that haven't changed since they were last written. The
+    // entries point at it, so the store must stay where it is.
+    bool changed = true;
+
+    EntityStore() = default;
+    EntityStore(const EntityStore &) = delete;
+    EntityStore &operator=(const EntityStore &) = delete;
+
+    void add(const std::shared_ptr<Persistence::DataEntry> &entry) {
+        // new items go after existing ones with the same key, so an
+        // existing index entry stays correct
+        auto it = entries.emplace(entry->key, entry);
+        first_by_key.emplace(it->first, it);
+        entry->store_changed = &changed;
+        changed = true;
+    }
+
+    void erase(EntryMap::iterator it) {
+        auto idx = first_by_key.find(it->first);
+        if (idx != first_by_key.end() && idx->second == it) {
+            first_by_key.erase(idx);
+            auto next = std::next(it);
+            if (next != entries.end() && next->first == it->first)
+                first_by_key.emplace(next->first, next);
+        }
+        entries.erase(it);
+        changed = true;
+    }
+
+    EntryMap::iterator find(const std::string &key) {
+        auto idx = first_by_key.find(key);
+        return idx == first_by_key.end() ? entries.end() : idx->second;
+    }
+
+    std::pair<EntryMap::iterator, EntryMap::iterator> equal_range(const std::string &key) {
+        auto begin = find(key), end = begin;
+        while (end != entries.end() && end->first == key)
+            ++end;
+        return std::make_pair(begin, end);
+    }
 };
 
+static std::unordered_map<int, EntityStore> store;
+
+// bumped whenever items are added or removed, to detect changes made while
+// iterating
+static uint64_t store_version = 0;
+
 int PersistentDataItem::entity_id() const {
     CHECK_INVALID_ARGUMENT(isValid());
     return data->entity_id;
@@ -122,6 +258,7 @@ const std::string &PersistentDataItem::key() const
 std::string &PersistentDataItem::val()
 {
     CHECK_INVALID_ARGUMENT(isValid());
+    data->touch();
     return data->str_value;
 }
 const std::string &PersistentDataItem::val() const
@@ -133,28 +270,24 @@ int &PersistentDataItem::ival(int i)
 {
     CHECK_INVALID_ARGUMENT(isValid());
     CHECK_INVALID_ARGUMENT(i >= 0 && i < (int)NumInts);
-    return data->int_values.at(i);
+    data->touch();
+    return data->int_values[i];
 }
 int PersistentDataItem::ival(int i) const
 {
     CHECK_INVALID_ARGUMENT(isValid());
     CHECK_INVALID_ARGUMENT(i >= 0 && i < (int)NumInts);
-    return data->int_values.at(i);
+    return data->int_values[i];
 }
 
 const std::string & PersistentDataItem::get_str() {
     static const std::string empty;
-    return isValid() ? val() : empty;
+    return isValid() ? data->str_value : empty;
 }
 
 bool PersistentDataItem::isValid() const
 {
-    if (data == nullptr)
-        return false;
-
-    CoreSuspender suspend;
-
-    return entry_cache.contains(data->entry_id) && entry_cache.at(data->entry_id) == data;
+    return data != nullptr && data->isLive();
 }
 
 int PersistentDataItem::fake_df_id() {
@@ -162,8 +295,10 @@ int PersistentDataItem::fake_df_id() {
         return 0;
 
     // set it if unset
-    if (data->fake_df_id == 0)
+    if (data->fake_df_id == 0) {
         data->fake_df_id = next_fake_df_id--;
+        data->touch();
+    }
 
     return data->fake_df_id;
 }
@@ -171,9 +306,16 @@ int PersistentDataItem::fake_df_id() {
 void Persistence::Internal::clear(color_ostream& out) {
     CoreSuspender suspend;
 
+    finishSave(out);
+
+    for (auto & entity_store_entry : store) {
+        for (auto & entries : entity_store_entry.second.entries) {
+            if (entries.second)
+                entries.second->kill();
+        }
+    }
     store.clear();
-    entry_cache.clear();
-    next_entry_id = 0;
+    store_version++;
     next_fake_df_id = -101;
 }
 
@@ -199,6 +341,125 @@ struct LastLoadSaveTickCountUpdater {
     }
 };
 
+static std::string getEntityFileName(int entity_id) {
+    return (entity_id == Persistence::WORLD_ENTITY_ID) ?
+        "world" : "entity-" + int_to_string(entity_id);
+}
+
+// Writes to a temporary file and renames it into place, so a crash leaves
+// either the old file or the complete new one.
+static bool writeFileAtomically(const std::filesystem::path &path, const std::string &contents) {
+    std::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+
+    FILE *f = fopen(tmp_path.string().c_str(), "wb");
+    if (!f)
+        return false;
+
+    bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size() && fflush(f) == 0;
+#ifdef WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    ok = (fclose(f) == 0) && ok;
+
+    std::error_code ec;
+    if (ok) {
+        std::filesystem::rename(tmp_path, path, ec);
+        ok = !ec;
+    }
+    if (!ok)
+        std::filesystem::remove(tmp_path, ec);
+    return ok;
+}
+
+static size_t countSetInts(const SavedEntry &entry) {
+    size_t num_set_ints = 0;
+    for (size_t i = 0; i < PersistentDataItem::NumInts; i++) {
+        if (entry.int_values[i] != -1)
+            num_set_ints = i + 1;
+    }
+    return num_set_ints;
+}
+
+static void putVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+static void putSigned(std::string &out, int32_t value) {
+    putVarint(out, (uint32_t(value) << 1) ^ uint32_t(value >> 31));
+}
+
+static void putString(std::string &out, const std::string &str) {
+    putVarint(out, str.size());
+    out += str;
+}
+
+static std::string encodeBinary(const std::vector<SavedEntry> &entries) {
+    std::unordered_map<std::string, uint32_t> key_ids;
+    std::vector<const std::string *> keys;
+    for (auto & entry : entries) {
+        if (key_ids.emplace(entry.key, keys.size()).second)
+            keys.push_back(&entry.key);
+    }
+
+    std::string out(BINARY_MAGIC, BINARY_MAGIC_LEN);
+    putVarint(out, BINARY_VERSION);
+
+    putVarint(out, keys.size());
+    for (auto key : keys)
+        putString(out, *key);
+
+    putVarint(out, entries.size());
+    for (auto & entry : entries) {
+        putVarint(out, key_ids[entry.key]);
+        putSigned(out, entry.fake_df_id);
+        putString(out, entry.str_value);
+        size_t num_set_ints = countSetInts(entry);
+        putVarint(out, num_set_ints);
+        for (size_t i = 0; i < num_set_ints; i++)
+            putSigned(out, entry.int_values[i]);
+    }
+    return out;
+}
+
+static std::string encodeJSON(const std::vector<SavedEntry> &entries) {
+    Json::Value json(Json::arrayValue);
+    for (auto & entry : entries)
+        json.append(toJSON(entry));
+    std::ostringstream ss;
+    ss << json;
+    return ss.str();
+}
+
+static std::string encodeEntries(const std::vector<SavedEntry> &entries, Persistence::SaveFormat format) {
+    if (format == Persistence::SaveFormat::JSON)
+        return encodeJSON(entries);
+    return encodeBinary(entries);
+}
+
+static void writeSave(SaveJob job) {
+    DFHACK_TRACE_SPAN("persistence/write");
+
+    for (auto & file : job.files) {
+        if (!writeFileAtomically(file.first, file.second))
+            failed_writes.push_back(file.first.string());
+    }
+
+    for (auto & changed : job.changed) {
+        auto path = getSaveFilePath("current", getEntityFileName(changed.first));
+        if (!writeFileAtomically(path, encodeEntries(changed.second, job.format))) {
+            failed_writes.push_back(path.string());
+            failed_stores.push_back(changed.first);
+        }
+    }
+}
+
 void Persistence::Internal::save(color_ostream& out) {
     Core &core = Core::getInstance();
 
@@ -208,9 +469,15 @@ void Persistence::Internal::save(color_ostream& out) {
     CoreSuspender suspend;
     LastLoadSaveTickCountUpdater tickCountUpdater;
 
-    // write status
+    // the changed flags of stores that failed to write are restored here
+    finishSave(out);
+
+    SaveJob job;
+    job.format = getSaveFormat();
+
+    // status
     {
-        auto file = std::ofstream(getSaveFilePath("current", "status"));
+        std::ostringstream file;
         file << "DF version:  " << core.p->getDescriptor()->getVersion() << std::endl;
         file << "DFHack version: " << Version::dfhack_version() << " (" << Version::git_commit(true) << ")" << std::endl;
         file << "Tagged release: " << (Version::is_release() ? "yes" : "no") << std::endl;
@@ -225,30 +492,63 @@ void Persistence::Internal::save(color_ostream& out) {
             file << "World last saved in version: " << df::global::world->save_version << std::endl;
             file << "World loaded in version:     " << *df::global::version << std::endl;
         }
+        job.files.emplace_back(getSaveFilePath("current", "status"), file.str());
     }
 
-    // write entity data
+    // entity data; only stores that changed since the last save (or whose
+    // file went away) are copied
+    size_t num_unchanged = 0;
     for (auto & entity_store_entry : store) {
         int entity_id = entity_store_entry.first;
-        Json::Value json(Json::arrayValue);
-        for (auto & entries : entity_store_entry.second) {
-            if (entries.second == nullptr)
-                continue;
-            json.append(entries.second->toJSON());
+        auto & entity_store = entity_store_entry.second;
+        if (!entity_store.changed && Filesystem::exists(getSaveFilePath("current", getEntityFileName(entity_id)))) {
+            ++num_unchanged;
+            continue;
+        }
+        entity_store.changed = false;
+        auto & entries = job.changed[entity_id];
+        for (auto & entry : entity_store.entries) {
+            if (entry.second != nullptr)
+                entries.push_back(entry.second->save());
         }
-        std::string name = (entity_id == Persistence::WORLD_ENTITY_ID) ?
-            "world" : "entity-" + int_to_string(entity_id);
-        auto file = std::ofstream(getSaveFilePath("current", name));
-        file << json;
     }
 
-    // write perf counters
+    // perf counters
     {
-        auto file = std::ofstream(getSaveFilePath("current", "perf-counters"));
+        std::ostringstream file;
         color_ostream_wrapper wrapper(file);
         Lua::CallLuaModuleFunction(wrapper, "script-manager", "print_timers");
+        wrapper.flush();
+        job.files.emplace_back(getSaveFilePath("current", "perf-counters"), file.str());
     }
 
+    DEBUG(persistence,out).print("saving %zu changed and %zu unchanged entity stores\n",
+        job.changed.size(), num_unchanged);
+
+    save_thread = std::thread(writeSave, std::move(job));
+}
+
+static void waitForSaveThread() {
+    if (!save_thread.joinable())
+        return;
+    DFHACK_TRACE_SPAN("persistence/finishSave");
+    save_thread.join();
+}
+
+void Persistence::Internal::finishSave(color_ostream& out) {
+    waitForSaveThread();
+
+    for (auto & path : failed_writes)
+        out.printerr("Cannot save data to: '%s'\n", path.c_str());
+    failed_writes.clear();
+
+    // write them again on the next save
+    for (int entity_id : failed_stores) {
+        auto entity_store_entry = store.find(entity_id);
+        if (entity_store_entry != store.end())
+            entity_store_entry->second.changed = true;
+    }
+    failed_stores.clear();
 }
 
 static bool get_entity_id(const std::string & fname, int & entity_id) {
@@ -258,20 +558,30 @@ static bool get_entity_id(const std::string & fname, int & entity_id) {
     return true;
 }
 
-static void add_entry(std::multimap<std::string, std::shared_ptr<Persistence::DataEntry>> & entity_store_entry,
+static void add_entry(EntityStore & entity_store_entry,
         std::shared_ptr<Persistence::DataEntry> entry) {
-    entity_store_entry.emplace(entry->key, entry);
-    entry_cache.emplace(entry->entry_id, entry);
+    entity_store_entry.add(entry);
+    store_version++;
 }
 
 static void add_entry(int entity_id, std::shared_ptr<Persistence::DataEntry> entry) {
     add_entry(store[entity_id], entry);
 }
 
-static bool load_file(const std::filesystem::path & path, int entity_id) {
+static void add_loaded_entry(EntityStore & entity_store_entry,
+        std::shared_ptr<Persistence::DataEntry> entry) {
+    if (entry->key.empty())
+        return;
+    // ensure fake DF IDs remain globally unique
+    next_fake_df_id = std::min(next_fake_df_id, entry->fake_df_id - 1);
+    add_entry(entity_store_entry, entry);
+}
+
+// entries go into target if given, otherwise into the store
+static bool load_json(const std::string & data, int entity_id, EntityStore * target = nullptr) {
     Json::Value json;
     try {
-        std::ifstream file(path);
+        std::istringstream file(data);
         file >> json;
     } catch (std::exception &) {
         // empty file?
@@ -279,20 +589,140 @@ static bool load_file(const std::filesystem::path & path, int entity_id) {
     }
 
     if (json.isArray()) {
-        auto & entity_store_entry = store[entity_id];
-        for (auto & value : json) {
-            std::shared_ptr<Persistence::DataEntry> entry(new Persistence::DataEntry(entity_id, value));
-            if (entry->key.empty())
-                continue;
-            // ensure fake DF IDs remain globally unique
-            next_fake_df_id = std::min(next_fake_df_id, entry->fake_df_id - 1);
-            add_entry(entity_store_entry, entry);
+        auto & entity_store_entry = target ? *target : store[entity_id];
+        for (auto & value : json)
+            add_loaded_entry(entity_store_entry,
+                std::shared_ptr<Persistence::DataEntry>(new Persistence::DataEntry(entity_id, value)));
+    }
+
+    return true;
+}
+
+namespace {
+    class BinaryReader {
+        const uint8_t *pos, *end;
+
+    public:
+        BinaryReader(const std::string & data)
+            : pos((const uint8_t *)data.data()), end(pos + data.size()) {}
+
+        bool atEnd() const { return pos == end; }
+
+        bool skip(size_t count) {
+            if (size_t(end - pos) < count)
+                return false;
+            pos += count;
+            return true;
+        }
+
+        bool getVarint(uint64_t & value) {
+            value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (pos == end)
+                    return false;
+                uint8_t byte = *pos++;
+                value |= uint64_t(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return true;
+            }
+            return false;
+        }
+
+        // a count of things that take at least a byte each
+        bool getCount(size_t & value) {
+            uint64_t raw;
+            if (!getVarint(raw) || raw > uint64_t(end - pos))
+                return false;
+            value = size_t(raw);
+            return true;
+        }
+
+        bool getSigned(int & value) {
+            uint64_t raw;
+            if (!getVarint(raw) || raw > 0xffffffffULL)
+                return false;
+            value = int32_t(uint32_t(raw >> 1) ^ -uint32_t(raw & 1));
+            return true;
+        }
+
+        bool getString(std::string & str) {
+            uint64_t len;
+            if (!getVarint(len) || len > uint64_t(end - pos))
+                return false;
+            str.assign((const char *)pos, size_t(len));
+            pos += len;
+            return true;
         }
+    };
+}
+
+// Builds the entries straight from the file contents. Nothing is added to
+// the store unless the whole file decodes.
+static bool load_binary(const std::string & data, int entity_id, EntityStore * target = nullptr) {
+    BinaryReader reader(data);
+    uint64_t version;
+    if (!reader.skip(BINARY_MAGIC_LEN) || !reader.getVarint(version) || version != BINARY_VERSION)
+        return false;
+
+    // counts that can't fit in the rest of the file are rejected up front,
+    // so a corrupt count can't make us allocate huge vectors
+    size_t num_keys;
+    if (!reader.getCount(num_keys))
+        return false;
+    std::vector<std::string> keys(num_keys);
+    for (auto & key : keys) {
+        if (!reader.getString(key))
+            return false;
     }
 
+    size_t num_entries;
+    if (!reader.getCount(num_entries))
+        return false;
+    std::vector<std::shared_ptr<Persistence::DataEntry>> entries;
+    entries.reserve(num_entries);
+    for (size_t idx = 0; idx < num_entries; idx++) {
+        uint64_t key_id, num_ints;
+        if (!reader.getVarint(key_id) || key_id >= keys.size())
+            return false;
+        std::shared_ptr<Persistence::DataEntry> entry(new Persistence::DataEntry(entity_id, keys[key_id]));
+        if (!reader.getSigned(entry->fake_df_id) || !reader.getString(entry->str_value) ||
+                !reader.getVarint(num_ints) || num_ints > PersistentDataItem::NumInts)
+            return false;
+        for (size_t i = 0; i < num_ints; i++) {
+            if (!reader.getSigned(entry->int_values[i]))
+                return false;
+        }
+        entries.emplace_back(std::move(entry));
+    }
+    if (!reader.atEnd())
+        return false;
+
+    auto & entity_store_entry = target ? *target : store[entity_id];
+    for (auto & entry : entries)
+        add_loaded_entry(entity_store_entry, entry);
     return true;
 }
 
+static bool load_data(const std::string & data, int entity_id, EntityStore * target = nullptr) {
+    if (data.compare(0, BINARY_MAGIC_LEN, BINARY_MAGIC) == 0)
+        return load_binary(data, entity_id, target);
+    return load_json(data, entity_id, target);
+}
+
+static bool load_file(const std::filesystem::path & path, int entity_id) {
+    std::string data;
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        data = contents.str();
+    }
+
+    return load_data(data, entity_id);
+}
+
 void Persistence::Internal::load(color_ostream& out) {
     CoreSuspender suspend;
     LastLoadSaveTickCountUpdater tickCountUpdater;
@@ -353,11 +783,17 @@ PersistentDataItem Persistence::getByKey(int entity_id, const std::string &key,
 
     CoreSuspender suspend;
 
-    bool found = store.contains(entity_id) && store[entity_id].contains(key);
+    auto entity_store_entry = store.find(entity_id);
+    if (entity_store_entry != store.end()) {
+        auto it = entity_store_entry->second.find(key);
+        if (it != entity_store_entry->second.entries.end()) {
+            if (added)
+                *added = false;
+            return PersistentDataItem(it->second);
+        }
+    }
     if (added)
-        *added = !found;
-    if (found)
-        return PersistentDataItem(store[entity_id].find(key)->second);
+        *added = true;
     if (!added)
         return PersistentDataItem();
     return addItem(entity_id, key);
@@ -371,11 +807,13 @@ bool Persistence::deleteItem(const PersistentDataItem &item) {
 
     int entity_id = item.entity_id();
 
-    auto range = store[entity_id].equal_range(item.key());
+    auto & entity_store_entry = store[entity_id];
+    auto range = entity_store_entry.equal_range(item.key());
     for (auto it = range.first; it != range.second; ++it) {
         if (it->second->isReferencedBy(item)) {
-            entry_cache.erase(it->second->entry_id);
-            store[entity_id].erase(it);
+            it->second->kill();
+            entity_store_entry.erase(it);
+            store_version++;
             break;
         }
     }
@@ -393,7 +831,7 @@ void Persistence::getAll(std::vector<PersistentDataItem> &vec, int entity_id) {
     if (!store.contains(entity_id))
         return;
 
-    for (auto & entries : store[entity_id])
+    for (auto & entries : store[entity_id].entries)
         vec.emplace_back(entries.second);
 }
 
@@ -409,8 +847,8 @@ void Persistence::getAllByKeyRange(std::vector<PersistentDataItem> &vec, int ent
     if (!store.contains(entity_id))
         return;
 
-    auto begin = store[entity_id].lower_bound(min);
-    auto end = store[entity_id].lower_bound(max);
+    auto begin = store[entity_id].entries.lower_bound(min);
+    auto end = store[entity_id].entries.lower_bound(max);
     for (auto it = begin; it != end; ++it)
         vec.emplace_back(it->second);
 }
@@ -431,7 +869,135 @@ void Persistence::getAllByKey(std::vector<PersistentDataItem> &vec, int entity_i
         vec.emplace_back(it->second);
 }
 
+static bool forEachInRange(EntryMap::iterator begin, EntryMap::iterator end,
+        const std::function<bool(const PersistentDataItem &)> &fn) {
+    uint64_t version = store_version;
+    for (auto it = begin; it != end; ++it) {
+        if (!fn(PersistentDataItem(it->second)))
+            return true;
+        // it may be gone
+        if (store_version != version)
+            return false;
+    }
+    return true;
+}
+
+bool Persistence::forEachByKeyRange(int entity_id, const std::string &min, const std::string &max,
+        const std::function<bool(const PersistentDataItem &)> &fn) {
+    if (!is_good_entity_id(entity_id) || !Core::getInstance().isWorldLoaded())
+        return true;
+
+    CoreSuspender suspend;
+
+    auto entity_store_entry = store.find(entity_id);
+    if (entity_store_entry == store.end())
+        return true;
+
+    auto & entries = entity_store_entry->second.entries;
+    return forEachInRange(entries.lower_bound(min), entries.lower_bound(max), fn);
+}
+
+bool Persistence::forEachByPrefix(int entity_id, const std::string &prefix,
+        const std::function<bool(const PersistentDataItem &)> &fn) {
+    if (!is_good_entity_id(entity_id) || !Core::getInstance().isWorldLoaded())
+        return true;
+
+    CoreSuspender suspend;
+
+    auto entity_store_entry = store.find(entity_id);
+    if (entity_store_entry == store.end())
+        return true;
+
+    // the keys with the prefix end before the prefix with its last
+    // incrementable character incremented
+    auto & entries = entity_store_entry->second.entries;
+    std::string max = prefix;
+    while (!max.empty() && (unsigned char)max.back() == 0xff)
+        max.pop_back();
+    if (!max.empty())
+        ++max.back();
+
+    return forEachInRange(entries.lower_bound(prefix),
+        max.empty() ? entries.end() : entries.lower_bound(max), fn);
+}
+
+bool Persistence::forEachByKey(int entity_id, const std::string &key,
+        const std::function<bool(const PersistentDataItem &)> &fn) {
+    if (!is_good_entity_id(entity_id) || !Core::getInstance().isWorldLoaded())
+        return true;
+
+    CoreSuspender suspend;
+
+    auto entity_store_entry = store.find(entity_id);
+    if (entity_store_entry == store.end())
+        return true;
+
+    auto range = entity_store_entry->second.equal_range(key);
+    return forEachInRange(range.first, range.second, fn);
+}
+
 uint32_t Persistence::getUnsavedSeconds() {
     uint32_t durMS =  Core::getInstance().p->getTickCount() - lastLoadSaveTickCount;
     return durMS / 1000;
 }
+
+static std::filesystem::path getConfigPath() {
+    return Filesystem::getBaseDir() / "dfhack-config" / "persistence.json";
+}
+
+static void readSaveFormat() {
+    std::ifstream file(getConfigPath());
+    if (!file)
+        return;
+    Json::Value config;
+    try {
+        file >> config;
+    } catch (std::exception &e) {
+        WARN(persistence).print("could not read '%s': %s\n", getConfigPath().string().c_str(), e.what());
+        return;
+    }
+    if (config.isObject() && config.get("save_format", "json").asString() == "binary")
+        save_format = Persistence::SaveFormat::BINARY;
+}
+
+Persistence::SaveFormat Persistence::getSaveFormat() {
+    std::call_once(save_format_read, readSaveFormat);
+    return save_format;
+}
+
+void Persistence::setSaveFormat(SaveFormat format) {
+    CoreSuspender suspend;
+
+    if (format == getSaveFormat())
+        return;
+    save_format = format;
+
+    Json::Value config(Json::objectValue);
+    config["save_format"] = format == SaveFormat::JSON ? "json" : "binary";
+    std::ostringstream contents;
+    contents << config;
+    if (!writeFileAtomically(getConfigPath(), contents.str()))
+        WARN(persistence).print("could not write '%s'\n", getConfigPath().string().c_str());
+
+    // rewrite every store in the new format on the next save
+    for (auto & entity_store_entry : store)
+        entity_store_entry.second.changed = true;
+}
+
+bool Persistence::roundTripSaveFormat(SaveFormat format, const std::vector<SavedEntry> &entries,
+        std::vector<SavedEntry> &decoded, size_t *bytes) {
+    std::string data = encodeEntries(entries, format);
+    if (bytes)
+        *bytes = data.size();
+
+    // loading keeps fake ids unique; these entries aren't in the store
+    int saved_next_fake_df_id = next_fake_df_id;
+    EntityStore loaded;
+    bool ok = load_data(data, WORLD_ENTITY_ID, &loaded);
+    next_fake_df_id = saved_next_fake_df_id;
+
+    decoded.clear();
+    for (auto & entry : loaded.entries)
+        decoded.push_back(entry.second->save());
+    return ok;
+}
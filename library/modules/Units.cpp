@@ -99,6 +99,7 @@ distribution.
 #include <numeric>
 #include <stddef.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 using std::max;
@@ -668,6 +669,113 @@ bool Units::isGreatDanger(df::unit *unit) {
         isMegabeast(unit) || isForgottenBeast(unit);
 }
 
+namespace {
+    /*
+     * Active units by map block, so box and distance queries only look at
+     * the units in blocks they overlap. Rebuilt on first use in each frame
+     * (the game tick doesn't advance while paused), or when the active
+     * vector is reallocated or resized; Units::teleport drops it. Candidates
+     * are skipped unless they are still at their index in the active vector,
+     * and are rechecked against their current position, but a unit moved by
+     * other means within a frame can be missed until the next one.
+     */
+    class UnitIndex {
+        struct Entry {
+            int32_t idx; // in world->units.active
+            df::unit *unit;
+        };
+
+        std::unordered_map<uint64_t, vector<Entry>> cells;
+        int bx_min = 0, bx_max = -1, by_min = 0, by_max = -1, z_min = 0, z_max = -1;
+
+        bool valid = false;
+        uint32_t built_frame = 0;
+        const void *built_data = nullptr;
+        size_t built_count = 0;
+
+        static uint64_t cellKey(int bx, int by, int z) {
+            return (uint64_t(uint16_t(z)) << 32) | (uint64_t(uint16_t(bx)) << 16) | uint16_t(by);
+        }
+
+    public:
+        void invalidate() {
+            valid = false;
+        }
+
+        void sync() {
+            auto &vec = world->units.active;
+            if (valid && built_frame == Core::getInstance().getFrameCount() &&
+                    built_data == vec.data() && built_count == vec.size())
+                return;
+
+            cells.clear();
+            bx_min = by_min = z_min = INT_MAX;
+            bx_max = by_max = z_max = INT_MIN;
+            for (size_t i = 0; i < vec.size(); i++) {
+                auto unit = vec[i];
+                if (!unit || !Units::isActive(unit))
+                    continue;
+                df::coord pos = Units::getPosition(unit);
+                if (!pos.isValid())
+                    continue;
+                int bx = pos.x >> 4, by = pos.y >> 4;
+                cells[cellKey(bx, by, pos.z)].push_back({int32_t(i), unit});
+                bx_min = min(bx_min, bx); bx_max = max(bx_max, bx);
+                by_min = min(by_min, by); by_max = max(by_max, by);
+                z_min = min(z_min, int(pos.z)); z_max = max(z_max, int(pos.z));
+            }
+
+            valid = true;
+            built_frame = Core::getInstance().getFrameCount();
+            built_data = vec.data();
+            built_count = vec.size();
+        }
+
+        // true if the tile box covers every indexed unit
+        bool covers(int x1, int y1, int z1, int x2, int y2, int z2) const {
+            return (x1 >> 4) <= bx_min && (x2 >> 4) >= bx_max &&
+                (y1 >> 4) <= by_min && (y2 >> 4) >= by_max &&
+                z1 <= z_min && z2 >= z_max;
+        }
+
+        // calls fn(idx, unit) for each unit indexed in a block that overlaps
+        // the tile box and still in the active vector at the same index
+        template<typename F>
+        void forBox(int x1, int y1, int z1, int x2, int y2, int z2, F fn) const {
+            auto &vec = world->units.active;
+            for (int z = max(z1, z_min); z <= min(z2, z_max); z++)
+                for (int by = max(y1 >> 4, by_min); by <= min(y2 >> 4, by_max); by++)
+                    for (int bx = max(x1 >> 4, bx_min); bx <= min(x2 >> 4, bx_max); bx++) {
+                        auto it = cells.find(cellKey(bx, by, z));
+                        if (it == cells.end())
+                            continue;
+                        for (auto &e : it->second)
+                            if (size_t(e.idx) < vec.size() && vec[e.idx] == e.unit)
+                                fn(e.idx, e.unit);
+                    }
+        }
+    };
+
+    UnitIndex unit_index;
+
+    typedef std::pair<int32_t, df::unit *> IndexedUnit;
+
+    // applies the filter in world->units.active order, like a linear scan would
+    void filter_in_order(vector<df::unit *> &units, vector<IndexedUnit> &found,
+                         const std::function<bool(df::unit *)> &filter) {
+        std::sort(found.begin(), found.end());
+        units.clear();
+        for (auto &f : found)
+            if (filter(f.second))
+                units.push_back(f.second);
+    }
+
+    int64_t dist2(df::coord a, df::coord b) {
+        int64_t dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+        return dx*dx + dy*dy + dz*dz;
+    }
+}
+
 bool Units::isUnitInBox(df::unit *u, const cuboid &box) {
     CHECK_NULL_POINTER(u);
     if (!isActive(u))
@@ -679,10 +787,86 @@ bool Units::getUnitsInBox(vector<df::unit *> &units, const cuboid &box, std::fun
     if (!world)
         return false;
 
+    unit_index.sync();
+    vector<IndexedUnit> found;
+    unit_index.forBox(box.x_min, box.y_min, box.z_min, box.x_max, box.y_max, box.z_max,
+        [&](int32_t idx, df::unit *unit) {
+            if (isUnitInBox(unit, box))
+                found.emplace_back(idx, unit);
+        });
+    filter_in_order(units, found, filter);
+    return true;
+}
+
+bool Units::getUnitsInRadius(vector<df::unit *> &units, df::coord center, int radius,
+                             std::function<bool(df::unit *)> filter) {
+    if (!world)
+        return false;
+
     units.clear();
-    for (auto unit : world->units.active)
-        if (isUnitInBox(unit, box) && filter(unit))
-            units.push_back(unit);
+    if (radius < 0)
+        return true;
+
+    unit_index.sync();
+    int64_t r2 = int64_t(radius) * radius;
+    vector<IndexedUnit> found;
+    unit_index.forBox(center.x - radius, center.y - radius, center.z - radius,
+                      center.x + radius, center.y + radius, center.z + radius,
+        [&](int32_t idx, df::unit *unit) {
+            if (isActive(unit) && dist2(getPosition(unit), center) <= r2)
+                found.emplace_back(idx, unit);
+        });
+    filter_in_order(units, found, filter);
+    return true;
+}
+
+bool Units::getNearestUnits(vector<df::unit *> &units, df::coord pos, size_t count,
+                            std::function<bool(df::unit *)> filter) {
+    if (!world)
+        return false;
+
+    units.clear();
+    if (count == 0)
+        return true;
+
+    unit_index.sync();
+
+    // search ever larger boxes around pos until count units are known to be
+    // within the sphere that fits in the box, or the box covers every unit
+    struct Candidate {
+        int64_t d2;
+        int32_t idx;
+        df::unit *unit;
+        bool operator<(const Candidate &o) const {
+            return d2 < o.d2 || (d2 == o.d2 && idx < o.idx);
+        }
+    };
+    vector<Candidate> found;
+    vector<bool> seen(world->units.active.size());
+    for (int radius = 16; ; radius *= 2) {
+        int x1 = pos.x - radius, y1 = pos.y - radius, z1 = pos.z - radius;
+        int x2 = pos.x + radius, y2 = pos.y + radius, z2 = pos.z + radius;
+        unit_index.forBox(x1, y1, z1, x2, y2, z2, [&](int32_t idx, df::unit *unit) {
+            if (seen[idx])
+                return;
+            seen[idx] = true;
+            if (isActive(unit) && filter(unit))
+                found.push_back({dist2(getPosition(unit), pos), idx, unit});
+        });
+
+        int64_t r2 = int64_t(radius) * radius;
+        size_t inside = 0;
+        for (auto &c : found)
+            if (c.d2 <= r2)
+                inside++;
+        if (inside >= count || unit_index.covers(x1, y1, z1, x2, y2, z2))
+            break;
+    }
+
+    size_t n = std::min(count, found.size());
+    std::partial_sort(found.begin(), found.begin() + n, found.end());
+    for (size_t i = 0; i < n; i++)
+        units.push_back(found[i].unit);
     return true;
 }
 
@@ -803,6 +987,7 @@ bool Units::teleport(df::unit *unit, df::coord target_pos)
     // Move unit to destination
     unit->pos = target_pos;
     unit->idle_area = target_pos;
+    unit_index.invalidate();
 
     // Move unit's riders (including babies) to destination
     if (unit->flags1.bits.ridden)
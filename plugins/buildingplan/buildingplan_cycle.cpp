@@ -262,16 +262,12 @@ static df::building * popInvalidTasks(color_ostream &out, Bucket &task_queue,
 }
 
 
-static int distance(df::coord pos1, df::coord pos2) {
-    return std::max(abs(pos1.x - pos2.x), abs(pos1.y - pos2.y)) + abs(pos1.z - pos2.z);
-}
-
 static void doVector(color_ostream &out, df::job_item_vector_id vector_id,
         map<string, Bucket> &buckets,
         unordered_map<int32_t, PlannedBuilding> &planned_buildings,
         bool unsuspend_on_finalize) {
     auto other_id = ENUM_ATTR(job_item_vector_id, other, vector_id);
-    const auto item_vector = df::global::world->items.other[other_id];
+    const auto &item_vector = df::global::world->items.other[other_id];
 
     DEBUG(cycle,out).print("matching %zu item(s) in vector %s against %zu filter bucket(s)\n",
           item_vector.size(),
@@ -284,8 +280,7 @@ static void doVector(color_ostream &out, df::job_item_vector_id vector_id,
         if (itemPassesScreen(out, item))
             available.emplace_back(item);
     }
-    std::vector<std::pair<df::coord, df::item*>> matching;
-    size_t num_matching = 0;
+    Items::NearestItemIndex matching;
 
     DEBUG(cycle,out).print("%zu items available for assignment\n", available.size());
 
@@ -318,24 +313,18 @@ static void doVector(color_ostream &out, df::job_item_vector_id vector_id,
                                        pb.heat_safety,
                                        pb.item_filters[rev_filter_idx],
                                        pb.specials))
-                        matching.emplace_back(Items::getPosition(item),item);
+                        matching.add(item);
 
-                num_matching = matching.size();
                 first_task = false;
                 TRACE(cycle,out).print("first task in bucket: found %zu matching items\n",
-                                        num_matching);
+                                        matching.size());
             }
             // every task: find and attach closest matching item (if any)
-            if (num_matching == 0)
+            if (matching.empty())
                 break; // no more items for this bucket, go to next bucket.
 
-            auto jpos = job->pos;
-            std::pair<df::coord, df::item*> *closest = nullptr;
-            for (auto &p : matching) {
-                if (p.second && (closest == nullptr || distance(jpos, p.first) < distance(jpos, closest->first)))
-                    closest = &p;
-            }
-            auto item = closest->second; // some item must be closest.
+            int dist = 0;
+            auto item = matching.findNearest(job->pos, &dist);
 
             if (Job::attachJobItem(job, item, df::job_role_type::Hauled, filter_idx)) {
                 MaterialInfo material;
@@ -345,7 +334,7 @@ static void doVector(color_ostream &out, df::job_item_vector_id vector_id,
                 DEBUG(cycle,out).print("attached %s %s (distance %d) to filter %d for %s(%d): %s/%s\n",
                       material.toString().c_str(),
                       item_type.toString().c_str(),
-                      distance(closest->first, jpos),
+                      dist,
                       filter_idx,
                       ENUM_KEY_STR(building_type, bld->getType()).c_str(),
                       id,
@@ -357,10 +346,8 @@ static void doVector(color_ostream &out, df::job_item_vector_id vector_id,
                 // items so if buildingplan is turned off, the building will
                 // be completed with the correct number of items.
                 --jitems[filter_idx]->quantity;
-                // null the item* component in vector of matching items
-                // ensures we don't try to attach this item to another job
-                closest->second = nullptr;
-                --num_matching;
+                // ensure we don't try to attach this item to another job
+                matching.remove(item);
                 // try to finalize building
                 if (isJobReady(out, jitems)) {
                     finalizeBuilding(out, bld, unsuspend_on_finalize);
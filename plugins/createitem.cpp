@@ -122,37 +122,25 @@ static inline bool select_caste_mat(color_ostream &out, vector<string> &tokens,
         return CR_FAILURE;
     }
 
-    for (size_t i = 0; i < world->raws.creatures.all.size(); i++)
-    {
-        string castes = "";
-        auto creature = world->raws.creatures.all[i];
-        if (creature->creature_id == tokens[0])
-        {
-            for (size_t j = 0; j < creature->caste.size(); j++)
-            {
-                auto caste = creature->caste[j];
-                castes += " " + caste->caste_id;
-                if (caste->caste_id == tokens[1])
-                {
-                    mat_type = i;
-                    mat_index = j;
-                    break;
-                }
-            }
-            if (mat_type == -1) {
-                if (tokens[1].empty())
-                    out.printerr("You must also specify a caste.\n");
-                else
-                    out.printerr("The creature you specified has no such caste!\n");
-                out.printerr("Valid castes:%s\n", castes.c_str());
-                return false;
-            }
-        }
-    }
-    if (mat_type == -1) {
+    int creature = findCreatureIndex(tokens[0]);
+    if (creature == -1) {
         out.printerr("Unrecognized creature ID!\n");
         return false;
     }
+    int caste = findCasteIndex(creature, tokens[1]);
+    if (caste == -1) {
+        string castes = "";
+        for (auto raw : world->raws.creatures.all[creature]->caste)
+            castes += " " + raw->caste_id;
+        if (tokens[1].empty())
+            out.printerr("You must also specify a caste.\n");
+        else
+            out.printerr("The creature you specified has no such caste!\n");
+        out.printerr("Valid castes:%s\n", castes.c_str());
+        return false;
+    }
+    mat_type = creature;
+    mat_index = caste;
     return true;
 }
 
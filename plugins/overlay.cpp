@@ -30,6 +30,7 @@
 #include "MemAccess.h"
 #include "PluginManager.h"
 #include "PluginLua.h"
+#include "Trace.h"
 #include "VTableInterpose.h"
 
 #include "modules/Gui.h"
@@ -65,6 +66,8 @@ static void overlay_interpose_lua(const char *fn_name, int nargs = 0, int nres =
     auto & core = Core::getInstance();
     auto & counters = core.perf_counters;
     uint32_t start_ms = core.p->getTickCount();
+    // fn_name is always a string literal
+    DFHACK_TRACE_SPAN(fn_name);
 
     Lua::CallLuaModuleFunction(out, L, "plugins.overlay", fn_name, nargs, nres,
                                std::forward<Lua::LuaLambda&&>(args_lambda),
@@ -623,23 +623,8 @@ static command_result embark_prospector(color_ostream &out,
     return CR_OK;
 }
 
-static command_result map_prospector(color_ostream &con,
-                                     const prospect_options &options) {
-    if (!Maps::IsValid())
-    {
-        con.printerr("Map is not available!\n");
-        return CR_FAILURE;
-    }
-
-    uint32_t x_max = 0, y_max = 0, z_max = 0;
-    Maps::getSize(x_max, y_max, z_max);
-    MapExtras::MapCache map;
-
-    DFHack::Materials *mats = Core::getInstance().getMaterials();
-
-    DFHack::t_feature blockFeatureGlobal;
-    DFHack::t_feature blockFeatureLocal;
-
+struct map_counts
+{
     bool hasDemonTemple = false;
     bool hasLair = false;
     MatMap baseMats;
@@ -653,162 +638,208 @@ static command_result map_prospector(color_ostream &con,
     matdata aquiferTiles;
     matdata tubeTiles;
 
-    for(uint32_t z = 0; z < z_max; z++)
+    static void merge(matdata &into, const matdata &from)
+    {
+        if (!from.count)
+            return;
+        into.add(from.lower_z, from.count);
+        into.add(from.upper_z, 0);
+    }
+    static void merge(MatMap &into, const MatMap &from)
+    {
+        for (auto &entry : from)
+            merge(into[entry.first], entry.second);
+    }
+
+    void merge(const map_counts &other)
     {
-        // the '- 100' is because DF v50 and later have a 100 offset in reported elevation
-        int global_z = world->map.region_z + z - 100;
+        hasDemonTemple |= other.hasDemonTemple;
+        hasLair |= other.hasLair;
+        merge(baseMats, other.baseMats);
+        merge(layerMats, other.layerMats);
+        merge(veinMats, other.veinMats);
+        merge(plantMats, other.plantMats);
+        merge(treeMats, other.treeMats);
+        merge(liquidWater, other.liquidWater);
+        merge(liquidMagma, other.liquidMagma);
+        merge(aquiferTiles, other.aquiferTiles);
+        merge(tubeTiles, other.tubeTiles);
+    }
+};
+
+// Called from the map scan workers, so this must only read from the map.
+static void count_block(map_counts &counts, MapExtras::Block *b,
+                        const prospect_options &options)
+{
+    DFHack::t_feature blockFeatureGlobal;
+    DFHack::t_feature blockFeatureLocal;
+
+    df::coord bcoord = b->getCoord();
+    // the '- 100' is because DF v50 and later have a 100 offset in reported elevation
+    int global_z = world->map.region_z + bcoord.z - 100;
 
-        for(uint32_t b_y = 0; b_y < y_max; b_y++)
+    // Find features
+    b->GetGlobalFeature(&blockFeatureGlobal);
+    b->GetLocalFeature(&blockFeatureLocal);
+
+    // Iterate over all the tiles in the block
+    for(uint32_t y = 0; y < 16; y++)
+    {
+        for(uint32_t x = 0; x < 16; x++)
         {
-            for(uint32_t b_x = 0; b_x < x_max; b_x++)
+            df::coord2d coord(x, y);
+            df::tile_designation des = b->DesignationAt(coord);
+            df::tile_occupancy occ = b->OccupancyAt(coord);
+
+            // Skip hidden tiles
+            if (!options.hidden && des.bits.hidden)
+            {
+                continue;
+            }
+
+            // Check for aquifer
+            if (des.bits.water_table)
+            {
+                counts.aquiferTiles.add(global_z);
+            }
+
+            // Check for lairs
+            if (occ.bits.monster_lair)
+            {
+                counts.hasLair = true;
+            }
+
+            // Check for liquid
+            if (des.bits.flow_size)
+            {
+                if (des.bits.liquid_type == tile_liquid::Magma)
+                    counts.liquidMagma.add(global_z);
+                else
+                    counts.liquidWater.add(global_z);
+            }
+
+            df::tiletype type = b->tiletypeAt(coord);
+            df::tiletype_shape tileshape = tileShape(type);
+            df::tiletype_material tilemat = tileMaterial(type);
+
+            // We only care about these types
+            switch (tileshape)
             {
-                // Get the map block
-                df::coord2d blockCoord(b_x, b_y);
-                MapExtras::Block *b = map.BlockAt(DFHack::DFCoord(b_x, b_y, z));
-                if (!b || !b->is_valid())
+            case tiletype_shape::WALL:
+            case tiletype_shape::FORTIFICATION:
+                break;
+            case tiletype_shape::EMPTY:
+                /* A heuristic: tubes inside adamantine have EMPTY:AIR tiles which
+                   still have feature_local set. Also check the unrevealed status,
+                   so as to exclude any holes mined by the player. */
+                if (tilemat == tiletype_material::AIR &&
+                    des.bits.feature_local && des.bits.hidden &&
+                    blockFeatureLocal.type == feature_type::deep_special_tube)
                 {
-                    continue;
+                    counts.tubeTiles.add(global_z);
                 }
+            default:
+                continue;
+            }
 
-                // Find features
-                b->GetGlobalFeature(&blockFeatureGlobal);
-                b->GetLocalFeature(&blockFeatureLocal);
+            // Count the material type
+            counts.baseMats[tilemat].add(global_z);
 
-                // Iterate over all the tiles in the block
-                for(uint32_t y = 0; y < 16; y++)
+            // Find the type of the tile
+            switch (tilemat)
+            {
+            case tiletype_material::SOIL:
+            case tiletype_material::STONE:
+                counts.layerMats[b->layerMaterialAt(coord)].add(global_z);
+                break;
+            case tiletype_material::MINERAL:
+                counts.veinMats[b->veinMaterialAt(coord)].add(global_z);
+                break;
+            case tiletype_material::FEATURE:
+                if (blockFeatureLocal.type != -1 && des.bits.feature_local)
                 {
-                    for(uint32_t x = 0; x < 16; x++)
+                    if (blockFeatureLocal.type == feature_type::deep_special_tube
+                            && blockFeatureLocal.main_material == 0) // stone
                     {
-                        df::coord2d coord(x, y);
-                        df::tile_designation des = b->DesignationAt(coord);
-                        df::tile_occupancy occ = b->OccupancyAt(coord);
-
-                        // Skip hidden tiles
-                        if (!options.hidden && des.bits.hidden)
-                        {
-                            continue;
-                        }
-
-                        // Check for aquifer
-                        if (des.bits.water_table)
-                        {
-                            aquiferTiles.add(global_z);
-                        }
-
-                        // Check for lairs
-                        if (occ.bits.monster_lair)
-                        {
-                            hasLair = true;
-                        }
-
-                        // Check for liquid
-                        if (des.bits.flow_size)
-                        {
-                            if (des.bits.liquid_type == tile_liquid::Magma)
-                                liquidMagma.add(global_z);
-                            else
-                                liquidWater.add(global_z);
-                        }
-
-                        df::tiletype type = b->tiletypeAt(coord);
-                        df::tiletype_shape tileshape = tileShape(type);
-                        df::tiletype_material tilemat = tileMaterial(type);
-
-                        // We only care about these types
-                        switch (tileshape)
-                        {
-                        case tiletype_shape::WALL:
-                        case tiletype_shape::FORTIFICATION:
-                            break;
-                        case tiletype_shape::EMPTY:
-                            /* A heuristic: tubes inside adamantine have EMPTY:AIR tiles which
-                               still have feature_local set. Also check the unrevealed status,
-                               so as to exclude any holes mined by the player. */
-                            if (tilemat == tiletype_material::AIR &&
-                                des.bits.feature_local && des.bits.hidden &&
-                                blockFeatureLocal.type == feature_type::deep_special_tube)
-                            {
-                                tubeTiles.add(global_z);
-                            }
-                        default:
-                            continue;
-                        }
-
-                        // Count the material type
-                        baseMats[tilemat].add(global_z);
-
-                        // Find the type of the tile
-                        switch (tilemat)
-                        {
-                        case tiletype_material::SOIL:
-                        case tiletype_material::STONE:
-                            layerMats[b->layerMaterialAt(coord)].add(global_z);
-                            break;
-                        case tiletype_material::MINERAL:
-                            veinMats[b->veinMaterialAt(coord)].add(global_z);
-                            break;
-                        case tiletype_material::FEATURE:
-                            if (blockFeatureLocal.type != -1 && des.bits.feature_local)
-                            {
-                                if (blockFeatureLocal.type == feature_type::deep_special_tube
-                                        && blockFeatureLocal.main_material == 0) // stone
-                                {
-                                    veinMats[blockFeatureLocal.sub_material].add(global_z);
-                                }
-                                else if (blockFeatureLocal.type == feature_type::deep_surface_portal)
-                                {
-                                    hasDemonTemple = true;
-                                }
-                            }
-
-                            if (blockFeatureGlobal.type != -1 && des.bits.feature_global
-                                    && blockFeatureGlobal.type == feature_type::underworld_from_layer
-                                    && blockFeatureGlobal.main_material == 0) // stone
-                            {
-                                layerMats[blockFeatureGlobal.sub_material].add(global_z);
-                            }
-                            break;
-                        case tiletype_material::LAVA_STONE:
-                            // TODO ?
-                            break;
-                        default:
-                            break;
-                        }
+                        counts.veinMats[blockFeatureLocal.sub_material].add(global_z);
+                    }
+                    else if (blockFeatureLocal.type == feature_type::deep_surface_portal)
+                    {
+                        counts.hasDemonTemple = true;
                     }
                 }
 
-                // Check plants this way, as the other way wasn't getting them all
-                // and we can check visibility more easily here
-                if (options.shrubs)
+                if (blockFeatureGlobal.type != -1 && des.bits.feature_global
+                        && blockFeatureGlobal.type == feature_type::underworld_from_layer
+                        && blockFeatureGlobal.main_material == 0) // stone
                 {
-                    auto block = Maps::getBlockColumn(b_x,b_y);
-                    vector<df::plant *> *plants = block ? &block->plants : NULL;
-                    if(plants)
-                    {
-                        for (PlantList::const_iterator it = plants->begin(); it != plants->end(); it++)
-                        {
-                            const df::plant & plant = *(*it);
-                            if (uint32_t(plant.pos.z) != z)
-                                continue;
-                            df::coord2d loc(plant.pos.x, plant.pos.y);
-                            loc = loc % 16;
-                            if (options.hidden || !b->DesignationAt(loc).bits.hidden)
-                            {
-                                if (ENUM_ATTR(plant_type, is_shrub, plant.type))
-                                    plantMats[plant.material].add(global_z);
-                                else
-                                    treeMats[plant.material].add(global_z);
-                            }
-                        }
-                    }
+                    counts.layerMats[blockFeatureGlobal.sub_material].add(global_z);
+                }
+                break;
+            case tiletype_material::LAVA_STONE:
+                // TODO ?
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    // Check plants this way, as the other way wasn't getting them all
+    // and we can check visibility more easily here
+    if (options.shrubs)
+    {
+        auto block = Maps::getBlockColumn(bcoord.x, bcoord.y);
+        vector<df::plant *> *plants = block ? &block->plants : NULL;
+        if(plants)
+        {
+            for (PlantList::const_iterator it = plants->begin(); it != plants->end(); it++)
+            {
+                const df::plant & plant = *(*it);
+                if (plant.pos.z != bcoord.z)
+                    continue;
+                df::coord2d loc(plant.pos.x, plant.pos.y);
+                loc = loc % 16;
+                if (options.hidden || !b->DesignationAt(loc).bits.hidden)
+                {
+                    if (ENUM_ATTR(plant_type, is_shrub, plant.type))
+                        counts.plantMats[plant.material].add(global_z);
+                    else
+                        counts.treeMats[plant.material].add(global_z);
                 }
-                // Block end
-            } // block x
+            }
+        }
+    }
+}
+
+static command_result map_prospector(color_ostream &con,
+                                     const prospect_options &options) {
+    if (!Maps::IsValid())
+    {
+        con.printerr("Map is not available!\n");
+        return CR_FAILURE;
+    }
+
+    DFHack::Materials *mats = Core::getInstance().getMaterials();
 
-            // Clean uneeded memory
-            map.trash();
-        } // block y
-    } // z
+    // the map is scanned by several workers at once; each one fills its own
+    // map_counts and the results are merged afterwards
+    map_counts counts = MapExtras::parallelBlockReduce<map_counts>(
+        [&](map_counts &acc, MapExtras::Block *b) { count_block(acc, b, options); },
+        [](map_counts &acc, map_counts &other) { acc.merge(other); });
+
+    bool hasDemonTemple = counts.hasDemonTemple;
+    bool hasLair = counts.hasLair;
+    MatMap &baseMats = counts.baseMats;
+    MatMap &layerMats = counts.layerMats;
+    MatMap &veinMats = counts.veinMats;
+    MatMap &plantMats = counts.plantMats;
+    MatMap &treeMats = counts.treeMats;
+
+    matdata &liquidWater = counts.liquidWater;
+    matdata &liquidMagma = counts.liquidMagma;
+    matdata &aquiferTiles = counts.aquiferTiles;
+    matdata &tubeTiles = counts.tubeTiles;
 
     MatMap::const_iterator it;
 
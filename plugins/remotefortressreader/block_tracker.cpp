@@ -0,0 +1,241 @@
+#include "block_tracker.h"
+#include "DataDefs.h"
+#include "df_version_int.h"
+
+#include "df/block_square_event_material_spatterst.h"
+#if DF_VERSION_INT > 34011
+#include "df/block_square_event_item_spatterst.h"
+#endif
+#include "df/map_block.h"
+
+#include <algorithm>
+
+using namespace DFHack;
+
+static uint16_t hashSpatters(df::map_block *block)
+{
+    std::vector<df::block_square_event_material_spatterst *> materials;
+#if DF_VERSION_INT > 34011
+    std::vector<df::block_square_event_item_spatterst *> items;
+    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL, NULL, &items))
+        return 0;
+#else
+    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL))
+        return 0;
+#endif
+
+    uint16_t hash = 0;
+
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        auto mat = materials[i];
+        hash ^= fletcher16((uint8_t*)mat, sizeof(df::block_square_event_material_spatterst));
+    }
+#if DF_VERSION_INT > 34011
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        auto item = items[i];
+        hash ^= fletcher16((uint8_t*)item, sizeof(df::block_square_event_item_spatterst));
+    }
+#endif
+    return hash;
+}
+
+void BlockTracker::clear()
+{
+    states.clear();
+    x_bmax = y_bmax = z_max = 0;
+    generation = 0;
+    map_epoch++;
+}
+
+BlockTracker::BlockState *BlockTracker::getState(const DFCoord &pos)
+{
+    uint32_t x, y, z;
+    Maps::getSize(x, y, z);
+    if (x != x_bmax || y != y_bmax || z != z_max)
+    {
+        // new map; everything we knew is stale
+        clear();
+        x_bmax = x;
+        y_bmax = y;
+        z_max = z;
+        states.assign(size_t(x) * y * z, BlockState());
+    }
+
+    if (unsigned(pos.x) >= x_bmax || unsigned(pos.y) >= y_bmax || unsigned(pos.z) >= z_max)
+        return NULL;
+    return &states[(size_t(pos.z) * y_bmax + pos.y) * x_bmax + pos.x];
+}
+
+void BlockTracker::rehash(BlockState &state, df::map_block *block)
+{
+    uint16_t hash[NUM_ASPECTS] = {};
+    if (block)
+    {
+        hash[TILES] = fletcher16((uint8_t*)(block->tiletype), 16 * 16 * (sizeof(df::enums::tiletype::tiletype)));
+        hash[DESIGNATIONS] = fletcher16((uint8_t*)(block->designation), 16 * 16 * (sizeof(df::tile_designation)));
+        hash[SPATTERS] = hashSpatters(block);
+    }
+    for (int i = 0; i < NUM_ASPECTS; i++)
+    {
+        if (state.hash[i] == hash[i])
+            continue;
+        state.hash[i] = hash[i];
+        state.gen[i] = ++generation;
+    }
+    state.hashed_frame = frame;
+}
+
+bool BlockTracker::isFresh(const BlockState &state) const
+{
+    if (!state.hashed_frame || !watch_size)
+        return false;
+    // the sweep revisits every watched block at least this often
+    uint32_t period = uint32_t((watch_size + SWEEP_BUDGET - 1) / SWEEP_BUDGET);
+    return frame - state.hashed_frame <= period;
+}
+
+BlockTracker::SentBlocks *BlockTracker::watch(int client, const DFCoord &min, const DFCoord &max)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (max.x <= min.x || max.y <= min.y || max.z <= min.z)
+    {
+        auto it = clients.find(client);
+        if (it != clients.end())
+        {
+            watch_size -= it->second.size;
+            clients.erase(it);
+            cursor = 0;
+        }
+        return NULL;
+    }
+
+    SentBlocks &area = clients[client];
+    area.watched_frame = frame;
+    if (area.size && area.min == min && area.max == max)
+        return &area;
+
+    // keep what was sent for the part of the old area that is still watched
+    size_t size = size_t(max.x - min.x) * (max.y - min.y) * (max.z - min.z);
+    std::vector<std::array<uint32_t, NUM_ASPECTS>> sent(size);
+    if (area.size)
+    {
+        size_t old_dx = area.max.x - area.min.x, old_dy = area.max.y - area.min.y;
+        size_t dx = max.x - min.x, dy = max.y - min.y;
+        for (int z = std::max(min.z, area.min.z); z < std::min(max.z, area.max.z); z++)
+            for (int y = std::max(min.y, area.min.y); y < std::min(max.y, area.max.y); y++)
+                for (int x = std::max(min.x, area.min.x); x < std::min(max.x, area.max.x); x++)
+                    sent[(size_t(z - min.z) * dy + (y - min.y)) * dx + (x - min.x)] =
+                        area.sent[(size_t(z - area.min.z) * old_dy + (y - area.min.y)) * old_dx + (x - area.min.x)];
+    }
+
+    watch_size += size - area.size;
+    cursor = 0;
+    area.min = min;
+    area.max = max;
+    area.size = size;
+    area.sent.swap(sent);
+    return &area;
+}
+
+void BlockTracker::unwatch(int client)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = clients.find(client);
+    if (it == clients.end())
+        return;
+    watch_size -= it->second.size;
+    clients.erase(it);
+    cursor = 0;
+}
+
+void BlockTracker::sweep(size_t budget)
+{
+    // still counted while nothing is watched, so blocks hashed before then
+    // aren't taken as fresh once something is again
+    frame++;
+    if (!watch_size)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto it = clients.begin(); it != clients.end(); )
+    {
+        if (frame - it->second.watched_frame <= IDLE_FRAMES)
+        {
+            ++it;
+            continue;
+        }
+        watch_size -= it->second.size;
+        it = clients.erase(it);
+        cursor = 0;
+    }
+
+    budget = std::min<size_t>(budget, watch_size);
+    while (budget > 0)
+    {
+        if (cursor >= watch_size)
+            cursor = 0;
+
+        // find the area the cursor is in
+        size_t offset = cursor;
+        auto it = clients.begin();
+        while (offset >= it->second.size)
+        {
+            offset -= it->second.size;
+            ++it;
+        }
+        const SentBlocks &area = it->second;
+        size_t dx = area.max.x - area.min.x;
+        size_t dy = area.max.y - area.min.y;
+
+        size_t count = std::min(budget, area.size - offset);
+        for (size_t idx = offset; idx < offset + count; idx++)
+        {
+            DFCoord pos(area.min.x + idx % dx,
+                        area.min.y + (idx / dx) % dy,
+                        area.min.z + idx / (dx * dy));
+            BlockState *state = getState(pos);
+            if (!state)
+                continue;
+            rehash(*state, Maps::getBlock(pos));
+            stats.blocks_swept++;
+        }
+        cursor += count;
+        budget -= count;
+    }
+}
+
+void BlockTracker::refresh(const DFCoord &pos)
+{
+    BlockState *state = getState(pos);
+    if (!state || isFresh(*state))
+        return;
+    rehash(*state, Maps::getBlock(pos));
+    stats.blocks_hashed++;
+}
+
+bool BlockTracker::takeChanged(SentBlocks &client, const DFCoord &pos, Aspect aspect)
+{
+    BlockState *state = getState(pos);
+    if (!state)
+        return false;
+    if (client.map_epoch != map_epoch)
+    {
+        std::fill(client.sent.begin(), client.sent.end(), std::array<uint32_t, NUM_ASPECTS>());
+        client.map_epoch = map_epoch;
+    }
+    if (pos.x < client.min.x || pos.x >= client.max.x ||
+        pos.y < client.min.y || pos.y >= client.max.y ||
+        pos.z < client.min.z || pos.z >= client.max.z)
+        return true;
+    size_t dx = client.max.x - client.min.x, dy = client.max.y - client.min.y;
+    uint32_t &sent = client.sent[(size_t(pos.z - client.min.z) * dy + (pos.y - client.min.y)) * dx +
+                                 (pos.x - client.min.x)][aspect];
+    if (sent == state->gen[aspect])
+        return false;
+    sent = state->gen[aspect];
+    return true;
+}
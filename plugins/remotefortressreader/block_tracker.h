@@ -0,0 +1,111 @@
+#ifndef BLOCK_TRACKER_H
+#define BLOCK_TRACKER_H
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "modules/Maps.h"
+
+uint16_t fletcher16(uint8_t const *data, size_t bytes);
+
+// Keeps track of which map blocks changed since they were last sent, so that
+// GetBlockList doesn't have to rehash every requested block on every poll.
+//
+// Blocks inside the areas clients last asked for are rehashed a few at a time
+// from plugin_onupdate, and every change stamps the block with a new
+// generation number. Each client has the generations it was last sent kept
+// in a SentBlocks, covering only the area it last asked for, so GetBlockList
+// only compares generations, and only hashes blocks the sweep hasn't visited
+// recently (e.g. ones that just scrolled into view). Clients that stop asking
+// are forgotten after IDLE_FRAMES.
+class BlockTracker
+{
+public:
+    enum Aspect {
+        TILES = 0,
+        DESIGNATIONS,
+        SPATTERS,
+        NUM_ASPECTS
+    };
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t blocks_scanned = 0; // blocks looked at by GetBlockList
+        uint64_t blocks_hashed = 0;  // ... of which had to be hashed on the spot
+        uint64_t blocks_swept = 0;   // blocks hashed by the per-frame sweep
+        uint64_t blocks_sent = 0;
+    };
+
+    // the area one client watches, and the generations of each block in it
+    // that the client has been sent
+    class SentBlocks {
+        friend class BlockTracker;
+        DFHack::DFCoord min, max;
+        size_t size = 0;
+        std::vector<std::array<uint32_t, NUM_ASPECTS>> sent;
+        uint32_t map_epoch = 0;
+        uint32_t watched_frame = 0;
+    };
+
+    // blocks rehashed per frame by sweep(). Kept small so the sweep costs
+    // little in any one frame; a typical view of a few thousand blocks is
+    // still revisited within a second, and GetBlockList hashes blocks the
+    // sweep hasn't reached yet itself.
+    static const size_t SWEEP_BUDGET = 64;
+    // clients that haven't called watch() for this many frames are forgotten
+    static const uint32_t IDLE_FRAMES = 1000;
+
+    // forgets all block state; watched areas are kept
+    void clear();
+
+    // sets the area to keep up to date for a client, in block coordinates,
+    // and returns what the client was sent in it, which stays valid while
+    // the core is suspended. max is exclusive. NULL if the area is empty.
+    SentBlocks *watch(int client, const DFHack::DFCoord &min, const DFHack::DFCoord &max);
+    // forgets the client, so every block counts as changed for it again.
+    // Doesn't need the core suspended.
+    void unwatch(int client);
+
+    // rehashes up to budget blocks of the watched areas
+    void sweep(size_t budget = SWEEP_BUDGET);
+
+    // brings the block up to date if the sweep hasn't done so recently
+    void refresh(const DFHack::DFCoord &pos);
+
+    // true if the aspect changed since the last takeChanged() for the same
+    // client that returned true for it; that call consumes the change.
+    // Blocks outside the client's area always count as changed.
+    bool takeChanged(SentBlocks &client, const DFHack::DFCoord &pos, Aspect aspect);
+
+    Stats stats;
+
+private:
+    struct BlockState {
+        uint16_t hash[NUM_ASPECTS];
+        uint32_t gen[NUM_ASPECTS];
+        uint32_t hashed_frame;
+    };
+
+    std::vector<BlockState> states;
+    uint32_t x_bmax = 0, y_bmax = 0, z_max = 0;
+    uint32_t generation = 0;
+    // 0 marks blocks that were never hashed
+    uint32_t frame = 1;
+    // bumped whenever states is thrown away, so clients know to resend
+    uint32_t map_epoch = 1;
+
+    // guards clients and cursor, since connections go away without
+    // suspending the core
+    std::mutex mutex;
+    std::map<int, SentBlocks> clients;
+    std::atomic<size_t> watch_size{0};
+    size_t cursor = 0;
+
+    BlockState *getState(const DFHack::DFCoord &pos);
+    void rehash(BlockState &state, df::map_block *block);
+    bool isFresh(const BlockState &state) const;
+};
+
+#endif
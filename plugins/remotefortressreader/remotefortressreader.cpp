@@ -1,11 +1,14 @@
 #include "df_version_int.h"
 #define RFR_VERSION "0.21.0"
 
+#include <algorithm>
 #include <cstdio>
+#include <map>
 #include <time.h>
 #include <vector>
 
 #include "Console.h"
+#include "Core.h"
 #include "DataDefs.h"
 #include "Export.h"
 #include "Hooks.h"
@@ -126,6 +129,7 @@
 #include "df/unit_relationship_type.h"
 
 #include "adventure_control.h"
+#include "block_tracker.h"
 #include "building_reader.h"
 #include "dwarf_control.h"
 #include "item_reader.h"
@@ -155,20 +159,18 @@ REQUIRE_GLOBAL(adventure);
 static command_result GetGrowthList(color_ostream &stream, const EmptyMessage *in, MaterialList *out);
 static command_result GetMaterialList(color_ostream &stream, const EmptyMessage *in, MaterialList *out);
 static command_result GetTiletypeList(color_ostream &stream, const EmptyMessage *in, TiletypeList *out);
-static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out);
 static command_result GetPlantList(color_ostream &stream, const BlockRequest *in, PlantList *out);
 static command_result CheckHashes(color_ostream &stream, const EmptyMessage *in);
 static command_result GetUnitList(color_ostream &stream, const EmptyMessage *in, UnitList *out);
 static command_result GetUnitListInside(color_ostream &stream, const BlockRequest *in, UnitList *out);
 static command_result GetViewInfo(color_ostream &stream, const EmptyMessage *in, ViewInfo *out);
 static command_result GetMapInfo(color_ostream &stream, const EmptyMessage *in, MapInfo *out);
-static command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in);
 static command_result GetWorldMap(color_ostream &stream, const EmptyMessage *in, WorldMap *out);
 static command_result GetWorldMapNew(color_ostream &stream, const EmptyMessage *in, WorldMap *out);
 static command_result GetWorldMapCenter(color_ostream &stream, const EmptyMessage *in, WorldMap *out);
 static command_result GetRegionMaps(color_ostream &stream, const EmptyMessage *in, RegionMaps *out);
 static command_result GetRegionMapsNew(color_ostream &stream, const EmptyMessage *in, RegionMaps *out);
-static command_result GetCreatureRaws(color_ostream &stream, const EmptyMessage *in, CreatureRawList *out);
+static command_result GetCreatureRaws(color_ostream &stream, const EmptyMessage *in, RPCReplyStream<CreatureRawList> &reply);
 static command_result GetPartialCreatureRaws(color_ostream &stream, const ListRequest *in, CreatureRawList *out);
 static command_result GetPlantRaws(color_ostream &stream, const EmptyMessage *in, PlantRawList *out);
 static command_result GetPartialPlantRaws(color_ostream &stream, const ListRequest *in, PlantRawList *out);
@@ -226,6 +228,84 @@ command_result RemoteFortressReader_version(color_ostream &out, std::vector<std:
 
 DFHACK_PLUGIN_IS_ENABLED(enableUpdates);
 
+#ifndef SF_ALLOW_REMOTE
+#define SF_ALLOW_REMOTE 0
+#endif // !SF_ALLOW_REMOTE
+
+static BlockTracker blockTracker;
+
+// What one connected client has already been sent. Every connection gets its
+// own service instance from plugin_rpcconnect, so each viewer receives its own
+// deltas instead of stealing another one's.
+struct ClientSession
+{
+    int id;
+    std::map<DFCoord, uint8_t> buildingHashes;
+    std::map<int, uint16_t> itemHashes;
+    std::map<int, int> engravingHashes;
+
+    bool IsBuildingChanged(DFCoord pos);
+    bool isItemChanged(int i);
+    bool areItemsChanged(std::vector<int> * items);
+    bool isEngravingNew(int index);
+    void engravingIsNotNew(int index);
+
+    void reset();
+};
+
+static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out, ClientSession &session);
+
+class RemoteFortressReaderService : public RPCService
+{
+    static int next_session_id;
+    ClientSession session;
+
+public:
+    RemoteFortressReaderService()
+    {
+        session.id = ++next_session_id;
+        addMethod("GetBlockList", &RemoteFortressReaderService::GetBlockList, SF_ALLOW_REMOTE);
+        addMethod("ResetMapHashes", &RemoteFortressReaderService::ResetMapHashes, SF_ALLOW_REMOTE);
+    }
+
+    ~RemoteFortressReaderService()
+    {
+        blockTracker.unwatch(session.id);
+    }
+
+    command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out)
+    {
+        return ::GetBlockList(stream, in, out, session);
+    }
+
+    command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in)
+    {
+        session.reset();
+        return CR_OK;
+    }
+};
+
+int RemoteFortressReaderService::next_session_id = 0;
+
+command_result RemoteFortressReader_stats(color_ostream &out, std::vector<std::string> &parameters)
+{
+    if (parameters.size() == 1 && parameters[0] == "reset")
+    {
+        blockTracker.stats = BlockTracker::Stats();
+        return CR_OK;
+    }
+    if (!parameters.empty())
+        return CR_WRONG_USAGE;
+
+    auto &stats = blockTracker.stats;
+    out.print("GetBlockList requests: %llu\n", (unsigned long long)stats.requests);
+    out.print("Blocks scanned:        %llu\n", (unsigned long long)stats.blocks_scanned);
+    out.print("  hashed on request:   %llu\n", (unsigned long long)stats.blocks_hashed);
+    out.print("Blocks sent:           %llu\n", (unsigned long long)stats.blocks_sent);
+    out.print("Blocks swept:          %llu\n", (unsigned long long)stats.blocks_swept);
+    return CR_OK;
+}
+
 // Mandatory init function. If you have some global state, create it here.
 DFhackCExport command_result plugin_init(color_ostream &out, std::vector <PluginCommand> &commands)
 {
@@ -233,6 +313,10 @@ DFhackCExport command_result plugin_init(color_ostream &out, std::vector <Plugin
         "RemoteFortressReader_version",
         "List the loaded RemoteFortressReader version",
         RemoteFortressReader_version));
+    commands.push_back(PluginCommand(
+        "RemoteFortressReader_stats",
+        "Show how many map blocks GetBlockList scanned and sent",
+        RemoteFortressReader_stats));
     commands.push_back(PluginCommand(
         "load-art-image-chunk",
         "Gets an art image chunk by index, loading from disk if necessary",
@@ -241,16 +325,11 @@ DFhackCExport command_result plugin_init(color_ostream &out, std::vector <Plugin
     return CR_OK;
 }
 
-#ifndef SF_ALLOW_REMOTE
-#define SF_ALLOW_REMOTE 0
-#endif // !SF_ALLOW_REMOTE
-
 DFhackCExport RPCService *plugin_rpcconnect(color_ostream &)
 {
-    RPCService *svc = new RPCService();
+    RPCService *svc = new RemoteFortressReaderService();
     svc->addFunction("GetMaterialList", GetMaterialList, SF_ALLOW_REMOTE);
     svc->addFunction("GetGrowthList", GetGrowthList, SF_ALLOW_REMOTE);
-    svc->addFunction("GetBlockList", GetBlockList, SF_ALLOW_REMOTE);
     svc->addFunction("CheckHashes", CheckHashes, SF_ALLOW_REMOTE);
     svc->addFunction("GetTiletypeList", GetTiletypeList, SF_ALLOW_REMOTE);
     svc->addFunction("GetPlantList", GetPlantList, SF_ALLOW_REMOTE);
@@ -258,14 +337,13 @@ DFhackCExport RPCService *plugin_rpcconnect(color_ostream &)
     svc->addFunction("GetUnitListInside", GetUnitListInside, SF_ALLOW_REMOTE);
     svc->addFunction("GetViewInfo", GetViewInfo, SF_ALLOW_REMOTE);
     svc->addFunction("GetMapInfo", GetMapInfo, SF_ALLOW_REMOTE);
-    svc->addFunction("ResetMapHashes", ResetMapHashes, SF_ALLOW_REMOTE);
     svc->addFunction("GetItemList", GetItemList, SF_ALLOW_REMOTE);
     svc->addFunction("GetBuildingDefList", GetBuildingDefList, SF_ALLOW_REMOTE);
     svc->addFunction("GetWorldMap", GetWorldMap, SF_ALLOW_REMOTE);
     svc->addFunction("GetWorldMapNew", GetWorldMapNew, SF_ALLOW_REMOTE);
     svc->addFunction("GetRegionMaps", GetRegionMaps, SF_ALLOW_REMOTE);
     svc->addFunction("GetRegionMapsNew", GetRegionMapsNew, SF_ALLOW_REMOTE);
-    svc->addFunction("GetCreatureRaws", GetCreatureRaws, SF_ALLOW_REMOTE);
+    svc->addStreamingFunction("GetCreatureRaws", GetCreatureRaws, SF_ALLOW_REMOTE | SF_DONT_SUSPEND);
     svc->addFunction("GetPartialCreatureRaws", GetPartialCreatureRaws, SF_ALLOW_REMOTE);
     svc->addFunction("GetWorldMapCenter", GetWorldMapCenter, SF_ALLOW_REMOTE);
     svc->addFunction("GetPlantRaws", GetPlantRaws, SF_ALLOW_REMOTE);
@@ -301,6 +379,15 @@ DFhackCExport command_result plugin_shutdown(color_ostream &out)
 DFhackCExport command_result plugin_onupdate(color_ostream &out)
 {
     KeyUpdate();
+    if (Maps::IsValid())
+        blockTracker.sweep();
+    return CR_OK;
+}
+
+DFhackCExport command_result plugin_onstatechange(color_ostream &out, state_change_event event)
+{
+    if (event == SC_MAP_UNLOADED)
+        blockTracker.clear();
     return CR_OK;
 }
 
@@ -647,45 +734,7 @@ void CopyMat(RemoteFortressReader::MatPair * mat, int type, int index)
 
 }
 
-std::map<DFCoord, uint16_t> hashes;
-
-bool IsTiletypeChanged(DFCoord pos)
-{
-    uint16_t hash;
-    df::map_block * block = Maps::getBlock(pos);
-    if (block)
-        hash = fletcher16((uint8_t*)(block->tiletype), 16 * 16 * (sizeof(df::enums::tiletype::tiletype)));
-    else
-        hash = 0;
-    if (hashes[pos] != hash)
-    {
-        hashes[pos] = hash;
-        return true;
-    }
-    return false;
-}
-
-std::map<DFCoord, uint16_t> waterHashes;
-
-bool IsDesignationChanged(DFCoord pos)
-{
-    uint16_t hash;
-    df::map_block * block = Maps::getBlock(pos);
-    if (block)
-        hash = fletcher16((uint8_t*)(block->designation), 16 * 16 * (sizeof(df::tile_designation)));
-    else
-        hash = 0;
-    if (waterHashes[pos] != hash)
-    {
-        waterHashes[pos] = hash;
-        return true;
-    }
-    return false;
-}
-
-std::map<DFCoord, uint8_t> buildingHashes;
-
-bool IsBuildingChanged(DFCoord pos)
+bool ClientSession::IsBuildingChanged(DFCoord pos)
 {
     df::map_block * block = Maps::getBlock(pos);
     bool changed = false;
@@ -702,46 +751,7 @@ bool IsBuildingChanged(DFCoord pos)
     return changed;
 }
 
-std::map<DFCoord, uint16_t> spatterHashes;
-
-bool IsspatterChanged(DFCoord pos)
-{
-    df::map_block * block = Maps::getBlock(pos);
-    std::vector<df::block_square_event_material_spatterst *> materials;
-#if DF_VERSION_INT > 34011
-    std::vector<df::block_square_event_item_spatterst *> items;
-    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL, NULL, &items))
-        return false;
-#else
-    if (!Maps::SortBlockEvents(block, NULL, NULL, &materials, NULL, NULL))
-        return false;
-#endif
-
-    uint16_t hash = 0;
-
-    for (size_t i = 0; i < materials.size(); i++)
-    {
-        auto mat = materials[i];
-        hash ^= fletcher16((uint8_t*)mat, sizeof(df::block_square_event_material_spatterst));
-    }
-#if DF_VERSION_INT > 34011
-    for (size_t i = 0; i < items.size(); i++)
-    {
-        auto item = items[i];
-        hash ^= fletcher16((uint8_t*)item, sizeof(df::block_square_event_item_spatterst));
-    }
-#endif
-    if (spatterHashes[pos] != hash)
-    {
-        spatterHashes[pos] = hash;
-        return true;
-    }
-    return false;
-}
-
-std::map<int, uint16_t> itemHashes;
-
-bool isItemChanged(int i)
+bool ClientSession::isItemChanged(int i)
 {
     uint16_t hash = 0;
     auto item = df::item::find(i);
@@ -757,7 +767,7 @@ bool isItemChanged(int i)
     return false;
 }
 
-bool areItemsChanged(std::vector<int> * items)
+bool ClientSession::areItemsChanged(std::vector<int> * items)
 {
     bool result = false;
     for (size_t i = 0; i < items->size(); i++)
@@ -768,9 +778,7 @@ bool areItemsChanged(std::vector<int> * items)
     return result;
 }
 
-std::map<int, int> engravingHashes;
-
-bool isEngravingNew(int index)
+bool ClientSession::isEngravingNew(int index)
 {
     if (engravingHashes[index])
         return false;
@@ -778,20 +786,17 @@ bool isEngravingNew(int index)
     return true;
 }
 
-void engravingIsNotNew(int index)
+void ClientSession::engravingIsNotNew(int index)
 {
     engravingHashes[index] = false;
 }
 
-static command_result ResetMapHashes(color_ostream &stream, const EmptyMessage *in)
+void ClientSession::reset()
 {
-    hashes.clear();
-    waterHashes.clear();
+    blockTracker.unwatch(id);
     buildingHashes.clear();
-    spatterHashes.clear();
     itemHashes.clear();
     engravingHashes.clear();
-    return CR_OK;
 }
 
 df::matter_state GetState(df::material * mat, uint16_t temp = 10015)
@@ -1374,29 +1379,41 @@ void CopyFlows(df::map_block * DfBlock, RemoteFortressReader::MapBlock * NetBloc
     }
 }
 
-static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out)
+static command_result GetBlockList(color_ostream &stream, const BlockRequest *in, BlockList *out, ClientSession &session)
 {
     int x, y, z;
     DFHack::Maps::getPosition(x, y, z);
     out->set_map_x(x);
     out->set_map_y(y);
+    out->set_session_id(session.id);
+    blockTracker.stats.requests++;
+
+    // the request comes from the network; keep it inside the map, so it fits
+    // in a DFCoord and can't make the tracker allocate more than the map
+    uint32_t size_x, size_y, size_z;
+    Maps::getSize(size_x, size_y, size_z);
+    int min_x = std::clamp<int>(in->min_x(), 0, size_x);
+    int min_y = std::clamp<int>(in->min_y(), 0, size_y);
+    int min_z = std::clamp<int>(in->min_z(), 0, size_z);
+    int max_x = std::clamp<int>(in->max_x(), 0, size_x);
+    int max_y = std::clamp<int>(in->max_y(), 0, size_y);
+    int max_z = std::clamp<int>(in->max_z(), 0, size_z);
+
+    auto sentBlocks = blockTracker.watch(session.id, DFCoord(min_x, min_y, min_z), DFCoord(max_x, max_y, max_z));
+    if (!sentBlocks)
+        return CR_OK; // nothing of the map is in the requested area
+
     MapExtras::MapCache MC;
-    int center_x = (in->min_x() + in->max_x()) / 2;
-    int center_y = (in->min_y() + in->max_y()) / 2;
+    int center_x = (min_x + max_x) / 2;
+    int center_y = (min_y + max_y) / 2;
 
-    int NUMBER_OF_POINTS = ((in->max_x() - center_x + 1) * 2) * ((in->max_y() - center_y + 1) * 2);
+    int NUMBER_OF_POINTS = ((max_x - center_x + 1) * 2) * ((max_y - center_y + 1) * 2);
     int blocks_needed;
     if (in->has_blocks_needed())
         blocks_needed = in->blocks_needed();
     else
-        blocks_needed = NUMBER_OF_POINTS * (in->max_z() - in->min_z());
+        blocks_needed = NUMBER_OF_POINTS * (max_z - min_z);
     int blocks_sent = 0;
-    int min_x = in->min_x();
-    int min_y = in->min_y();
-    int max_x = in->max_x();
-    int max_y = in->max_y();
-    int min_z = in->min_z();
-    int max_z = in->max_z();
     bool forceReload = in->force_reload();
     bool firstBlock = true; //Always send all the buildings needed on the first block, and none on the rest.
                                 //stream.print("Got request for blocks from (%d, %d, %d) to (%d, %d, %d).\n", in->min_x(), in->min_y(), in->min_z(), in->max_x(), in->max_y(), in->max_z());
@@ -1437,11 +1454,13 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
                 ItsAir:
                     if (block->flows.size() > 0)
                         nonAir = true;
+                    blockTracker.stats.blocks_scanned++;
                     if (nonAir || firstBlock)
                     {
-                        bool tileChanged = IsTiletypeChanged(pos);
-                        bool desChanged = IsDesignationChanged(pos);
-                        bool spatterChanged = IsspatterChanged(pos);
+                        blockTracker.refresh(pos);
+                        bool tileChanged = blockTracker.takeChanged(*sentBlocks, pos, BlockTracker::TILES);
+                        bool desChanged = blockTracker.takeChanged(*sentBlocks, pos, BlockTracker::DESIGNATIONS);
+                        bool spatterChanged = blockTracker.takeChanged(*sentBlocks, pos, BlockTracker::SPATTERS);
                         bool itemsChanged = block->items.size() > 0;
                         bool flows = block->flows.size() > 0;
                         RemoteFortressReader::MapBlock *net_block = nullptr;
@@ -1456,6 +1475,7 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
                         {
                             CopyBlock(block, net_block, &MC, pos);
                             blocks_sent++;
+                            blockTracker.stats.blocks_sent++;
                         }
                         if (desChanged || forceReload)
                             CopyDesignation(block, net_block, &MC, pos);
@@ -1510,7 +1530,7 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
             continue;
         if (engraving->pos.z < min_z || engraving->pos.z > max_z)
             continue;
-        if (!isEngravingNew(i))
+        if (!session.isEngravingNew(i))
             continue;
 
         df::art_image_chunk * chunk = NULL;
@@ -1529,7 +1549,7 @@ static command_result GetBlockList(color_ostream &stream, const BlockRequest *in
         }
         if (!chunk)
         {
-            engravingIsNotNew(i);
+            session.engravingIsNotNew(i);
             continue;
         }
         auto netEngraving = out->add_engravings();
@@ -2597,9 +2617,34 @@ static command_result GetRegionMapsNew(color_ostream &stream, const EmptyMessage
     return CR_OK;
 }
 
-static command_result GetCreatureRaws(color_ostream &stream, const EmptyMessage *in, CreatureRawList *out)
+static command_result GetCreatureRaws(color_ostream &stream, const EmptyMessage *in, RPCReplyStream<CreatureRawList> &reply)
 {
-    return GetPartialCreatureRaws(stream, NULL, out);
+    // The full list is tens of megabytes, so it is sent in slices. The core
+    // is only suspended while a slice is copied; earlier slices are written
+    // to the socket in the meantime.
+    const int SLICE_SIZE = 64;
+
+    ListRequest request;
+    for (int start = 0; ; start += SLICE_SIZE)
+    {
+        CreatureRawList part;
+        {
+            CoreSuspender suspend;
+            if (!df::global::world)
+                return CR_FAILURE;
+            if (size_t(start) >= df::global::world->raws.creatures.all.size())
+                break;
+
+            request.set_list_start(start);
+            request.set_list_end(start + SLICE_SIZE);
+            command_result res = GetPartialCreatureRaws(stream, &request, &part);
+            if (res != CR_OK)
+                return res;
+        }
+        if (!reply.write(part))
+            return CR_LINK_FAILURE;
+    }
+    return CR_OK;
 }
 
 static command_result GetPartialCreatureRaws(color_ostream &stream, const ListRequest *in, CreatureRawList *out)
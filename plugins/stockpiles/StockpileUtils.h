@@ -2,6 +2,7 @@
 
 #include "LuaTools.h"
 #include "MiscUtils.h"
+#include "modules/Materials.h"
 
 #include "df/world.h"
 #include "df/creature_raw.h"
@@ -27,7 +28,7 @@ static inline df::creature_raw* find_creature(int32_t idx) {
  * @return -1 if not found
  */
 static inline int16_t find_creature(const std::string& creature_id) {
-    return linear_index(df::global::world->raws.creatures.all, &df::creature_raw::creature_id, creature_id);
+    return DFHack::findCreatureIndex(creature_id);
 }
 
 /**
@@ -42,7 +43,7 @@ static inline df::plant_raw* find_plant(size_t idx) {
  * @return -1 if not found
  */
 static inline size_t find_plant(const std::string& plant_id) {
-    return linear_index(df::global::world->raws.plants.all, &df::plant_raw::id, plant_id);
+    return DFHack::findPlantIndex(plant_id);
 }
 
 struct less_than_no_case {
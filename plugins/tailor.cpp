@@ -9,6 +9,7 @@
 #include "PluginManager.h"
 #include "PluginLua.h"
 
+#include "modules/Items.h"
 #include "modules/Materials.h"
 #include "modules/Persistence.h"
 #include "modules/Units.h"
@@ -204,21 +205,21 @@ public:
 
     void scan_clothing()
     {
-        for (auto i : world->items.other[df::items_other_id::ANY_GOES_IN_CABINET])
+        for (auto &entry : itemTypeMap)
         {
-            if (i->flags.whole & badFlags.whole)
-            {
-                continue;
-            }
-            if (i->getWear() >= 1)
-                continue;
-            if (i->getMakerRace() < 0) // sometimes we get borked items with no valid maker race
-                continue;
-
-            df::item_type t = i->getType();
-            int size = world->raws.creatures.all[i->getMakerRace()]->adultsize;
-
-            available[std::make_pair(t, size)] += 1;
+            df::item_type t = entry.first;
+            Items::forEachCensusCount(t, [&](const ItemCensusKey &key, const ItemCensusCount &count) {
+                if (key.flags & badFlags.whole)
+                    return;
+                if (key.wear >= 1)
+                    return;
+                if (key.maker_race < 0) // sometimes we get borked items with no valid maker race
+                    return;
+
+                int size = world->raws.creatures.all[key.maker_race]->adultsize;
+
+                available[std::make_pair(t, size)] += count.items;
+            });
         }
 
         if (DBG_NAME(cycle).isEnabled(DebugCategory::LDEBUG))
@@ -273,12 +274,7 @@ public:
             }
         }
 
-        for (auto i : world->items.other[df::items_other_id::SKIN_TANNED])
-        {
-            if (i->flags.whole & badFlags.whole)
-                continue;
-            supply[M_LEATHER] += i->getStackSize();
-        }
+        supply[M_LEATHER] += Items::getCensusCount(df::item_type::SKIN_TANNED, -1, -1, -1, badFlags.whole).stack;
 
         DEBUG(cycle).print("tailor: available silk %d yarn %d cloth %d leather %d adamantine %d\n",
             supply[M_SILK], supply[M_YARN], supply[M_CLOTH], supply[M_LEATHER], supply[M_ADAMANTINE]);
@@ -0,0 +1,55 @@
+config.target = 'core'
+config.mode = 'fortress'
+
+-- the scan getBuildingsInBox replaces
+local function linear_scan(box, include_civzones)
+    local ids = {}
+    for _, bld in ipairs(df.global.world.buildings.all) do
+        if (include_civzones or bld:getType() ~= df.building_type.Civzone) and
+                bld.z >= box[3] and bld.z <= box[6] and
+                math.max(bld.x1, bld.x2) >= box[1] and math.min(bld.x1, bld.x2) <= box[4] and
+                math.max(bld.y1, bld.y2) >= box[2] and math.min(bld.y1, bld.y2) <= box[5] then
+            table.insert(ids, bld.id)
+        end
+    end
+    table.sort(ids)
+    return ids
+end
+
+local function index_lookup(box, include_civzones)
+    local ids = {}
+    for _, bld in ipairs(dfhack.buildings.getBuildingsInBox(
+            box[1], box[2], box[3], box[4], box[5], box[6], include_civzones)) do
+        table.insert(ids, bld.id)
+    end
+    table.sort(ids)
+    return ids
+end
+
+function test.getBuildingsInBox()
+    local x, y, z = dfhack.maps.getTileSize()
+    local boxes = {
+        {0, 0, 0, x-1, y-1, z-1},
+        -- reaching past the edges of the map
+        {-100, -100, -10, x+100, y+100, z+10},
+        {-30000, -30000, -30000, 30000, 30000, 30000},
+        {x-20, y-20, 0, x+20, y+20, z-1},
+        -- smaller than a block, spanning block edges
+        {15, 15, 0, 16, 16, z-1},
+        -- entirely off the map
+        {x+1, y+1, 0, x+50, y+50, z-1},
+    }
+    -- boxes around existing buildings, so the test finds something even on
+    -- large maps
+    for i, bld in ipairs(df.global.world.buildings.all) do
+        if i % 7 == 0 then
+            table.insert(boxes, {bld.x1 - 3, bld.y1 - 20, bld.z, bld.x2 + 17, bld.y2, bld.z + 1})
+        end
+    end
+
+    for _, box in ipairs(boxes) do
+        local label = table.concat(box, ',')
+        expect.table_eq(index_lookup(box, true), linear_scan(box, true), label)
+        expect.table_eq(index_lookup(box, false), linear_scan(box, false), label)
+    end
+end
@@ -0,0 +1,60 @@
+config.target = 'core'
+config.mode = 'fortress'
+
+local function scan(itype, exclude_flags, max_wear)
+    local items, stack = 0, 0
+    for _, item in ipairs(df.global.world.items.other.IN_PLAY) do
+        if item:getType() == itype and
+                (item.flags.whole & exclude_flags) == 0 and
+                item:getWear() <= max_wear then
+            items = items + 1
+            stack = stack + item:getStackSize()
+        end
+    end
+    return items, stack
+end
+
+local function flag_mask(...)
+    local mask = 0
+    for _, name in ipairs{...} do
+        mask = mask | (1 << df.item_flags[name])
+    end
+    return mask
+end
+
+function test.matches_scan()
+    local exclude = flag_mask('forbid', 'dump', 'in_job', 'owned')
+    expect.eq(exclude & dfhack.items.getCensusFlags(), exclude)
+    for _, itype in ipairs{df.item_type.BOULDER, df.item_type.WOOD, df.item_type.SEEDS,
+                           df.item_type.ARMOR, df.item_type.CLOTH, df.item_type.BAR} do
+        local name = df.item_type[itype]
+        local items, stack = scan(itype, 0, 3)
+        expect.table_eq({dfhack.items.getCensusCount(itype)}, {items, stack}, name)
+        items, stack = scan(itype, exclude, 0)
+        expect.table_eq({dfhack.items.getCensusCount(itype, -1, -1, -1, exclude, 0)}, {items, stack}, name)
+    end
+end
+
+function test.tracks_flag_changes()
+    local item
+    for _, candidate in ipairs(df.global.world.items.other.IN_PLAY) do
+        if not candidate.flags.forbid and candidate:getType() == df.item_type.BOULDER then
+            item = candidate
+            break
+        end
+    end
+    if not item then return end
+
+    local mask = flag_mask('forbid')
+
+    local itype = item:getType()
+    local before = dfhack.items.getCensusCount(itype, -1, -1, -1, mask)
+    dfhack.with_finalize(
+        function() item.flags.forbid = false end,
+        function()
+            item.flags.forbid = true
+            -- the census is swept once per frame
+            delay()
+            expect.eq(dfhack.items.getCensusCount(itype, -1, -1, -1, mask), before - 1)
+        end)
+end
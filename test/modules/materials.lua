@@ -0,0 +1,79 @@
+config.target = 'core'
+
+-- mirrors MaterialInfo::CREATURE_BASE and PLANT_BASE
+local CREATURE_BASE = 19
+local PLANT_BASE = 419
+
+local raws = df.global.world.raws
+
+-- the scans the token lookups used to do; the first match wins
+local function linear_index(vec, field, token)
+    for i, obj in ipairs(vec) do
+        if obj and obj[field] == token then return i end
+    end
+    return -1
+end
+
+function test.builtin()
+    for i = 0, CREATURE_BASE - 1 do
+        local mat = raws.mat_table.builtin[i]
+        if mat then
+            local info = dfhack.matinfo.find(mat.id)
+            expect.eq(info.type, linear_index(raws.mat_table.builtin, 'id', mat.id), mat.id)
+        end
+    end
+end
+
+function test.inorganic()
+    for _, raw in ipairs(raws.inorganics.all) do
+        local info = dfhack.matinfo.find('INORGANIC:' .. raw.id)
+        expect.eq(info.index, linear_index(raws.inorganics.all, 'id', raw.id), raw.id)
+    end
+    expect.nil_(dfhack.matinfo.find('INORGANIC:NOT_A_RAW_TOKEN'))
+end
+
+function test.plant()
+    for _, raw in ipairs(raws.plants.all) do
+        local pidx = linear_index(raws.plants.all, 'id', raw.id)
+        for _, mat in ipairs(raw.material) do
+            local token = 'PLANT:' .. raw.id .. ':' .. mat.id
+            local info = dfhack.matinfo.find(token)
+            expect.eq(info.index, pidx, token)
+            expect.eq(info.type, PLANT_BASE + linear_index(raw.material, 'id', mat.id), token)
+        end
+        expect.nil_(dfhack.matinfo.find('PLANT:' .. raw.id .. ':NOT_A_RAW_TOKEN'))
+    end
+    expect.nil_(dfhack.matinfo.find('PLANT:NOT_A_RAW_TOKEN:WOOD'))
+end
+
+function test.creature()
+    for _, raw in ipairs(raws.creatures.all) do
+        local cidx = linear_index(raws.creatures.all, 'creature_id', raw.creature_id)
+        for _, mat in ipairs(raw.material) do
+            local token = 'CREATURE:' .. raw.creature_id .. ':' .. mat.id
+            local info = dfhack.matinfo.find(token)
+            expect.eq(info.index, cidx, token)
+            expect.eq(info.type, CREATURE_BASE + linear_index(raw.material, 'id', mat.id), token)
+        end
+    end
+    expect.nil_(dfhack.matinfo.find('CREATURE:NOT_A_RAW_TOKEN:SKIN'))
+end
+
+function test.itemdef()
+    local types = {
+        WEAPON='weapons', TRAPCOMP='trapcomps', TOY='toys', TOOL='tools',
+        INSTRUMENT='instruments', ARMOR='armor', AMMO='ammo',
+        SIEGEAMMO='siege_ammo', GLOVES='gloves', SHOES='shoes',
+        SHIELD='shields', HELM='helms', PANTS='pants', FOOD='food',
+    }
+    for type, field in pairs(types) do
+        local defs = raws.itemdefs[field]
+        for _, def in ipairs(defs) do
+            local token = type .. ':' .. def.id
+            expect.eq(dfhack.items.findType(token), df.item_type[type], token)
+            expect.eq(dfhack.items.findSubtype(token), linear_index(defs, 'id', def.id), token)
+        end
+        expect.eq(dfhack.items.findSubtype(type .. ':NOT_A_RAW_TOKEN'), -1)
+    end
+    expect.eq(dfhack.items.findSubtype('BOULDER:NONE'), -1)
+end
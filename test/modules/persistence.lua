@@ -0,0 +1,30 @@
+config.target = 'core'
+config.mode = 'fortress'
+
+local KEY = 'dfhack-test/persistence'
+
+local function with_world_data(fn)
+    dfhack.persistent.saveWorldDataString(KEY, '')
+    dfhack.with_finalize(
+        function() dfhack.persistent.deleteWorldData(KEY) end,
+        fn)
+end
+
+-- the handles Lua gets items through must notice when an item is deleted,
+-- and must not pick up a new item saved under the same key as the old one
+function test.read_after_delete()
+    with_world_data(function()
+        dfhack.persistent.saveWorldDataString(KEY, 'first')
+        for _ = 1, 1000 do
+            expect.eq(dfhack.persistent.getWorldDataString(KEY), 'first')
+        end
+        expect.true_(dfhack.persistent.deleteWorldData(KEY))
+        expect.nil_(dfhack.persistent.getWorldDataString(KEY))
+        expect.false_(dfhack.persistent.deleteWorldData(KEY))
+
+        dfhack.persistent.saveWorldDataString(KEY, 'second')
+        expect.eq(dfhack.persistent.getWorldDataString(KEY), 'second')
+        dfhack.persistent.saveWorldDataString(KEY, 'third')
+        expect.eq(dfhack.persistent.getWorldDataString(KEY), 'third')
+    end)
+end
@@ -0,0 +1,117 @@
+config.target = 'core'
+config.mode = 'title' -- alters world state, not safe when a world is loaded
+
+local NUM_UNITS = 2000
+
+-- fills the active unit vector with units scattered over a 192x192x100 area.
+-- the unit index is rebuilt once per frame, so wait for a new frame after
+-- changing the vector, like the game would
+local function with_units(fn)
+    local active = df.global.world.units.active
+    if not expect.eq(#active, 0, 'active unit list is not empty') then return end
+    local units = {}
+    local seed = 1
+    local function rand(n)
+        seed = (seed * 1103515245 + 12345) % 2147483648
+        return seed % n
+    end
+    for i = 1, NUM_UNITS do
+        local unit = df.unit:new()
+        unit.id = i
+        unit.pos = xyz2pos(rand(192), rand(192), rand(100))
+        unit.flags1.inactive = rand(10) == 0
+        active:insert('#', unit)
+        units[i] = unit
+    end
+    delay()
+    dfhack.with_finalize(
+        function()
+            active:resize(0)
+            for _, unit in ipairs(units) do unit:delete() end
+        end,
+        function() fn(units) end)
+    delay()
+end
+
+local function ids(units)
+    local ret = {}
+    for _, unit in ipairs(units) do table.insert(ret, unit.id) end
+    return ret
+end
+
+local function dist2(pos, unit)
+    local dx, dy, dz = pos.x - unit.pos.x, pos.y - unit.pos.y, pos.z - unit.pos.z
+    return dx*dx + dy*dy + dz*dz
+end
+
+local function odd_id(unit) return unit.id % 2 == 1 end
+
+function test.getUnitsInBox()
+    with_units(function(units)
+        for _, box in ipairs{{10, 10, 5, 60, 40, 30}, {0, 0, 0, 191, 191, 99}, {100, 100, 50, 100, 100, 50}} do
+            local expected = {}
+            for _, unit in ipairs(units) do
+                if not unit.flags1.inactive and odd_id(unit) and
+                        unit.pos.x >= box[1] and unit.pos.x <= box[4] and
+                        unit.pos.y >= box[2] and unit.pos.y <= box[5] and
+                        unit.pos.z >= box[3] and unit.pos.z <= box[6] then
+                    table.insert(expected, unit.id)
+                end
+            end
+            local found = dfhack.units.getUnitsInBox(box[1], box[2], box[3], box[4], box[5], box[6], odd_id)
+            expect.table_eq(ids(found), expected)
+        end
+    end)
+end
+
+function test.getUnitsInRadius()
+    with_units(function(units)
+        local pos = xyz2pos(90, 100, 50)
+        for _, radius in ipairs{0, 5, 30, 200} do
+            local expected = {}
+            for _, unit in ipairs(units) do
+                if not unit.flags1.inactive and dist2(pos, unit) <= radius * radius then
+                    table.insert(expected, unit.id)
+                end
+            end
+            expect.table_eq(ids(dfhack.units.getUnitsInRadius(pos, radius)), expected)
+        end
+    end)
+end
+
+function test.getNearestUnits()
+    with_units(function(units)
+        local pos = xyz2pos(20, 150, 10)
+        local sorted = {}
+        for _, unit in ipairs(units) do
+            if not unit.flags1.inactive and odd_id(unit) then table.insert(sorted, unit) end
+        end
+        table.sort(sorted, function(a, b)
+            local da, db = dist2(pos, a), dist2(pos, b)
+            return da < db or (da == db and a.id < b.id)
+        end)
+        for _, count in ipairs{1, 10, 100, NUM_UNITS} do
+            local expected = {}
+            for i = 1, math.min(count, #sorted) do table.insert(expected, sorted[i].id) end
+            expect.table_eq(ids(dfhack.units.getNearestUnits(pos, count, odd_id)), expected)
+        end
+        expect.table_eq(dfhack.units.getNearestUnits(pos, 0), {})
+    end)
+end
+
+-- many small boxes, so that queries start and end on every block boundary
+function test.getUnitsInBox_many()
+    with_units(function(units)
+        for i = 1, 500 do
+            local x, y, z = i * 7 % 172, i * 13 % 172, i % 100
+            local expected = {}
+            for _, unit in ipairs(units) do
+                if dfhack.units.isUnitInBox(unit, x, y, z, x + 20, y + 20, z) then
+                    table.insert(expected, unit.id)
+                end
+            end
+            expect.table_eq(ids(dfhack.units.getUnitsInBox(x, y, z, x + 20, y + 20, z)), expected,
+                ('box at %d,%d,%d'):format(x, y, z))
+        end
+    end)
+end
@@ -0,0 +1,48 @@
+config.target = 'core'
+config.mode = 'fortress'
+
+local function units()
+    return df.global.world.units.all
+end
+
+function test.matches_item_reads()
+    local vec = units()
+    if not expect.gt(#vec, 0, 'no units to read') then return end
+    local ids, xs, inactive = dfhack.columns(vec, {'id', 'pos.x', 'flags1.inactive'})
+    expect.eq(#ids, #vec)
+    for i, unit in ipairs(vec) do
+        expect.eq(ids[i+1], unit.id)
+        expect.eq(xs[i+1], unit.pos.x)
+        expect.eq(inactive[i+1], unit.flags1.inactive)
+    end
+end
+
+function test.no_columns()
+    expect.eq(select('#', dfhack.columns(units(), {})), 0)
+end
+
+function test.unknown_field()
+    expect.error_match('field not found', function()
+        dfhack.columns(units(), {'nonexistent'})
+    end)
+    expect.error_match('unknown bit', function()
+        dfhack.columns(units(), {'flags1.nonexistent'})
+    end)
+end
+
+function test.non_primitive_field()
+    expect.error_match('not a primitive field', function()
+        dfhack.columns(units(), {'pos'})
+    end)
+    expect.error_match('only embedded structures', function()
+        dfhack.columns(units(), {'id.x'})
+    end)
+end
+
+function test.not_a_struct_container()
+    dfhack.with_temp_object(df.coord_path:new(), function(path)
+        expect.error_match('container of structures', function()
+            dfhack.columns(path.x, {'id'})
+        end)
+    end)
+end
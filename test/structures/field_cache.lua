@@ -0,0 +1,74 @@
+config.target = 'core'
+
+local function with_temp_coord(func)
+    dfhack.with_temp_object(df.coord:new(), func)
+end
+
+function test.repeated_reads()
+    with_temp_coord(function(pos)
+        pos.x, pos.y, pos.z = 1, 2, 3
+        for _ = 1, 100 do
+            expect.eq(pos.x + pos.y + pos.z, 6)
+        end
+    end)
+end
+
+function test.repeated_writes()
+    with_temp_coord(function(pos)
+        for i = 1, 100 do
+            pos.x = i
+            expect.eq(pos.x, i)
+        end
+    end)
+end
+
+function test.computed_names()
+    with_temp_coord(function(pos)
+        pos.y = 5
+        local prefix = 'y'
+        for _ = 1, 10 do
+            expect.eq(pos[prefix .. ''], 5)
+        end
+    end)
+end
+
+function test.same_name_different_types()
+    with_temp_coord(function(pos)
+        dfhack.with_temp_object(df.coord2d:new(), function(pos2d)
+            pos.x = 10
+            pos2d.x = 20
+            for _ = 1, 10 do
+                expect.eq(pos.x, 10)
+                expect.eq(pos2d.x, 20)
+            end
+        end)
+    end)
+end
+
+function test.methods_after_fields()
+    with_temp_coord(function(pos)
+        pos:clear()
+        expect.false_(pos:isValid())
+        pos.x, pos.y, pos.z = 1, 1, 1
+        expect.eq(type(pos.isValid), 'function')
+        expect.true_(pos:isValid())
+    end)
+end
+
+function test.missing_field_after_cached_fields()
+    with_temp_coord(function(pos)
+        expect.eq(pos.x, pos.x)
+        expect.error_match('not found', function() return pos.nonexistent end)
+        expect.error_match('not found', function() pos.nonexistent = 1 end)
+        expect.eq(pos.x, pos.x)
+    end)
+end
+
+function test.wrong_type_after_cached_fields()
+    with_temp_coord(function(pos)
+        pos.x = 1
+        expect.error(function() pos.x = 'foo' end)
+        expect.eq(pos.x, 1)
+    end)
+end
+